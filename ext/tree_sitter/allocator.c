@@ -0,0 +1,169 @@
+#include "tree_sitter.h"
+
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#define memory_usable_size(ptr) malloc_size(ptr)
+#else
+#include <malloc.h>
+#define memory_usable_size(ptr) malloc_usable_size(ptr)
+#endif
+
+extern VALUE mTreeSitter;
+
+// Process-wide counters, updated by every allocation tree-sitter makes.
+//
+// We rely on the libc's usable size instead of prefixing blocks with a header
+// so that memory handed out by tree-sitter can still be released with a plain
+// +free+, and blocks allocated before the allocator was installed don't crash
+// us.
+static ssize_t live_bytes = 0;
+static ssize_t peak_bytes = 0;
+static size_t total_bytes = 0;
+static size_t allocations = 0;
+static size_t frees = 0;
+
+// What we last told the ruby GC about; only touched while holding the GVL.
+static ssize_t reported_bytes = 0;
+
+// The innermost scope of the current thread, if any.
+static __thread memory_scope_t *current_scope = NULL;
+
+static void memory_track(ssize_t bytes) {
+  ssize_t live = __atomic_add_fetch(&live_bytes, bytes, __ATOMIC_RELAXED);
+
+  if (bytes > 0) {
+    __atomic_add_fetch(&total_bytes, (size_t)bytes, __ATOMIC_RELAXED);
+    ssize_t peak = __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&peak_bytes, &peak, live, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+  }
+
+  if (current_scope != NULL) {
+    current_scope->bytes += bytes;
+  }
+}
+
+static void memory_abort(size_t size) {
+  fprintf(stderr, "tree-sitter failed to allocate %zu bytes\n", size);
+  abort();
+}
+
+static void *memory_malloc(size_t size) {
+  void *ptr = malloc(size);
+  if (ptr == NULL && size > 0) {
+    memory_abort(size);
+  }
+  __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+  memory_track((ssize_t)memory_usable_size(ptr));
+  return ptr;
+}
+
+static void *memory_calloc(size_t count, size_t size) {
+  void *ptr = calloc(count, size);
+  if (ptr == NULL && count > 0 && size > 0) {
+    memory_abort(count * size);
+  }
+  __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+  memory_track((ssize_t)memory_usable_size(ptr));
+  return ptr;
+}
+
+static void *memory_realloc(void *ptr, size_t size) {
+  ssize_t old_size = ptr == NULL ? 0 : (ssize_t)memory_usable_size(ptr);
+  void *res = realloc(ptr, size);
+  if (res == NULL && size > 0) {
+    memory_abort(size);
+  }
+  if (ptr == NULL) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+  }
+  memory_track((ssize_t)memory_usable_size(res) - old_size);
+  return res;
+}
+
+/**
+ * Release memory allocated by tree-sitter, e.g. the strings returned by
+ * +ts_node_string+ or the ranges returned by +ts_tree_get_changed_ranges+.
+ */
+void memory_free(void *ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  __atomic_add_fetch(&frees, 1, __ATOMIC_RELAXED);
+  memory_track(-(ssize_t)memory_usable_size(ptr));
+  free(ptr);
+}
+
+/**
+ * Report the bytes allocated or released by tree-sitter since the last call
+ * to the ruby GC, so it can schedule collections accordingly.
+ *
+ * Must be called while holding the GVL.
+ */
+void memory_gc_sync(void) {
+  ssize_t live = __atomic_load_n(&live_bytes, __ATOMIC_RELAXED);
+  ssize_t diff = live - reported_bytes;
+  if (diff != 0) {
+    reported_bytes = live;
+    rb_gc_adjust_memory_usage(diff);
+  }
+}
+
+/**
+ * Start attributing the current thread's allocations to +scope+.
+ *
+ * Scopes nest: allocations are only attributed to the innermost one, so
+ * releasing an unrelated object (e.g. from the GC) while parsing doesn't
+ * skew the numbers of the parse.
+ */
+void memory_scope_begin(memory_scope_t *scope) {
+  scope->bytes = 0;
+  scope->parent = current_scope;
+  current_scope = scope;
+}
+
+/**
+ * Stop attributing allocations to +scope+.
+ *
+ * @return the net number of bytes allocated while the scope was active.
+ */
+ssize_t memory_scope_end(memory_scope_t *scope) {
+  current_scope = scope->parent;
+  return scope->bytes;
+}
+
+/**
+ * Statistics about the memory held by tree-sitter across the process.
+ *
+ * - +live_bytes+: bytes currently allocated.
+ * - +peak_bytes+: the highest +live_bytes+ observed.
+ * - +total_bytes+: bytes allocated since the extension was loaded.
+ * - +allocations+: number of allocations.
+ * - +frees+: number of deallocations.
+ *
+ * @return [Hash<Symbol, Integer>]
+ */
+static VALUE memory_stats(VALUE self) {
+  VALUE res = rb_hash_new();
+  rb_hash_aset(res, ID2SYM(rb_intern("live_bytes")),
+               SSIZET2NUM(__atomic_load_n(&live_bytes, __ATOMIC_RELAXED)));
+  rb_hash_aset(res, ID2SYM(rb_intern("peak_bytes")),
+               SSIZET2NUM(__atomic_load_n(&peak_bytes, __ATOMIC_RELAXED)));
+  rb_hash_aset(res, ID2SYM(rb_intern("total_bytes")),
+               SIZET2NUM(__atomic_load_n(&total_bytes, __ATOMIC_RELAXED)));
+  rb_hash_aset(res, ID2SYM(rb_intern("allocations")),
+               SIZET2NUM(__atomic_load_n(&allocations, __ATOMIC_RELAXED)));
+  rb_hash_aset(res, ID2SYM(rb_intern("frees")),
+               SIZET2NUM(__atomic_load_n(&frees, __ATOMIC_RELAXED)));
+  return res;
+}
+
+void init_allocator(void) {
+  // This must happen before any other call to tree-sitter.
+  ts_set_allocator(memory_malloc, memory_calloc, memory_realloc, memory_free);
+
+  /* Module methods */
+  rb_define_module_function(mTreeSitter, "memory_stats", memory_stats, 0);
+}
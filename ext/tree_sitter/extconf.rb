@@ -79,6 +79,26 @@ if !header || !library
   MSG
 end
 
+# ################################## #
+#           Static grammars          #
+# ################################## #
+
+# --enable-static-grammars links all the grammars of parsers.toml into the
+# extension, --enable-static-grammars=ruby,json only some of them.
+# --with-parsers-toml=path/to/parsers.toml overrides the one of this repo.
+if (static_grammars = enable_config('static-grammars', false))
+  require_relative 'grammars'
+
+  toml = Pathname(with_config('parsers-toml', File.expand_path('../../parsers.toml', __dir__)))
+  only = static_grammars.is_a?(String) ? static_grammars.split(',').map(&:strip) : nil
+  grammars = TreeSitter::Grammars.new(toml, only)
+  grammars.compile
+
+  $LOCAL_LIBS << " #{Pathname.pwd / TreeSitter::Grammars::ARCHIVE}"
+  $libs << ' -lstdc++' if grammars.cxx?
+  cflags << '-DTREE_SITTER_STATIC_GRAMMARS'
+end
+
 cflags << '-Werror' if env_var_on?('TREE_SITTER_PEDANTIC')
 
 if env_var_on?('DEBUG')
@@ -0,0 +1,139 @@
+# frozen_string_literal: true
+
+require 'shellwords'
+
+module TreeSitter
+  # Compiles the grammars listed in a `parsers.toml` into a static archive
+  # linked into the extension, so they're loaded without `dlopen`.
+  #
+  # The sources are expected where `tsdl` fetches them, i.e. under the
+  # `build-dir` of `parsers.toml`; run `tsdl build` first.
+  class Grammars
+    # The generated header, declaring the grammars for language.c.
+    HEADER = 'static_grammars.h'
+
+    # The generated archive.
+    ARCHIVE = 'libtree-sitter-grammars.a'
+
+    attr_reader :build_dir, :names
+
+    # @param toml [Pathname] the `parsers.toml`.
+    # @param only [Array<String>, nil] the grammars to link, all of them when
+    #   `nil`.
+    def initialize(toml, only = nil)
+      @toml = toml
+      config = parse(toml.read)
+      @build_dir = toml.dirname / config.fetch('build-dir', 'vendor/parsers/build')
+      @names = only || config.fetch('parsers', [])
+      unknown = @names - config.fetch('parsers', [])
+      abort "Unknown grammars in #{toml}: #{unknown.join(', ')}" if !unknown.empty?
+    end
+
+    # Compile the grammars into {ARCHIVE}, and generate {HEADER}, in the
+    # current directory.
+    #
+    # @return [void]
+    def compile
+      # The compilers of the extension, which extconf.rb takes from $CC.
+      cc = RbConfig::MAKEFILE_CONFIG['CC']
+      cxx = RbConfig::MAKEFILE_CONFIG['CXX']
+      ar = RbConfig::MAKEFILE_CONFIG['AR'] || 'ar'
+      objects = []
+
+      names.each do |name|
+        src = src_dir(name)
+        # Keep the grammars' symbols out of the extension's exports.
+        flags = "-O2 -fPIC -fvisibility=hidden -I#{esc(src)}"
+        sh "#{cc} #{flags} -std=c11 -c #{esc(src / 'parser.c')} -o #{esc(obj = "#{c_name(name)}_parser.o")}"
+        objects << obj
+        if (scanner = src / 'scanner.c').exist?
+          sh "#{cc} #{flags} -std=c11 -c #{esc(scanner)} -o #{esc(obj = "#{c_name(name)}_scanner.o")}"
+          objects << obj
+        elsif (scanner = src / 'scanner.cc').exist?
+          sh "#{cxx} #{flags} -c #{esc(scanner)} -o #{esc(obj = "#{c_name(name)}_scanner.o")}"
+          objects << obj
+        end
+      end
+
+      File.delete(ARCHIVE) if File.exist?(ARCHIVE)
+      sh "#{ar} rcs #{esc(ARCHIVE)} #{objects.map { |o| esc(o) }.join(' ')}"
+      File.write(HEADER, header)
+    end
+
+    # Whether a grammar has a C++ scanner, and the extension must link the
+    # C++ runtime.
+    def cxx?
+      names.any? { |name| (src_dir(name) / 'scanner.cc').exist? }
+    end
+
+    private
+
+    def c_name(name) = name.tr('-', '_')
+
+    def esc(path) = Shellwords.escape(path.to_s)
+
+    def header
+      <<~C
+        // Generated by extconf.rb from #{@toml}; do not edit.
+        #ifndef _RB_TREE_SITTER_STATIC_GRAMMARS_H
+        #define _RB_TREE_SITTER_STATIC_GRAMMARS_H
+
+        #{names.map { |n| "const TSLanguage *tree_sitter_#{c_name(n)}(void);" }.join("\n")}
+
+        #define TREE_SITTER_STATIC_GRAMMAR_LIST(X) #{names.map { |n| "X(#{c_name(n)})" }.join(' ')}
+
+        #endif
+      C
+    end
+
+    # The directory holding parser.c: grammars like typescript keep several
+    # under one repository, named after the grammar.
+    def src_dir(name)
+      candidates =
+        [name, "tree-sitter-#{name}"].flat_map do |dir|
+          Dir.glob((build_dir / dir / '**' / 'src' / 'parser.c').to_s)
+        end
+      candidates.reject! { |path| path.include?('node_modules') }
+      best =
+        candidates.find { |path| File.basename(File.dirname(path, 2)) == name } ||
+        candidates.min_by(&:size)
+      abort "Could not find the sources of #{name} under #{build_dir}; run `tsdl build` first." if best.nil?
+
+      Pathname(best).dirname
+    end
+
+    # Just enough TOML for parsers.toml: top-level strings, and the keys of
+    # the [parsers] table.
+    def parse(text)
+      res = { 'parsers' => [] }
+      table = nil
+      text.each_line do |line|
+        line = line.sub(/#.*/, '').strip
+        next if line.empty?
+
+        if (m = line.match(/\A\[(.+)\]\z/))
+          table = m[1].strip
+        elsif (m = line.match(/\A"?([\w-]+)"?\s*=\s*(.*)\z/))
+          if table == 'parsers'
+            res['parsers'] << m[1]
+          elsif table.nil?
+            res[m[1]] = m[2].delete_prefix('"').delete_suffix('"')
+          end
+        end
+      end
+      res
+    end
+
+    def sh(cmd)
+      return if system(cmd)
+
+      abort <<~MSG
+
+        Failed to run: #{cmd}
+
+        exiting …
+
+      MSG
+    end
+  end
+end
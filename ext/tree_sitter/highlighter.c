@@ -0,0 +1,1129 @@
+#include "tree_sitter.h"
+#include <ruby/encoding.h>
+
+extern VALUE mTreeSitter;
+extern VALUE cQuery;
+
+VALUE cHighlighter;
+
+// Events, exported as triples of integers.
+#define HIGHLIGHTER_SOURCE 0
+#define HIGHLIGHTER_HIGHLIGHT_START 1
+#define HIGHLIGHTER_HIGHLIGHT_END 2
+
+// What a capture of the query stands for.
+typedef enum {
+  HIGHLIGHTER_CAPTURE_NONE,
+  HIGHLIGHTER_CAPTURE_HIGHLIGHT,
+  HIGHLIGHTER_CAPTURE_LOCAL_SCOPE,
+  HIGHLIGHTER_CAPTURE_LOCAL_DEFINITION,
+  HIGHLIGHTER_CAPTURE_LOCAL_REFERENCE,
+} highlighter_capture_kind_t;
+
+// query:              the locals and highlights queries, compiled together,
+//                     locals first.
+// names:              the recognized highlight names.
+// locals_patterns:    the number of patterns of the locals query.
+// capture_kinds:      the kind of each capture.
+// capture_highlights: the index in names of each capture, -1 if none.
+// priorities:         the +(#set! priority N)+ of each pattern, 0 if none.
+// inherits:           whether each local scope pattern sees the definitions
+//                     of its parent scopes, unless
+//                     +(#set! local.scope-inherits false)+.
+// local, not_local:   the properties asserted for +#is? local+, depending on
+//                     whether the captured node is a local variable.
+typedef struct {
+  VALUE query;
+  VALUE names;
+  uint32_t locals_patterns;
+  uint32_t capture_count;
+  uint8_t *capture_kinds;
+  int32_t *capture_highlights;
+  uint32_t pattern_count;
+  int32_t *priorities;
+  bool *inherits;
+  query_property_assertions_t *local;
+  query_property_assertions_t *not_local;
+} highlighter_t;
+
+static void highlighter_free(void *ptr) {
+  highlighter_t *highlighter = (highlighter_t *)ptr;
+  xfree(highlighter->capture_kinds);
+  xfree(highlighter->capture_highlights);
+  xfree(highlighter->priorities);
+  xfree(highlighter->inherits);
+  query_property_assertions_free(highlighter->local);
+  query_property_assertions_free(highlighter->not_local);
+  xfree(ptr);
+}
+
+static size_t highlighter_memsize(const void *ptr) {
+  const highlighter_t *highlighter = (const highlighter_t *)ptr;
+  return sizeof(highlighter_t) +
+         (sizeof(uint8_t) + sizeof(int32_t)) * highlighter->capture_count +
+         (sizeof(int32_t) + sizeof(bool)) * highlighter->pattern_count;
+}
+
+static void highlighter_mark(void *ptr) {
+  highlighter_t *highlighter = (highlighter_t *)ptr;
+  rb_gc_mark_movable(highlighter->query);
+  rb_gc_mark_movable(highlighter->names);
+}
+
+static void highlighter_compact(void *ptr) {
+  highlighter_t *highlighter = (highlighter_t *)ptr;
+  highlighter->query = rb_gc_location(highlighter->query);
+  highlighter->names = rb_gc_location(highlighter->names);
+}
+
+const rb_data_type_t highlighter_data_type = {
+    .wrap_struct_name = "highlighter",
+    .function =
+        {
+            .dmark = highlighter_mark,
+            .dfree = highlighter_free,
+            .dsize = highlighter_memsize,
+            .dcompact = highlighter_compact,
+        },
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static VALUE highlighter_allocate(VALUE klass) {
+  highlighter_t *highlighter;
+  VALUE res = TypedData_Make_Struct(klass, highlighter_t,
+                                    &highlighter_data_type, highlighter);
+  highlighter->query = Qnil;
+  highlighter->names = Qnil;
+  return res;
+}
+
+DATA_UNWRAP(highlighter)
+
+static bool highlighter_name_is(const char *name, uint32_t len,
+                                const char *prefix) {
+  size_t prefix_len = strlen(prefix);
+  return len >= prefix_len && memcmp(name, prefix, prefix_len) == 0 &&
+         (len == prefix_len || name[prefix_len] == '.');
+}
+
+// The index of the recognized name of a capture: the name itself, or its
+// longest prefix ending before a dot, e.g. +function+ for +function.builtin+.
+static int32_t highlighter_lookup(VALUE names, const char *name,
+                                  uint32_t len) {
+  while (true) {
+    for (long i = 0; i < RARRAY_LEN(names); i++) {
+      VALUE candidate = RARRAY_AREF(names, i);
+      if ((uint32_t)RSTRING_LEN(candidate) == len &&
+          memcmp(RSTRING_PTR(candidate), name, len) == 0) {
+        return (int32_t)i;
+      }
+    }
+    const char *dot = NULL;
+    for (uint32_t i = len; i > 0; i--) {
+      if (name[i - 1] == '.') {
+        dot = &name[i - 1];
+        break;
+      }
+    }
+    if (dot == NULL) {
+      return -1;
+    }
+    len = (uint32_t)(dot - name);
+  }
+}
+
+// The highlight names of the captures of +query+, when none are given.
+static VALUE highlighter_default_names(const TSQuery *query) {
+  VALUE res = rb_ary_new();
+  for (uint32_t i = 0; i < ts_query_capture_count(query); i++) {
+    uint32_t len;
+    const char *name = ts_query_capture_name_for_id(query, i, &len);
+    if (len == 0 || name[0] == '_' || highlighter_name_is(name, len, "local")) {
+      continue;
+    }
+    VALUE str = rb_str_freeze(safe_str2(name, len));
+    if (!RTEST(rb_ary_includes(res, str))) {
+      rb_ary_push(res, str);
+    }
+  }
+  return res;
+}
+
+static void highlighter_compile(highlighter_t *highlighter) {
+  const TSQuery *query = value_to_query(highlighter->query);
+  const query_properties_t *properties =
+      value_to_query_properties(highlighter->query);
+
+  highlighter->capture_count = ts_query_capture_count(query);
+  highlighter->capture_kinds = ZALLOC_N(uint8_t, highlighter->capture_count);
+  highlighter->capture_highlights =
+      ALLOC_N(int32_t, highlighter->capture_count);
+  for (uint32_t i = 0; i < highlighter->capture_count; i++) {
+    uint32_t len;
+    const char *name = ts_query_capture_name_for_id(query, i, &len);
+    highlighter_capture_kind_t kind = HIGHLIGHTER_CAPTURE_NONE;
+    int32_t highlight = -1;
+    if (highlighter_name_is(name, len, "local.scope")) {
+      kind = HIGHLIGHTER_CAPTURE_LOCAL_SCOPE;
+    } else if (highlighter_name_is(name, len, "local.definition")) {
+      kind = HIGHLIGHTER_CAPTURE_LOCAL_DEFINITION;
+    } else if (highlighter_name_is(name, len, "local.reference")) {
+      kind = HIGHLIGHTER_CAPTURE_LOCAL_REFERENCE;
+    } else if (len > 0 && name[0] != '_' &&
+               !highlighter_name_is(name, len, "local")) {
+      highlight = highlighter_lookup(highlighter->names, name, len);
+      kind = highlight < 0 ? HIGHLIGHTER_CAPTURE_NONE
+                           : HIGHLIGHTER_CAPTURE_HIGHLIGHT;
+    }
+    highlighter->capture_kinds[i] = (uint8_t)kind;
+    highlighter->capture_highlights[i] = highlight;
+  }
+
+  highlighter->pattern_count = ts_query_pattern_count(query);
+  highlighter->priorities = ZALLOC_N(int32_t, highlighter->pattern_count);
+  highlighter->inherits = ALLOC_N(bool, highlighter->pattern_count);
+  for (uint32_t i = 0; i < highlighter->pattern_count; i++) {
+    VALUE settings = query_properties_settings(properties, i);
+    highlighter->inherits[i] = true;
+    if (NIL_P(settings)) {
+      continue;
+    }
+    VALUE priority = rb_hash_lookup(settings, rb_str_new_cstr("priority"));
+    VALUE inherits =
+        rb_hash_lookup(settings, rb_str_new_cstr("local.scope-inherits"));
+    if (!NIL_P(priority)) {
+      highlighter->priorities[i] = NUM2INT(rb_str_to_inum(priority, 10, 1));
+    }
+    highlighter->inherits[i] =
+        NIL_P(inherits) || strcmp(StringValueCStr(inherits), "false") != 0;
+  }
+
+  VALUE local = rb_hash_new();
+  rb_hash_aset(local, rb_str_new_cstr("local"), Qtrue);
+  highlighter->local = query_property_assertions_new(local);
+  highlighter->not_local = query_property_assertions_new(rb_hash_new());
+}
+
+/**
+ * Create a highlighter from a +highlights.scm+ query, and optionally a
+ * +locals.scm+ query.
+ *
+ * Captures are mapped to the +names+ to highlight: a capture highlights the
+ * longest of its dot-separated prefixes found in +names+, so +@function.call+
+ * is highlighted as +function+ unless +function.call+ is recognized too.
+ * Captures starting with an underscore, or without a recognized name, are
+ * ignored.
+ *
+ * When several patterns capture the same node, the one with the highest
+ * +(#set! priority N)+ wins; ties go to the first pattern.
+ *
+ * Locals (+@local.scope+, +@local.definition+, +@local.reference+) are
+ * tracked like +tree-sitter-highlight+: references to a local definition are
+ * highlighted like the definition, and +(#is? local)+ / +(#is-not? local)+
+ * tell whether a captured node is a local variable.
+ *
+ * @raise [QueryCreationError] if a query is invalid.
+ * @raise [RuntimeError] if the highlighter was already initialized.
+ *
+ * @param language   [Language]
+ * @param highlights [String] the highlights query.
+ * @param locals     [String, nil] the locals query.
+ * @param names      [Array<String>, nil] the recognized highlight names,
+ *   defaulting to the names of all the highlight captures.
+ */
+static VALUE highlighter_initialize(int argc, VALUE *argv, VALUE self) {
+  VALUE language, highlights, opts;
+  rb_scan_args(argc, argv, "2:", &language, &highlights, &opts);
+  highlighter_t *highlighter = unwrap(self);
+  // The compiled tables are sized for the query, and shared by running
+  // highlights: they're never replaced.
+  if (!NIL_P(highlighter->query)) {
+    rb_raise(rb_eRuntimeError, "Highlighter is already initialized");
+  }
+
+  VALUE locals = Qnil;
+  VALUE names = Qnil;
+  if (!NIL_P(opts)) {
+    ID keys[2] = {rb_intern("locals"), rb_intern("names")};
+    VALUE values[2];
+    rb_get_kwargs(opts, keys, 0, 2, values);
+    locals = values[0] == Qundef ? Qnil : values[0];
+    names = values[1] == Qundef ? Qnil : values[1];
+  }
+
+  StringValue(highlights);
+  VALUE source = highlights;
+  long locals_len = 0;
+  if (!NIL_P(locals)) {
+    StringValue(locals);
+    locals_len = RSTRING_LEN(locals);
+    source = rb_str_plus(rb_str_plus(locals, rb_str_new_cstr("\n")),
+                         highlights);
+  }
+
+  VALUE args[2] = {language, source};
+  VALUE query = rb_class_new_instance(2, args, cQuery);
+  RB_OBJ_WRITE(self, &highlighter->query, query);
+
+  const TSQuery *ts_query = value_to_query(query);
+  uint32_t pattern_count = ts_query_pattern_count(ts_query);
+  highlighter->locals_patterns = 0;
+  while (highlighter->locals_patterns < pattern_count &&
+         ts_query_start_byte_for_pattern(
+             ts_query, highlighter->locals_patterns) < (uint32_t)locals_len) {
+    highlighter->locals_patterns++;
+  }
+
+  if (NIL_P(names)) {
+    names = highlighter_default_names(ts_query);
+  } else {
+    Check_Type(names, T_ARRAY);
+    names = rb_ary_dup(names);
+    for (long i = 0; i < RARRAY_LEN(names); i++) {
+      VALUE name = RARRAY_AREF(names, i);
+      rb_ary_store(names, i, rb_str_freeze(rb_str_dup(StringValue(name))));
+    }
+  }
+  RB_OBJ_WRITE(self, &highlighter->names, rb_obj_freeze(names));
+
+  highlighter_compile(highlighter);
+  return self;
+}
+
+/**
+ * @return [Array<String>] the recognized highlight names; highlights are
+ *   their indices.
+ */
+static VALUE highlighter_get_names(VALUE self) {
+  return unwrap(self)->names;
+}
+
+/**
+ * @return [Query] the locals and highlights queries, compiled together.
+ */
+static VALUE highlighter_get_query(VALUE self) {
+  return unwrap(self)->query;
+}
+
+// A local definition, whose name is borrowed from the source.
+typedef struct {
+  const char *name;
+  uint32_t len;
+  int32_t highlight;
+} highlighter_definition_t;
+
+// end:         where the scope ends, in bytes.
+// definitions: where the definitions of the scope start in the definitions
+//              stack.
+typedef struct {
+  uint32_t end;
+  uint32_t definitions;
+  bool inherits;
+} highlighter_scope_t;
+
+typedef struct {
+  uint32_t end;
+  int32_t highlight;
+} highlighter_open_t;
+
+// The state of a highlighting run; everything is allocated with xmalloc, and
+// released by highlighter_run_free even when raising.
+//
+// end:        where the highlighted node ends.
+// events:     the events, in triples.
+// pos:        where the source events got to.
+// open:       the stack of open highlights.
+// candidate:  the best highlight of the node at [start, end), not yet
+//             emitted; highlight < 0 if none.
+// local:      the node at [local_start, local_end) is a local reference to
+//             a definition highlighted local_highlight.
+// definition: the node at [definition_start, definition_end) is the
+//             definition at this index, if not UINT32_MAX.
+typedef struct {
+  highlighter_t *highlighter;
+  const text_predicates_t *text_predicates;
+  const query_properties_t *properties;
+  TSQueryCursor *cursor;
+  const char *src;
+  size_t src_len;
+  uint32_t end;
+
+  uint32_t *events;
+  size_t events_len;
+  size_t events_capa;
+  uint32_t pos;
+
+  highlighter_open_t *open;
+  uint32_t open_len;
+  uint32_t open_capa;
+
+  highlighter_scope_t *scopes;
+  uint32_t scopes_len;
+  uint32_t scopes_capa;
+  highlighter_definition_t *definitions;
+  uint32_t definitions_len;
+  uint32_t definitions_capa;
+
+  uint32_t candidate_start;
+  uint32_t candidate_end;
+  int32_t candidate_highlight;
+  int32_t candidate_priority;
+
+  bool local;
+  uint32_t local_start;
+  uint32_t local_end;
+  int32_t local_highlight;
+
+  uint32_t definition;
+  uint32_t definition_start;
+  uint32_t definition_end;
+} highlighter_run_t;
+
+#define HIGHLIGHTER_PUSH(run, field, value)                                    \
+  do {                                                                         \
+    if ((run)->field##_len == (run)->field##_capa) {                           \
+      (run)->field##_capa = (run)->field##_capa == 0 ? 16                      \
+                                                     : (run)->field##_capa * 2; \
+      (run)->field = ruby_xrealloc2((run)->field, (run)->field##_capa,         \
+                                    sizeof(*(run)->field));                    \
+    }                                                                          \
+    (run)->field[(run)->field##_len++] = (value);                              \
+  } while (0)
+
+static void highlighter_emit(highlighter_run_t *run, uint32_t type, uint32_t a,
+                             uint32_t b) {
+  if (run->events_len + 3 > run->events_capa) {
+    run->events_capa = run->events_capa == 0 ? 1024 : run->events_capa * 2;
+    REALLOC_N(run->events, uint32_t, run->events_capa);
+  }
+  run->events[run->events_len++] = type;
+  run->events[run->events_len++] = a;
+  run->events[run->events_len++] = b;
+}
+
+static void highlighter_source_to(highlighter_run_t *run, uint32_t pos) {
+  if (pos > run->pos) {
+    highlighter_emit(run, HIGHLIGHTER_SOURCE, run->pos, pos);
+    run->pos = pos;
+  }
+}
+
+// Close the highlights ending at or before +pos+.
+static void highlighter_close_to(highlighter_run_t *run, uint32_t pos) {
+  while (run->open_len > 0 && run->open[run->open_len - 1].end <= pos) {
+    highlighter_source_to(run, run->open[run->open_len - 1].end);
+    highlighter_emit(run, HIGHLIGHTER_HIGHLIGHT_END, 0, 0);
+    run->open_len--;
+  }
+}
+
+// Emit the candidate highlight, clipped so highlights nest.
+static void highlighter_flush(highlighter_run_t *run) {
+  int32_t highlight = run->candidate_highlight;
+  uint32_t start = run->candidate_start;
+  uint32_t end = run->candidate_end;
+  run->candidate_highlight = -1;
+  if (highlight < 0) {
+    return;
+  }
+
+  if (run->definition != UINT32_MAX && run->definition_start == start &&
+      run->definition_end == end) {
+    run->definitions[run->definition].highlight = highlight;
+  }
+
+  highlighter_close_to(run, start);
+  if (start < run->pos) {
+    start = run->pos;
+  }
+  if (run->open_len > 0 && end > run->open[run->open_len - 1].end) {
+    end = run->open[run->open_len - 1].end;
+  }
+  if (start >= end) {
+    return;
+  }
+  highlighter_source_to(run, start);
+  highlighter_emit(run, HIGHLIGHTER_HIGHLIGHT_START, (uint32_t)highlight, 0);
+  highlighter_open_t open = {.end = end, .highlight = highlight};
+  HIGHLIGHTER_PUSH(run, open, open);
+}
+
+static void highlighter_pop_scopes(highlighter_run_t *run, uint32_t pos) {
+  // The root scope never ends.
+  while (run->scopes_len > 1 && run->scopes[run->scopes_len - 1].end <= pos) {
+    run->definitions_len = run->scopes[run->scopes_len - 1].definitions;
+    run->scopes_len--;
+  }
+  if (run->definition >= run->definitions_len) {
+    run->definition = UINT32_MAX;
+  }
+}
+
+// The highlight of the local definition named like the source at
+// [start, end), or -2 if there's none.
+static int32_t highlighter_resolve(highlighter_run_t *run, uint32_t start,
+                                   uint32_t end) {
+  const char *name = run->src + start;
+  uint32_t len = end - start;
+  uint32_t definitions_end = run->definitions_len;
+  for (uint32_t i = run->scopes_len; i > 0; i--) {
+    const highlighter_scope_t *scope = &run->scopes[i - 1];
+    for (uint32_t j = definitions_end; j > scope->definitions; j--) {
+      const highlighter_definition_t *definition = &run->definitions[j - 1];
+      if (definition->len == len && memcmp(definition->name, name, len) == 0) {
+        return definition->highlight;
+      }
+    }
+    if (!scope->inherits) {
+      break;
+    }
+    definitions_end = scope->definitions;
+  }
+  return -2;
+}
+
+static void highlighter_capture(highlighter_run_t *run,
+                                const TSQueryMatch *match, uint32_t index) {
+  highlighter_t *highlighter = run->highlighter;
+  const TSQueryCapture *capture = &match->captures[index];
+  uint32_t start = ts_node_start_byte(capture->node);
+  uint32_t end = ts_node_end_byte(capture->node);
+  if (end > run->src_len) {
+    end = (uint32_t)run->src_len;
+  }
+  if (start > end) {
+    start = end;
+  }
+
+  if (run->candidate_highlight >= 0 &&
+      (start != run->candidate_start || end != run->candidate_end)) {
+    highlighter_flush(run);
+  }
+  highlighter_pop_scopes(run, start);
+
+  switch ((highlighter_capture_kind_t)highlighter->capture_kinds[capture->index]) {
+  case HIGHLIGHTER_CAPTURE_LOCAL_SCOPE: {
+    highlighter_scope_t scope = {
+        .end = end,
+        .definitions = run->definitions_len,
+        .inherits = highlighter->inherits[match->pattern_index],
+    };
+    HIGHLIGHTER_PUSH(run, scopes, scope);
+    break;
+  }
+  case HIGHLIGHTER_CAPTURE_LOCAL_DEFINITION: {
+    highlighter_definition_t definition = {
+        .name = run->src + start, .len = end - start, .highlight = -1};
+    HIGHLIGHTER_PUSH(run, definitions, definition);
+    run->definition = run->definitions_len - 1;
+    run->definition_start = start;
+    run->definition_end = end;
+    break;
+  }
+  case HIGHLIGHTER_CAPTURE_LOCAL_REFERENCE: {
+    int32_t highlight = highlighter_resolve(run, start, end);
+    run->local = highlight != -2;
+    run->local_start = start;
+    run->local_end = end;
+    run->local_highlight = highlight;
+    break;
+  }
+  case HIGHLIGHTER_CAPTURE_HIGHLIGHT: {
+    bool local =
+        run->local && run->local_start == start && run->local_end == end;
+    if (!query_properties_satisfied(run->properties, match,
+                                    local ? highlighter->local
+                                          : highlighter->not_local)) {
+      break;
+    }
+    int32_t highlight = highlighter->capture_highlights[capture->index];
+    if (local && run->local_highlight >= 0) {
+      highlight = run->local_highlight;
+    }
+    int32_t priority = highlighter->priorities[match->pattern_index];
+    if (run->candidate_highlight < 0) {
+      run->candidate_start = start;
+      run->candidate_end = end;
+      run->candidate_highlight = highlight;
+      run->candidate_priority = priority;
+    } else if (priority > run->candidate_priority) {
+      run->candidate_highlight = highlight;
+      run->candidate_priority = priority;
+    }
+    break;
+  }
+  case HIGHLIGHTER_CAPTURE_NONE:
+    break;
+  }
+}
+
+static VALUE highlighter_run_body(VALUE arg) {
+  highlighter_run_t *run = (highlighter_run_t *)arg;
+  TSQueryMatch match;
+  uint32_t index;
+
+  while (ts_query_cursor_next_capture(run->cursor, &match, &index)) {
+    if (run->text_predicates != NULL &&
+        !text_predicates_satisfied(run->text_predicates, &match, run->src,
+                                   run->src_len)) {
+      ts_query_cursor_remove_match(run->cursor, match.id);
+      continue;
+    }
+    highlighter_capture(run, &match, index);
+  }
+  highlighter_flush(run);
+  highlighter_close_to(run, UINT32_MAX);
+  highlighter_source_to(run, run->end);
+  return Qnil;
+}
+
+static VALUE highlighter_run_free(VALUE arg) {
+  highlighter_run_t *run = (highlighter_run_t *)arg;
+  memory_scope_t scope;
+  memory_scope_begin(&scope);
+  ts_query_cursor_delete(run->cursor);
+  memory_scope_end(&scope);
+  xfree(run->open);
+  xfree(run->scopes);
+  xfree(run->definitions);
+  return Qnil;
+}
+
+static void highlighter_merge(highlighter_run_t *run, VALUE source,
+                              VALUE injections);
+
+// Highlight +node+, and merge the highlights of +injections+ if not nil,
+// leaving the events in run->events, which the caller must free.
+static void highlighter_run(VALUE self, VALUE node, VALUE source,
+                            VALUE injections, highlighter_run_t *run) {
+  highlighter_t *highlighter = unwrap(self);
+  StringValue(source);
+  TSNode ts_node = value_to_node(node);
+
+  *run = (highlighter_run_t){
+      .highlighter = highlighter,
+      .text_predicates = value_to_text_predicates(highlighter->query),
+      .properties = value_to_query_properties(highlighter->query),
+      .src = RSTRING_PTR(source),
+      .src_len = RSTRING_LEN(source),
+      .pos = ts_node_start_byte(ts_node),
+      .end = ts_node_end_byte(ts_node),
+      .candidate_highlight = -1,
+      .definition = UINT32_MAX,
+  };
+  if (run->end > run->src_len) {
+    run->end = (uint32_t)run->src_len;
+  }
+  highlighter_scope_t root = {
+      .end = UINT32_MAX, .definitions = 0, .inherits = false};
+  HIGHLIGHTER_PUSH(run, scopes, root);
+
+  memory_scope_t scope;
+  memory_scope_begin(&scope);
+  run->cursor = ts_query_cursor_new();
+  ts_query_cursor_exec(run->cursor, value_to_query(highlighter->query),
+                       ts_node);
+  memory_scope_end(&scope);
+
+  int state;
+  rb_protect(highlighter_run_body, (VALUE)run, &state);
+  highlighter_run_free((VALUE)run);
+  if (state) {
+    xfree(run->events);
+    rb_jump_tag(state);
+  }
+  if (!NIL_P(injections)) {
+    highlighter_merge(run, source, injections);
+  }
+  RB_GC_GUARD(source);
+}
+
+// The highlights of an injected language, being merged into the events of the
+// host document.
+//
+// events: the events of the layer, in its own highlights.
+// map:    the host highlight of each of the layer's, -1 if the host doesn't
+//         recognize it.
+// next:   the next event to merge.
+// pos:    where the merged events got to.
+// open:   the highlights of the layer open at pos, mapped.
+typedef struct {
+  uint32_t *events;
+  size_t events_len;
+  int32_t *map;
+  size_t next;
+  uint32_t pos;
+  int32_t *open;
+  uint32_t open_len;
+  uint32_t open_capa;
+} highlighter_layer_t;
+
+// A range of the host document highlighted by a layer.
+typedef struct {
+  uint32_t start;
+  uint32_t end;
+  long layer;
+} highlighter_injection_t;
+
+// The state of a merge; everything is allocated with xmalloc, and released by
+// highlighter_merge_free even when raising.
+//
+// out: the merged events, only its events are used.
+typedef struct {
+  highlighter_run_t *run;
+  VALUE source;
+  VALUE injections;
+  highlighter_layer_t *layers;
+  long layers_len;
+  highlighter_injection_t *ranges;
+  size_t ranges_len;
+  size_t ranges_capa;
+  highlighter_run_t out;
+} highlighter_merge_t;
+
+static int highlighter_injection_cmp(const void *a, const void *b) {
+  const highlighter_injection_t *x = (const highlighter_injection_t *)a;
+  const highlighter_injection_t *y = (const highlighter_injection_t *)b;
+  if (x->start != y->start) {
+    return x->start < y->start ? -1 : 1;
+  }
+  return x->layer < y->layer ? -1 : x->layer > y->layer;
+}
+
+static void highlighter_layer_push(highlighter_layer_t *layer,
+                                   int32_t highlight) {
+  if (layer->open_len == layer->open_capa) {
+    layer->open_capa = layer->open_capa == 0 ? 16 : layer->open_capa * 2;
+    REALLOC_N(layer->open, int32_t, layer->open_capa);
+  }
+  layer->open[layer->open_len++] = highlight;
+}
+
+static void highlighter_layer_source(highlighter_run_t *out, uint32_t *pos,
+                                     uint32_t start, uint32_t end) {
+  if (start > *pos) {
+    highlighter_emit(out, HIGHLIGHTER_SOURCE, *pos, start);
+  }
+  highlighter_emit(out, HIGHLIGHTER_SOURCE, start, end);
+  *pos = end;
+}
+
+// Emit the events of +layer+ clipped to [from, to), the highlights open at
+// +from+ being reopened, and the ones still open at +to+ closed. The parts of
+// [from, to) the layer doesn't cover are emitted unhighlighted.
+static void highlighter_layer_emit(highlighter_run_t *out,
+                                   highlighter_layer_t *layer, uint32_t from,
+                                   uint32_t to) {
+  const uint32_t *events = layer->events;
+
+  // Catch up with from.
+  for (; layer->next < layer->events_len; layer->next += 3) {
+    const uint32_t *event = &events[layer->next];
+    if (event[0] == HIGHLIGHTER_SOURCE) {
+      if (event[2] > from) {
+        break;
+      }
+      layer->pos = event[2];
+    } else if (event[0] == HIGHLIGHTER_HIGHLIGHT_START) {
+      if (layer->pos >= from) {
+        break;
+      }
+      highlighter_layer_push(layer, layer->map[event[1]]);
+    } else if (layer->open_len > 0) {
+      layer->open_len--;
+    }
+  }
+
+  for (uint32_t i = 0; i < layer->open_len; i++) {
+    if (layer->open[i] >= 0) {
+      highlighter_emit(out, HIGHLIGHTER_HIGHLIGHT_START,
+                       (uint32_t)layer->open[i], 0);
+    }
+  }
+  uint32_t pos = from;
+  for (; layer->next < layer->events_len; layer->next += 3) {
+    const uint32_t *event = &events[layer->next];
+    if (event[0] == HIGHLIGHTER_SOURCE) {
+      uint32_t start = event[1] > from ? event[1] : from;
+      uint32_t end = event[2] < to ? event[2] : to;
+      if (start < end) {
+        highlighter_layer_source(out, &pos, start, end);
+      }
+      if (event[2] > to) {
+        break;
+      }
+      layer->pos = event[2];
+    } else if (event[0] == HIGHLIGHTER_HIGHLIGHT_START) {
+      if (layer->pos >= to) {
+        break;
+      }
+      int32_t highlight = layer->map[event[1]];
+      highlighter_layer_push(layer, highlight);
+      if (highlight >= 0) {
+        highlighter_emit(out, HIGHLIGHTER_HIGHLIGHT_START, (uint32_t)highlight,
+                         0);
+      }
+    } else if (layer->open_len > 0) {
+      if (layer->open[--layer->open_len] >= 0) {
+        highlighter_emit(out, HIGHLIGHTER_HIGHLIGHT_END, 0, 0);
+      }
+    }
+  }
+  if (pos < to) {
+    highlighter_emit(out, HIGHLIGHTER_SOURCE, pos, to);
+  }
+  for (uint32_t i = layer->open_len; i > 0; i--) {
+    if (layer->open[i - 1] >= 0) {
+      highlighter_emit(out, HIGHLIGHTER_HIGHLIGHT_END, 0, 0);
+    }
+  }
+}
+
+// Highlight the layers, and collect their ranges.
+static void highlighter_merge_layers(highlighter_merge_t *merge) {
+  VALUE names = merge->run->highlighter->names;
+  for (long i = 0; i < merge->layers_len; i++) {
+    VALUE injection = rb_ary_entry(merge->injections, i);
+    Check_Type(injection, T_ARRAY);
+    if (RARRAY_LEN(injection) != 3) {
+      rb_raise(rb_eArgError,
+               "Expected injections of [highlighter, node, ranges], got %ld "
+               "elements",
+               RARRAY_LEN(injection));
+    }
+    VALUE highlighter = rb_ary_entry(injection, 0);
+    VALUE ranges = rb_ary_entry(injection, 2);
+    Check_Type(ranges, T_ARRAY);
+    highlighter_layer_t *layer = &merge->layers[i];
+
+    highlighter_run_t run;
+    highlighter_run(highlighter, rb_ary_entry(injection, 1), merge->source,
+                    Qnil, &run);
+    layer->events = run.events;
+    layer->events_len = run.events_len;
+
+    VALUE layer_names = unwrap(highlighter)->names;
+    layer->map = ALLOC_N(int32_t, RARRAY_LEN(layer_names));
+    for (long j = 0; j < RARRAY_LEN(layer_names); j++) {
+      VALUE name = RARRAY_AREF(layer_names, j);
+      layer->map[j] = highlighter_lookup(names, RSTRING_PTR(name),
+                                         (uint32_t)RSTRING_LEN(name));
+    }
+
+    for (long j = 0; j < RARRAY_LEN(ranges); j++) {
+      TSRange range = value_to_range(rb_ary_entry(ranges, j));
+      if (range.start_byte >= range.end_byte) {
+        continue;
+      }
+      highlighter_injection_t res = {
+          .start = range.start_byte, .end = range.end_byte, .layer = i};
+      HIGHLIGHTER_PUSH(merge, ranges, res);
+    }
+  }
+
+  // Sort the ranges, dropping the ones overlapping a previous one.
+  qsort(merge->ranges, merge->ranges_len, sizeof(highlighter_injection_t),
+        highlighter_injection_cmp);
+  size_t len = 0;
+  for (size_t i = 0; i < merge->ranges_len; i++) {
+    if (len == 0 || merge->ranges[i].start >= merge->ranges[len - 1].end) {
+      merge->ranges[len++] = merge->ranges[i];
+    }
+  }
+  merge->ranges_len = len;
+}
+
+static VALUE highlighter_merge_body(VALUE arg) {
+  highlighter_merge_t *merge = (highlighter_merge_t *)arg;
+  long len = RARRAY_LEN(merge->injections);
+  merge->layers = ZALLOC_N(highlighter_layer_t, len);
+  merge->layers_len = len;
+  highlighter_merge_layers(merge);
+
+  const highlighter_run_t *run = merge->run;
+  highlighter_run_t *out = &merge->out;
+  size_t next = 0;
+  for (size_t i = 0; i < run->events_len; i += 3) {
+    const uint32_t *event = &run->events[i];
+    if (event[0] != HIGHLIGHTER_SOURCE) {
+      highlighter_emit(out, event[0], event[1], event[2]);
+      continue;
+    }
+    // Hand the injected parts of the source over to their layers.
+    uint32_t pos = event[1];
+    while (pos < event[2]) {
+      while (next < merge->ranges_len && merge->ranges[next].end <= pos) {
+        next++;
+      }
+      const highlighter_injection_t *range =
+          next < merge->ranges_len ? &merge->ranges[next] : NULL;
+      uint32_t end = event[2];
+      if (range != NULL && range->start <= pos) {
+        end = range->end < end ? range->end : end;
+        highlighter_layer_emit(out, &merge->layers[range->layer], pos, end);
+      } else {
+        end = range != NULL && range->start < end ? range->start : end;
+        highlighter_emit(out, HIGHLIGHTER_SOURCE, pos, end);
+      }
+      pos = end;
+    }
+  }
+  return Qnil;
+}
+
+static VALUE highlighter_merge_free(VALUE arg) {
+  highlighter_merge_t *merge = (highlighter_merge_t *)arg;
+  for (long i = 0; i < merge->layers_len; i++) {
+    xfree(merge->layers[i].events);
+    xfree(merge->layers[i].map);
+    xfree(merge->layers[i].open);
+  }
+  xfree(merge->layers);
+  xfree(merge->ranges);
+  return Qnil;
+}
+
+// Replace the events of +run+ with the ones of its injections merged in:
+// every range of an injection is highlighted by its layer, nested in the
+// highlights of the host.
+static void highlighter_merge(highlighter_run_t *run, VALUE source,
+                              VALUE injections) {
+  highlighter_merge_t merge = {
+      .run = run,
+      .source = source,
+      .injections = injections,
+  };
+  int state = 0;
+  if (!RB_TYPE_P(injections, T_ARRAY)) {
+    xfree(run->events);
+    Check_Type(injections, T_ARRAY);
+  }
+  rb_protect(highlighter_merge_body, (VALUE)&merge, &state);
+  highlighter_merge_free((VALUE)&merge);
+  xfree(run->events);
+  if (state) {
+    xfree(merge.out.events);
+    rb_jump_tag(state);
+  }
+  run->events = merge.out.events;
+  run->events_len = merge.out.events_len;
+  run->events_capa = merge.out.events_capa;
+  RB_GC_GUARD(injections);
+}
+
+/**
+ * Highlight +node+, and return the events of {HIGHLIGHT_START} /
+ * {HIGHLIGHT_END} nested around {SOURCE} ranges covering the whole node,
+ * like +tree-sitter-highlight+.
+ *
+ * Each event is a triple of integers:
+ * - +SOURCE, start_byte, end_byte+
+ * - +HIGHLIGHT_START, highlight, 0+, +highlight+ being an index in {#names}.
+ * - +HIGHLIGHT_END, 0, 0+
+ *
+ * Overlapping highlights are clipped so they nest.
+ *
+ * The ranges of the document written in other languages, e.g. JavaScript in
+ * HTML, are highlighted by the highlighters of +injections+, nested in the
+ * highlights of the document: their highlights are mapped to {#names} like
+ * captures are, and the ones not recognized are dropped.
+ *
+ * @see .injections
+ *
+ * @example
+ *   highlighter.events(tree.root_node, src).each_slice(3) do |type, a, b|
+ *     # …
+ *   end
+ *
+ * @param node   [Node]
+ * @param source [String] the source of the tree.
+ * @param injections [Array<Array(Highlighter, Node, Array<Range>)>, nil] the
+ *   highlighter of every injected layer, the root of its tree, and the
+ *   ranges of the document it highlights.
+ *
+ * @return [Array<Integer>]
+ */
+static VALUE highlighter_events(int argc, VALUE *argv, VALUE self) {
+  VALUE node, source, injections;
+  rb_scan_args(argc, argv, "21", &node, &source, &injections);
+  highlighter_run_t run;
+  highlighter_run(self, node, source, injections, &run);
+
+  VALUE res = rb_ary_new_capa((long)run.events_len);
+  for (size_t i = 0; i < run.events_len; i++) {
+    rb_ary_push(res, UINT2NUM(run.events[i]));
+  }
+  xfree(run.events);
+  return res;
+}
+
+static void highlighter_cat_escaped(VALUE buffer, const char *src,
+                                    size_t len) {
+  size_t from = 0;
+  for (size_t i = 0; i < len; i++) {
+    const char *entity;
+    switch (src[i]) {
+    case '&':
+      entity = "&amp;";
+      break;
+    case '<':
+      entity = "&lt;";
+      break;
+    case '>':
+      entity = "&gt;";
+      break;
+    case '"':
+      entity = "&quot;";
+      break;
+    case '\'':
+      entity = "&#39;";
+      break;
+    default:
+      continue;
+    }
+    rb_str_buf_cat(buffer, src + from, i - from);
+    rb_str_buf_cat_ascii(buffer, entity);
+    from = i + 1;
+  }
+  rb_str_buf_cat(buffer, src + from, len - from);
+}
+
+static VALUE highlighter_render_body(VALUE arg) {
+  VALUE *args = (VALUE *)arg;
+  highlighter_run_t *run = (highlighter_run_t *)args[0];
+  uint32_t *stack = (uint32_t *)args[1];
+  VALUE buffer = args[2], open = args[3], close = args[4];
+  bool escape = RTEST(args[5]), reopen = RTEST(args[6]);
+  uint32_t depth = 0;
+  for (size_t i = 0; i < run->events_len; i += 3) {
+    uint32_t *event = &run->events[i];
+    switch (event[0]) {
+    case HIGHLIGHTER_SOURCE:
+      if (escape) {
+        highlighter_cat_escaped(buffer, run->src + event[1],
+                                event[2] - event[1]);
+      } else {
+        rb_str_buf_cat(buffer, run->src + event[1], event[2] - event[1]);
+      }
+      break;
+    case HIGHLIGHTER_HIGHLIGHT_START:
+      stack[depth++] = event[1];
+      rb_str_buf_append(buffer, rb_ary_entry(open, event[1]));
+      break;
+    case HIGHLIGHTER_HIGHLIGHT_END:
+      depth--;
+      rb_str_buf_append(buffer, RB_TYPE_P(close, T_ARRAY)
+                                    ? rb_ary_entry(close, stack[depth])
+                                    : close);
+      if (reopen && depth > 0) {
+        rb_str_buf_append(buffer, rb_ary_entry(open, stack[depth - 1]));
+      }
+      break;
+    }
+  }
+  return buffer;
+}
+
+// Check there's a String per highlight, and return a copy of +strings+
+// holding them, converted with +#to_str+.
+static VALUE highlighter_check_strings(VALUE strings, long names) {
+  Check_Type(strings, T_ARRAY);
+  if (RARRAY_LEN(strings) < names) {
+    rb_raise(rb_eArgError, "Expected %ld strings, got %ld", names,
+             RARRAY_LEN(strings));
+  }
+  strings = rb_ary_dup(strings);
+  for (long i = 0; i < RARRAY_LEN(strings); i++) {
+    VALUE str = RARRAY_AREF(strings, i);
+    rb_ary_store(strings, i, StringValue(str));
+  }
+  return strings;
+}
+
+static VALUE highlighter_render_buffer(VALUE source) {
+  VALUE buffer = rb_str_buf_new(RSTRING_LEN(source) * 2);
+  rb_enc_copy(buffer, source);
+  return buffer;
+}
+
+/**
+ * Highlight +node+, and render it directly into a +String+.
+ *
+ * @see #events
+ * @see #html
+ * @see #ansi
+ *
+ * @param node   [Node]
+ * @param source [String] the source of the tree.
+ * @param open   [Array<String>] what to write when a highlight starts, by
+ *   highlight.
+ * @param close  [String, Array<String>] what to write when a highlight ends,
+ *   by highlight if an +Array+.
+ * @param escape [Boolean] escape the source for HTML.
+ * @param reopen [Boolean] write the +open+ of the enclosing highlight again
+ *   after a nested one is closed, for formats which don't nest, like ANSI.
+ * @param injections [Array<Array(Highlighter, Node, Array<Range>)>, nil] see
+ *   {#events}.
+ *
+ * @return [String]
+ */
+static VALUE highlighter_render(int argc, VALUE *argv, VALUE self) {
+  VALUE node, source, open, close, escape, reopen, injections;
+  rb_scan_args(argc, argv, "61", &node, &source, &open, &close, &escape,
+               &reopen, &injections);
+  long names = RARRAY_LEN(unwrap(self)->names);
+  open = highlighter_check_strings(open, names);
+  if (RB_TYPE_P(close, T_ARRAY)) {
+    close = highlighter_check_strings(close, names);
+  } else {
+    StringValue(close);
+  }
+
+  highlighter_run_t run;
+  highlighter_run(self, node, source, injections, &run);
+
+  // The highlights open while rendering, for reopen.
+  uint32_t *stack = malloc(sizeof(uint32_t) * (run.events_len / 3 + 1));
+  if (stack == NULL) {
+    xfree(run.events);
+    rb_raise(rb_eNoMemError, "failed to allocate the highlights stack");
+  }
+  VALUE args[7] = {(VALUE)&run, (VALUE)stack, Qnil, open, close, escape,
+                   reopen};
+  int state;
+  args[2] = rb_protect(highlighter_render_buffer, source, &state);
+  if (!state) {
+    rb_protect(highlighter_render_body, (VALUE)args, &state);
+  }
+  free(stack);
+  xfree(run.events);
+  if (state) {
+    rb_jump_tag(state);
+  }
+  RB_GC_GUARD(source);
+  RB_GC_GUARD(open);
+  RB_GC_GUARD(close);
+  return args[2];
+}
+
+void init_highlighter(void) {
+  cHighlighter = rb_define_class_under(mTreeSitter, "Highlighter", rb_cObject);
+
+  rb_define_alloc_func(cHighlighter, highlighter_allocate);
+
+  /* A range of the source, not highlighted by the nested highlights. */
+  rb_define_const(cHighlighter, "SOURCE", INT2FIX(HIGHLIGHTER_SOURCE));
+  /* The start of a highlight. */
+  rb_define_const(cHighlighter, "HIGHLIGHT_START",
+                  INT2FIX(HIGHLIGHTER_HIGHLIGHT_START));
+  /* The end of the last highlight started. */
+  rb_define_const(cHighlighter, "HIGHLIGHT_END",
+                  INT2FIX(HIGHLIGHTER_HIGHLIGHT_END));
+
+  /* Class methods */
+  rb_define_method(cHighlighter, "initialize", highlighter_initialize, -1);
+  rb_define_method(cHighlighter, "events", highlighter_events, -1);
+  rb_define_method(cHighlighter, "names", highlighter_get_names, 0);
+  rb_define_method(cHighlighter, "query", highlighter_get_query, 0);
+  rb_define_method(cHighlighter, "render", highlighter_render, -1);
+}
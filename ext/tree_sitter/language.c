@@ -7,10 +7,31 @@
 typedef const TSLanguage *(tree_sitter_lang)(void);
 const char *tree_sitter_prefix = "tree_sitter_";
 
+#ifdef TREE_SITTER_STATIC_GRAMMARS
+// Generated by extconf.rb with --enable-static-grammars.
+#include "static_grammars.h"
+#else
+#define TREE_SITTER_STATIC_GRAMMAR_LIST(X)
+#endif
+
+// The grammars linked into the extension, NULL-terminated.
+#define STATIC_GRAMMAR(name) {#name, tree_sitter_##name},
+static const struct {
+  const char *name;
+  tree_sitter_lang *make;
+} static_grammars[] = {TREE_SITTER_STATIC_GRAMMAR_LIST(STATIC_GRAMMAR){NULL, NULL}};
+#undef STATIC_GRAMMAR
+
 extern VALUE mTreeSitter;
 
 VALUE cLanguage;
 
+// The languages returned by Language.load, by [name, path], so a library is
+// only dlopened once, and loading it again returns the same Language.
+//
+// Loads hold the GVL throughout, so they don't race.
+static VALUE loaded_languages = Qnil;
+
 DATA_TYPE(TSLanguage *, language)
 DATA_FREE(language)
 DATA_MEMSIZE(language)
@@ -29,6 +50,9 @@ VALUE new_language(const TSLanguage *language) {
 /**
  * Load a language parser from disk.
  *
+ * Libraries are only opened once: loading the same +name+ from the same
+ * +path+ again returns the same {Language}.
+ *
  * @raise [RuntimeError] if the parser was not found, or if it's incompatible
  * with this gem.
  *
@@ -40,6 +64,13 @@ VALUE new_language(const TSLanguage *language) {
 static VALUE language_load(VALUE self, VALUE name, VALUE path) {
   VALUE path_s = rb_funcall(path, rb_intern("to_s"), 0);
   char *path_cstr = StringValueCStr(path_s);
+  VALUE key = rb_ary_new_from_args(2, rb_str_new_frozen(StringValue(name)),
+                                   rb_str_new_frozen(path_s));
+  VALUE cached = rb_hash_lookup2(loaded_languages, key, Qundef);
+  if (cached != Qundef) {
+    return cached;
+  }
+
   void *lib = dlopen(path_cstr, RTLD_NOW);
   if (lib == NULL) {
     const char *err = dlerror();
@@ -88,7 +119,50 @@ static VALUE language_load(VALUE self, VALUE name, VALUE path) {
              TREE_SITTER_LANGUAGE_VERSION);
   }
 
-  return new_language(lang);
+  VALUE res = new_language(lang);
+  rb_hash_aset(loaded_languages, rb_obj_freeze(key), res);
+  return res;
+}
+
+/**
+ * Get a grammar linked into the extension, see +--enable-static-grammars+.
+ *
+ * No library is opened: the language is a lookup in a static table, and
+ * repeat calls return the same {Language}.
+ *
+ * @param name [String] the grammar's name, with +_+ instead of +-+.
+ *
+ * @return [Language, nil] +nil+ if the grammar wasn't linked.
+ */
+static VALUE language_linked(VALUE self, VALUE name) {
+  const char *name_cstr = StringValueCStr(name);
+  VALUE key = rb_ary_new_from_args(2, rb_str_new_frozen(name), Qnil);
+  VALUE cached = rb_hash_lookup2(loaded_languages, key, Qundef);
+  if (cached != Qundef) {
+    return cached;
+  }
+
+  for (size_t i = 0; static_grammars[i].name != NULL; i++) {
+    if (strcmp(static_grammars[i].name, name_cstr) == 0) {
+      VALUE res = new_language(static_grammars[i].make());
+      rb_hash_aset(loaded_languages, rb_obj_freeze(key), res);
+      return res;
+    }
+  }
+  return Qnil;
+}
+
+/**
+ * The names of the grammars linked into the extension.
+ *
+ * @return [Array<String>]
+ */
+static VALUE language_linked_names(VALUE self) {
+  VALUE res = rb_ary_new();
+  for (size_t i = 0; static_grammars[i].name != NULL; i++) {
+    rb_ary_push(res, rb_str_freeze(rb_str_new_cstr(static_grammars[i].name)));
+  }
+  return res;
 }
 
 static VALUE language_equal(VALUE self, VALUE other) {
@@ -97,6 +171,29 @@ static VALUE language_equal(VALUE self, VALUE other) {
   return this == that ? Qtrue : Qfalse;
 }
 
+/**
+ * Whether +other+ is a {Language} wrapping the same grammar.
+ *
+ * Together with {#hash}, this lets languages be used as +Hash+ keys.
+ *
+ * @param other [Object]
+ *
+ * @return [Boolean]
+ */
+static VALUE language_eql(VALUE self, VALUE other) {
+  if (!rb_obj_is_kind_of(other, cLanguage)) {
+    return Qfalse;
+  }
+  return language_equal(self, other);
+}
+
+/**
+ * @return [Integer] a hash of the underlying grammar.
+ */
+static VALUE language_hash(VALUE self) {
+  return ST2FIX(rb_hash_start((st_index_t)(uintptr_t)SELF));
+}
+
 /**
  * Get the number of distinct field names in the language.
  *
@@ -211,11 +308,19 @@ void init_language(void) {
 
   rb_define_alloc_func(cLanguage, language_allocate);
 
+  loaded_languages = rb_hash_new();
+  rb_gc_register_mark_object(loaded_languages);
+
   /* Module methods */
+  rb_define_module_function(cLanguage, "linked", language_linked, 1);
+  rb_define_module_function(cLanguage, "linked_names", language_linked_names,
+                            0);
   rb_define_module_function(cLanguage, "load", language_load, 2);
 
   /* Operators */
   rb_define_method(cLanguage, "==", language_equal, 1);
+  rb_define_method(cLanguage, "eql?", language_eql, 1);
+  rb_define_method(cLanguage, "hash", language_hash, 0);
 
   /* Class methods */
   rb_define_method(cLanguage, "field_count", language_field_count, 0);
@@ -68,10 +68,7 @@
   }
 
 #define DATA_MEMSIZE(type)                                                     \
-  static size_t type##_memsize(const void *ptr) {                              \
-    type##_t *type = (type##_t *)ptr;                                          \
-    return sizeof(type);                                                       \
-  }
+  static size_t type##_memsize(const void *ptr) { return sizeof(type##_t); }
 
 #define DATA_DECLARE_DATA_TYPE(type)                                           \
   const rb_data_type_t type##_data_type = {                                    \
@@ -57,9 +57,7 @@ static VALUE node_eq(VALUE self, VALUE other) {
 static VALUE node_string(VALUE self) {
   char *str = ts_node_string(SELF);
   VALUE res = safe_str(str);
-  if (str) {
-    free(str);
-  }
+  memory_free(str);
   return res;
 }
 
@@ -561,6 +559,161 @@ static VALUE node_symbol(VALUE self) { return UINT2NUM(ts_node_symbol(SELF)); }
  */
 static VALUE node_type(VALUE self) { return safe_symbol(ts_node_type(SELF)); }
 
+// The state of Node#dispatch, shared by the walks of nested around hooks:
+// [receiver, on table, around table, wrap].
+enum {
+  NODE_DISPATCH_RECEIVER,
+  NODE_DISPATCH_ON,
+  NODE_DISPATCH_AROUND,
+  NODE_DISPATCH_WRAP,
+  NODE_DISPATCH_SIZE,
+};
+
+typedef struct {
+  VALUE state;
+  TSTreeCursor cursor;
+  bool include_root;
+} node_dispatch_walk_t;
+
+static void node_dispatch_walk(VALUE state, TSNode node, bool include_root);
+
+// The hook of +symbol+ in +table+, +nil+ if none; the last entry of the table
+// is for the symbols past the grammar's, i.e. errors.
+static VALUE node_dispatch_hook(VALUE table, TSSymbol symbol) {
+  long length = RARRAY_LEN(table);
+  if (length == 0) {
+    return Qnil;
+  }
+  return RARRAY_AREF(table, symbol < length ? (long)symbol : length - 1);
+}
+
+// The block given to around hooks, walking the children of the node.
+static VALUE node_dispatch_children(RB_BLOCK_CALL_FUNC_ARGLIST(_arg, frame)) {
+  VALUE state = rb_ary_entry(frame, 0);
+  node_dispatch_walk(state, value_to_node(rb_ary_entry(frame, 1)), false);
+  return Qnil;
+}
+
+// Call the hooks of +node+, and tell whether the walk should go on with its
+// children, which it shouldn't when an around hook took care of them.
+static bool node_dispatch_visit(VALUE state, TSNode node) {
+  TSSymbol symbol = ts_node_symbol(node);
+  VALUE on = node_dispatch_hook(RARRAY_AREF(state, NODE_DISPATCH_ON), symbol);
+  VALUE around =
+      node_dispatch_hook(RARRAY_AREF(state, NODE_DISPATCH_AROUND), symbol);
+  if (NIL_P(on) && NIL_P(around)) {
+    return true;
+  }
+
+  VALUE receiver = RARRAY_AREF(state, NODE_DISPATCH_RECEIVER);
+  VALUE wrap = RARRAY_AREF(state, NODE_DISPATCH_WRAP);
+  VALUE ts_node = new_node_by_val(node);
+  VALUE arg = NIL_P(wrap) ? ts_node
+                          : rb_funcall(wrap, rb_intern("call"), 1, ts_node);
+
+  if (!NIL_P(on)) {
+    rb_funcallv_public(receiver, rb_sym2id(on), 1, &arg);
+  }
+  if (NIL_P(around)) {
+    return true;
+  }
+  VALUE frame = rb_ary_new_from_args(2, state, ts_node);
+  rb_block_call(receiver, rb_sym2id(around), 1, &arg, node_dispatch_children,
+                frame);
+  return false;
+}
+
+static VALUE node_dispatch_walk_body(VALUE ptr) {
+  node_dispatch_walk_t *walk = (node_dispatch_walk_t *)ptr;
+  uint32_t depth = 0;
+  if (!walk->include_root) {
+    if (!ts_tree_cursor_goto_first_child(&walk->cursor)) {
+      return Qnil;
+    }
+    depth = 1;
+  }
+  for (;;) {
+    TSNode node = ts_tree_cursor_current_node(&walk->cursor);
+    if (node_dispatch_visit(walk->state, node) &&
+        ts_tree_cursor_goto_first_child(&walk->cursor)) {
+      depth++;
+      continue;
+    }
+    for (;;) {
+      if (depth == 0) {
+        return Qnil;
+      }
+      if (ts_tree_cursor_goto_next_sibling(&walk->cursor)) {
+        break;
+      }
+      ts_tree_cursor_goto_parent(&walk->cursor);
+      depth--;
+    }
+  }
+}
+
+static VALUE node_dispatch_walk_ensure(VALUE ptr) {
+  node_dispatch_walk_t *walk = (node_dispatch_walk_t *)ptr;
+  ts_tree_cursor_delete(&walk->cursor);
+  return Qnil;
+}
+
+// Walk +node+, or only its descendants, with a cursor of its own, so around
+// hooks may yield whenever they like.
+static void node_dispatch_walk(VALUE state, TSNode node, bool include_root) {
+  node_dispatch_walk_t walk = {
+      .state = state,
+      .cursor = ts_tree_cursor_new(node),
+      .include_root = include_root,
+  };
+  rb_ensure(node_dispatch_walk_body, (VALUE)&walk, node_dispatch_walk_ensure,
+            (VALUE)&walk);
+}
+
+/**
+ * Walk the node and its descendants depth-first, calling hooks on
+ * +receiver+ from dispatch tables indexed by symbol id.
+ *
+ * The walk is native: nodes without hooks don't go through ruby at all.
+ *
+ * - +on+ hooks are called with the node, before visiting its children.
+ * - +around+ hooks are called with the node and a block, which visits its
+ *   children when called.
+ *
+ * Both tables are Arrays of method names, or +nil+ for no hook, indexed by
+ * {symbol}; their last entry is used for the symbols past the grammar's,
+ * like +ERROR+. See {Language#symbol_names}.
+ *
+ * @example
+ *   on = language.symbol_names.map { |name| :count if name == :identifier }
+ *   node.dispatch(counter, on + [nil], [])
+ *
+ * @param receiver [Object]
+ * @param on [Array<Symbol, nil>]
+ * @param around [Array<Symbol, nil>]
+ * @param wrap [#call, nil] converts the {Node} given to the hooks, e.g. into
+ *   a +TreeStand::Node+.
+ *
+ * @return [nil]
+ */
+static VALUE node_dispatch(int argc, VALUE *argv, VALUE self) {
+  VALUE receiver, on, around, wrap;
+  rb_scan_args(argc, argv, "31", &receiver, &on, &around, &wrap);
+  Check_Type(on, T_ARRAY);
+  Check_Type(around, T_ARRAY);
+
+  VALUE state = rb_ary_new_capa(NODE_DISPATCH_SIZE);
+  rb_ary_store(state, NODE_DISPATCH_RECEIVER, receiver);
+  rb_ary_store(state, NODE_DISPATCH_ON, rb_ary_dup(on));
+  rb_ary_store(state, NODE_DISPATCH_AROUND, rb_ary_dup(around));
+  rb_ary_store(state, NODE_DISPATCH_WRAP, wrap);
+  rb_ary_freeze(state);
+
+  node_dispatch_walk(state, SELF, true);
+  RB_GC_GUARD(state);
+  return Qnil;
+}
+
 void init_node(void) {
   cNode = rb_define_class_under(mTreeSitter, "Node", rb_cObject);
 
@@ -593,6 +746,7 @@ void init_node(void) {
                    node_descendant_for_byte_range, 2);
   rb_define_method(cNode, "descendant_for_point_range",
                    node_descendant_for_point_range, 2);
+  rb_define_method(cNode, "dispatch", node_dispatch, -1);
   rb_define_method(cNode, "edit", node_edit, 1);
   rb_define_method(cNode, "end_byte", node_end_byte, 0);
   rb_define_method(cNode, "end_point", node_end_point, 0);
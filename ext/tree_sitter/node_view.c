@@ -0,0 +1,277 @@
+#include "tree_sitter.h"
+
+extern VALUE mTreeSitter;
+
+VALUE cNodeView;
+
+// A node, and where a walk found it, updated in place at every step of
+// {TreeCursor#walk}.
+//
+// valid:      whether the walk is still running; the node might belong to a
+//             tree that's gone afterwards.
+// field_name: a static string of the language, or NULL.
+// skip:       whether the walk must not visit the children of node.
+typedef struct {
+  TSNode node;
+  TSFieldId field_id;
+  const char *field_name;
+  uint32_t depth;
+  bool valid;
+  bool skip;
+} node_view_t;
+
+const rb_data_type_t node_view_data_type = {
+    .wrap_struct_name = "node_view",
+    .function =
+        {
+            .dmark = NULL,
+            .dfree = RUBY_TYPED_DEFAULT_FREE,
+            .dsize = NULL,
+            .dcompact = NULL,
+        },
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static node_view_t *unwrap(VALUE self) {
+  node_view_t *view;
+  TypedData_Get_Struct(self, node_view_t, &node_view_data_type, view);
+  if (!view->valid) {
+    rb_raise(rb_eRuntimeError,
+             "NodeView used outside of its walk; call #to_node to keep a node");
+  }
+  return view;
+}
+
+#define NODE unwrap(self)->node
+
+VALUE node_view_new(void) {
+  node_view_t *view;
+  return TypedData_Make_Struct(cNodeView, node_view_t, &node_view_data_type,
+                               view);
+}
+
+/**
+ * Point +view+ at the current node of +cursor+, +depth+ levels below where
+ * the walk started.
+ */
+void node_view_set(VALUE view, const TSTreeCursor *cursor, uint32_t depth) {
+  node_view_t *ptr = RTYPEDDATA_DATA(view);
+  ptr->node = ts_tree_cursor_current_node(cursor);
+  ptr->field_id = ts_tree_cursor_current_field_id(cursor);
+  ptr->field_name = ts_tree_cursor_current_field_name(cursor);
+  ptr->depth = depth;
+  ptr->valid = true;
+  ptr->skip = false;
+}
+
+/**
+ * Whether {NodeView#skip_children!} was called on the current node.
+ */
+bool node_view_skipped(VALUE view) {
+  return ((node_view_t *)RTYPEDDATA_DATA(view))->skip;
+}
+
+void node_view_invalidate(VALUE view) {
+  ((node_view_t *)RTYPEDDATA_DATA(view))->valid = false;
+}
+
+/**
+ * @return [Symbol] the type of the node.
+ */
+static VALUE node_view_type(VALUE self) {
+  return safe_symbol(ts_node_type(NODE));
+}
+
+/**
+ * @return [Integer] the symbol of the node.
+ */
+static VALUE node_view_symbol(VALUE self) {
+  return UINT2NUM(ts_node_symbol(NODE));
+}
+
+/**
+ * @return [Integer]
+ */
+static VALUE node_view_start_byte(VALUE self) {
+  return UINT2NUM(ts_node_start_byte(NODE));
+}
+
+/**
+ * @return [Integer]
+ */
+static VALUE node_view_end_byte(VALUE self) {
+  return UINT2NUM(ts_node_end_byte(NODE));
+}
+
+/**
+ * @return [Point]
+ */
+static VALUE node_view_start_point(VALUE self) {
+  return new_point_by_val(ts_node_start_point(NODE));
+}
+
+/**
+ * @return [Point]
+ */
+static VALUE node_view_end_point(VALUE self) {
+  return new_point_by_val(ts_node_end_point(NODE));
+}
+
+/**
+ * @return [Integer] the row of the start of the node, without allocating a
+ *   {Point}.
+ */
+static VALUE node_view_start_row(VALUE self) {
+  return UINT2NUM(ts_node_start_point(NODE).row);
+}
+
+/**
+ * @return [Integer] the row of the end of the node, without allocating a
+ *   {Point}.
+ */
+static VALUE node_view_end_row(VALUE self) {
+  return UINT2NUM(ts_node_end_point(NODE).row);
+}
+
+/**
+ * @return [Integer] the field id of the node in its parent, 0 if none.
+ */
+static VALUE node_view_field_id(VALUE self) {
+  return UINT2NUM(unwrap(self)->field_id);
+}
+
+/**
+ * @return [Symbol, nil] the field name of the node in its parent.
+ */
+static VALUE node_view_field_name(VALUE self) {
+  return safe_symbol(unwrap(self)->field_name);
+}
+
+/**
+ * @return [Integer] the depth of the node below the node the walk started
+ *   from.
+ */
+static VALUE node_view_depth(VALUE self) {
+  return UINT2NUM(unwrap(self)->depth);
+}
+
+/**
+ * @return [Integer]
+ */
+static VALUE node_view_child_count(VALUE self) {
+  return UINT2NUM(ts_node_child_count(NODE));
+}
+
+/**
+ * @return [Boolean]
+ */
+static VALUE node_view_is_named(VALUE self) {
+  return ts_node_is_named(NODE) ? Qtrue : Qfalse;
+}
+
+/**
+ * @return [Boolean]
+ */
+static VALUE node_view_is_extra(VALUE self) {
+  return ts_node_is_extra(NODE) ? Qtrue : Qfalse;
+}
+
+/**
+ * @return [Boolean]
+ */
+static VALUE node_view_is_missing(VALUE self) {
+  return ts_node_is_missing(NODE) ? Qtrue : Qfalse;
+}
+
+/**
+ * @return [Boolean]
+ */
+static VALUE node_view_is_error(VALUE self) {
+  return ts_node_is_error(NODE) ? Qtrue : Qfalse;
+}
+
+/**
+ * @return [Boolean]
+ */
+static VALUE node_view_has_error(VALUE self) {
+  return ts_node_has_error(NODE) ? Qtrue : Qfalse;
+}
+
+/**
+ * The text of the node in +source+.
+ *
+ * @param source [String] the source the tree was parsed from.
+ *
+ * @raise [IndexError] if the node is out of +source+.
+ *
+ * @return [String]
+ */
+static VALUE node_view_text(VALUE self, VALUE source) {
+  TSNode node = NODE;
+  StringValue(source);
+  uint32_t start = ts_node_start_byte(node);
+  uint32_t end = ts_node_end_byte(node);
+  if ((long)end > RSTRING_LEN(source)) {
+    rb_raise(rb_eIndexError, "Node %u...%u out of source (len = %ld)", start,
+             end, RSTRING_LEN(source));
+  }
+  return rb_str_subseq(source, start, end - start);
+}
+
+/**
+ * Don't visit the children of the node.
+ *
+ * @return [nil]
+ */
+static VALUE node_view_skip_children(VALUE self) {
+  unwrap(self)->skip = true;
+  return Qnil;
+}
+
+/**
+ * A {Node} for the current node, which stays valid after the walk moves on.
+ *
+ * @return [Node]
+ */
+static VALUE node_view_to_node(VALUE self) {
+  return new_node_by_val(NODE);
+}
+
+static VALUE node_view_inspect(VALUE self) {
+  node_view_t *view = RTYPEDDATA_DATA(self);
+  if (!view->valid) {
+    return rb_sprintf("#<TreeSitter::NodeView (invalid)>");
+  }
+  return rb_sprintf("#<TreeSitter::NodeView %s %u...%u depth=%u>",
+                    ts_node_type(view->node), ts_node_start_byte(view->node),
+                    ts_node_end_byte(view->node), view->depth);
+}
+
+void init_node_view(void) {
+  cNodeView = rb_define_class_under(mTreeSitter, "NodeView", rb_cObject);
+  rb_undef_alloc_func(cNodeView);
+
+  /* Class methods */
+  rb_define_method(cNodeView, "child_count", node_view_child_count, 0);
+  rb_define_method(cNodeView, "depth", node_view_depth, 0);
+  rb_define_method(cNodeView, "end_byte", node_view_end_byte, 0);
+  rb_define_method(cNodeView, "end_point", node_view_end_point, 0);
+  rb_define_method(cNodeView, "end_row", node_view_end_row, 0);
+  rb_define_method(cNodeView, "error?", node_view_is_error, 0);
+  rb_define_method(cNodeView, "extra?", node_view_is_extra, 0);
+  rb_define_method(cNodeView, "field_id", node_view_field_id, 0);
+  rb_define_method(cNodeView, "field_name", node_view_field_name, 0);
+  rb_define_method(cNodeView, "has_error?", node_view_has_error, 0);
+  rb_define_method(cNodeView, "inspect", node_view_inspect, 0);
+  rb_define_method(cNodeView, "missing?", node_view_is_missing, 0);
+  rb_define_method(cNodeView, "named?", node_view_is_named, 0);
+  rb_define_method(cNodeView, "skip_children!", node_view_skip_children, 0);
+  rb_define_method(cNodeView, "start_byte", node_view_start_byte, 0);
+  rb_define_method(cNodeView, "start_point", node_view_start_point, 0);
+  rb_define_method(cNodeView, "start_row", node_view_start_row, 0);
+  rb_define_method(cNodeView, "symbol", node_view_symbol, 0);
+  rb_define_method(cNodeView, "text", node_view_text, 1);
+  rb_define_method(cNodeView, "to_node", node_view_to_node, 0);
+  rb_define_method(cNodeView, "to_s", node_view_inspect, 0);
+  rb_define_method(cNodeView, "type", node_view_type, 0);
+}
@@ -1,22 +1,65 @@
+// clock_gettime is POSIX, and we build with -std=c99.
+#define _POSIX_C_SOURCE 200809L
+
 #include "tree_sitter.h"
+#include <ruby/thread.h>
+#include <time.h>
 
 extern VALUE mTreeSitter;
 
 VALUE cParser;
 
+// What a parse did, see {Parser#stats}.
+//
+// reused: the share of the old tree that was reused, negative when the parse
+//         wasn't incremental.
+typedef struct {
+  uint64_t wall_ns;
+  uint64_t cpu_ns;
+  uint64_t bytes;
+  uint64_t nodes;
+  uint64_t errors;
+  uint64_t missing;
+  double reused;
+} parse_stats_t;
+
+// Process-wide counters of all the parses, see {TreeSitter.stats}.
+static uint64_t stats_parses = 0;
+static uint64_t stats_incremental_parses = 0;
+static uint64_t stats_failed_parses = 0;
+static uint64_t stats_trees_with_errors = 0;
+static uint64_t stats_bytes = 0;
+static uint64_t stats_nodes = 0;
+static uint64_t stats_wall_ns = 0;
+static uint64_t stats_cpu_ns = 0;
+
+// memsize:     the bytes tree-sitter allocated for the parser itself.  What a
+//              parse allocates is attributed to the tree it returns.
+// halt_reason: a static symbol, or nil.
+// parsing:     whether a parse is running, possibly without the GVL.
+// stats:       what the last parse did, when has_stats.
 typedef struct {
   TSParser *data;
   size_t cancellation_flag;
+  size_t memsize;
+  VALUE halt_reason;
+  bool parsing;
+  bool has_stats;
+  parse_stats_t stats;
 } parser_t;
 
 static void parser_free(void *ptr) {
+  memory_scope_t scope;
+  memory_scope_begin(&scope);
   ts_parser_delete(((parser_t *)ptr)->data);
+  memory_scope_end(&scope);
+  memory_gc_sync();
   xfree(ptr);
 }
 
 static size_t parser_memsize(const void *ptr) {
-  parser_t *type = (parser_t *)ptr;
-  return sizeof(type);
+  const parser_t *type = (const parser_t *)ptr;
+  return sizeof(parser_t) + type->memsize;
 }
 
 const rb_data_type_t parser_data_type = {
@@ -33,10 +76,33 @@ const rb_data_type_t parser_data_type = {
 
 DATA_UNWRAP(parser)
 
+// The parser, unless it's parsing: a parse runs without the GVL, and its
+// TSParser must not be changed, nor used, under its feet.
+static parser_t *idle(VALUE self) {
+  parser_t *parser = unwrap(self);
+  if (parser->parsing) {
+    rb_raise(rb_eRuntimeError, "Parser is already parsing in another thread");
+  }
+  return parser;
+}
+
+static void parser_account(parser_t *parser, ssize_t bytes) {
+  if (bytes < 0 && (size_t)-bytes > parser->memsize) {
+    parser->memsize = 0;
+  } else {
+    parser->memsize += bytes;
+  }
+  memory_gc_sync();
+}
+
 static VALUE parser_allocate(VALUE klass) {
   parser_t *parser;
+  memory_scope_t scope;
   VALUE res = TypedData_Make_Struct(klass, parser_t, &parser_data_type, parser);
+  parser->halt_reason = Qnil;
+  memory_scope_begin(&scope);
   parser->data = ts_parser_new();
+  parser_account(parser, memory_scope_end(&scope));
   return res;
 }
 
@@ -79,7 +145,7 @@ static VALUE parser_set_cancellation_flag(VALUE self, VALUE flag) {
  * Get the parser's current language.
  */
 static VALUE parser_get_language(VALUE self) {
-  return new_language(ts_parser_language(SELF));
+  return new_language(ts_parser_language(idle(self)->data));
 }
 
 /**
@@ -95,8 +161,12 @@ static VALUE parser_get_language(VALUE self) {
  * @return [Boolean]
  */
 static VALUE parser_set_language(VALUE self, VALUE language) {
-  return ts_parser_set_language(SELF, value_to_language(language)) ? Qtrue
-                                                                   : Qfalse;
+  parser_t *parser = idle(self);
+  memory_scope_t scope;
+  memory_scope_begin(&scope);
+  bool res = ts_parser_set_language(parser->data, value_to_language(language));
+  parser_account(parser, memory_scope_end(&scope));
+  return res ? Qtrue : Qfalse;
 }
 
 /**
@@ -106,7 +176,7 @@ static VALUE parser_set_language(VALUE self, VALUE language) {
  */
 static VALUE parser_get_included_ranges(VALUE self) {
   uint32_t length;
-  const TSRange *ranges = ts_parser_included_ranges(SELF, &length);
+  const TSRange *ranges = ts_parser_included_ranges(idle(self)->data, &length);
   VALUE res = rb_ary_new_capa(length);
   for (uint32_t i = 0; i < length; i++) {
     rb_ary_push(res, new_range(&ranges[i]));
@@ -142,6 +212,7 @@ static VALUE parser_get_included_ranges(VALUE self) {
  * @return [Boolean]
  */
 static VALUE parser_set_included_ranges(VALUE self, VALUE array) {
+  parser_t *parser = idle(self);
   Check_Type(array, T_ARRAY);
 
   long length = rb_array_len(array);
@@ -149,7 +220,11 @@ static VALUE parser_set_included_ranges(VALUE self, VALUE array) {
   for (long i = 0; i < length; i++) {
     ranges[i] = value_to_range(rb_ary_entry(array, i));
   }
-  bool res = ts_parser_set_included_ranges(SELF, ranges, (uint32_t)length);
+  memory_scope_t scope;
+  memory_scope_begin(&scope);
+  bool res =
+      ts_parser_set_included_ranges(parser->data, ranges, (uint32_t)length);
+  parser_account(parser, memory_scope_end(&scope));
   if (ranges) {
     free(ranges);
   }
@@ -162,7 +237,7 @@ static VALUE parser_set_included_ranges(VALUE self, VALUE array) {
  * @return [Logger]
  */
 static VALUE parser_get_logger(VALUE self) {
-  return new_logger_by_val(ts_parser_logger(SELF));
+  return new_logger_by_val(ts_parser_logger(idle(self)->data));
 }
 
 /**
@@ -177,10 +252,336 @@ static VALUE parser_get_logger(VALUE self) {
  * @return nil
  */
 static VALUE parser_set_logger(VALUE self, VALUE logger) {
-  ts_parser_set_logger(SELF, value_to_logger(logger));
+  ts_parser_set_logger(idle(self)->data, value_to_logger(logger));
   return Qnil;
 }
 
+// The state of a single parse, handed to the progress callback, which might
+// run without the GVL.
+//
+// scope:        what tree-sitter allocated since the parse last started or
+//               resumed.
+// bytes:        what tree-sitter allocated before the parse last resumed.
+// max_memory:   the budget for bytes + scope, 0 when unlimited.
+// over_budget:  whether the parse was halted by max_memory.
+// interrupted:  whether ruby asked the thread to stop parsing.
+// halt_reason:  why the parse was halted, nil if it wasn't.
+// stats:        whether to collect the detailed stats of the parse.
+typedef struct {
+  memory_scope_t scope;
+  ssize_t bytes;
+  size_t max_memory;
+  bool stats;
+  bool over_budget;
+  bool interrupted;
+  VALUE halt_reason;
+} parse_state_t;
+
+// A contiguous buffer fed to tree-sitter in one go.
+typedef struct {
+  const char *str;
+  uint32_t len;
+} string_input_t;
+
+static const char *string_input_read(void *payload, uint32_t byte_index,
+                                     TSPoint position, uint32_t *bytes_read) {
+  string_input_t *input = (string_input_t *)payload;
+  if (byte_index >= input->len) {
+    *bytes_read = 0;
+    return "";
+  }
+  *bytes_read = input->len - byte_index;
+  return input->str + byte_index;
+}
+
+static bool parser_progress(TSParseState *state) {
+  parse_state_t *parse = (parse_state_t *)state->payload;
+  if (__atomic_load_n(&parse->interrupted, __ATOMIC_RELAXED)) {
+    return true;
+  }
+  if (parse->max_memory > 0 &&
+      parse->bytes + parse->scope.bytes > (ssize_t)parse->max_memory) {
+    parse->over_budget = true;
+    return true;
+  }
+  return false;
+}
+
+// A parse run without the GVL.
+typedef struct {
+  TSParser *parser;
+  TSTree *old_tree;
+  TSInput input;
+  TSParseOptions options;
+  parse_state_t *parse;
+  parser_t *self;
+  TSTree *res;
+  bool done;
+} parse_nogvl_t;
+
+static void *parser_parse_nogvl(void *ptr) {
+  parse_nogvl_t *args = (parse_nogvl_t *)ptr;
+  memory_scope_begin(&args->parse->scope);
+  args->res = ts_parser_parse_with_options(args->parser, args->old_tree,
+                                           args->input, args->options);
+  memory_scope_end(&args->parse->scope);
+  return NULL;
+}
+
+static void parser_parse_interrupt(void *ptr) {
+  parse_state_t *parse = (parse_state_t *)ptr;
+  __atomic_store_n(&parse->interrupted, true, __ATOMIC_RELAXED);
+}
+
+static void parser_parse_options(VALUE opts, parse_state_t *parse) {
+  parse->bytes = 0;
+  parse->max_memory = 0;
+  parse->over_budget = false;
+  parse->interrupted = false;
+  parse->halt_reason = Qnil;
+  parse->stats = false;
+
+  if (NIL_P(opts)) {
+    return;
+  }
+
+  ID keys[2] = {rb_intern("max_memory"), rb_intern("stats")};
+  VALUE values[2];
+  rb_get_kwargs(opts, keys, 0, 2, values);
+
+  parse->stats = values[1] != Qundef && RTEST(values[1]);
+
+  if (values[0] != Qundef && !NIL_P(values[0])) {
+    long long max_memory = NUM2LL(values[0]);
+    if (max_memory <= 0) {
+      rb_raise(rb_eArgError, "max_memory must be positive, got %lld",
+               max_memory);
+    }
+    parse->max_memory = (size_t)max_memory;
+  }
+}
+
+// Parse without the GVL, checking for interrupts whenever ruby asks us to.
+static VALUE parser_parse_without_gvl(VALUE ptr) {
+  parse_nogvl_t *args = (parse_nogvl_t *)ptr;
+  rb_thread_call_without_gvl(parser_parse_nogvl, args, parser_parse_interrupt,
+                             args->parse);
+  // tree-sitter resumes where it was interrupted.
+  while (args->res == NULL && args->parse->interrupted &&
+         !args->parse->over_budget) {
+    args->parse->bytes += args->parse->scope.bytes;
+    args->parse->scope.bytes = 0;
+    args->parse->interrupted = false;
+    rb_thread_check_ints();
+    rb_thread_call_without_gvl(parser_parse_nogvl, args,
+                               parser_parse_interrupt, args->parse);
+  }
+  args->done = true;
+  return Qnil;
+}
+
+// If an interrupt raised, drop the half-done parse.
+static VALUE parser_parse_ensure(VALUE ptr) {
+  parse_nogvl_t *args = (parse_nogvl_t *)ptr;
+  parser_t *parser = args->self;
+  parser->parsing = false;
+  if (!args->done) {
+    memory_scope_t scope;
+    memory_scope_begin(&scope);
+    ts_parser_reset(parser->data);
+    memory_scope_end(&scope);
+    if (args->res != NULL) {
+      ts_tree_delete(args->res);
+    }
+    memory_gc_sync();
+  }
+  return Qnil;
+}
+
+static uint64_t parser_clock(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Count the error and missing nodes, only walking the subtrees with errors.
+static void parse_stats_count_errors(parse_stats_t *stats, TSNode root) {
+  TSTreeCursor cursor = ts_tree_cursor_new(root);
+  for (;;) {
+    TSNode node = ts_tree_cursor_current_node(&cursor);
+    if (ts_node_is_error(node)) {
+      stats->errors++;
+    } else if (ts_node_is_missing(node)) {
+      stats->missing++;
+    }
+    if (ts_node_has_error(node) && ts_tree_cursor_goto_first_child(&cursor)) {
+      continue;
+    }
+    while (!ts_tree_cursor_goto_next_sibling(&cursor)) {
+      if (!ts_tree_cursor_goto_parent(&cursor)) {
+        ts_tree_cursor_delete(&cursor);
+        return;
+      }
+    }
+  }
+}
+
+// The share of +tree+ outside of the ranges that changed since +old_tree+.
+static double parse_stats_reused(const TSTree *old_tree, const TSTree *tree,
+                                 uint64_t bytes) {
+  if (bytes == 0) {
+    return 1.0;
+  }
+  uint32_t length;
+  TSRange *ranges = ts_tree_get_changed_ranges(old_tree, tree, &length);
+  uint64_t changed = 0;
+  for (uint32_t i = 0; i < length; i++) {
+    changed += ranges[i].end_byte - ranges[i].start_byte;
+  }
+  memory_free(ranges);
+  return changed >= bytes ? 0.0 : 1.0 - (double)changed / (double)bytes;
+}
+
+// Update the process-wide counters, and the detailed stats of the parse if
+// asked to.
+static void parser_record_stats(parser_t *parser, const parse_state_t *parse,
+                                const TSTree *old_tree, const TSTree *tree,
+                                uint32_t length, uint64_t wall_ns,
+                                uint64_t cpu_ns) {
+  __atomic_add_fetch(&stats_parses, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&stats_wall_ns, wall_ns, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&stats_cpu_ns, cpu_ns, __ATOMIC_RELAXED);
+  if (old_tree != NULL) {
+    __atomic_add_fetch(&stats_incremental_parses, 1, __ATOMIC_RELAXED);
+  }
+  if (tree == NULL) {
+    __atomic_add_fetch(&stats_failed_parses, 1, __ATOMIC_RELAXED);
+    parser->has_stats = false;
+    return;
+  }
+
+  TSNode root = ts_tree_root_node(tree);
+  parse_stats_t stats = {
+      .wall_ns = wall_ns,
+      .cpu_ns = cpu_ns,
+      // Inputs other than strings don't tell us their length.
+      .bytes = length > 0 ? length : ts_node_end_byte(root),
+      .nodes = ts_node_descendant_count(root),
+      .reused = -1,
+  };
+  __atomic_add_fetch(&stats_bytes, stats.bytes, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&stats_nodes, stats.nodes, __ATOMIC_RELAXED);
+  if (ts_node_has_error(root)) {
+    __atomic_add_fetch(&stats_trees_with_errors, 1, __ATOMIC_RELAXED);
+  }
+
+  parser->has_stats = parse->stats;
+  if (!parse->stats) {
+    return;
+  }
+  memory_scope_t scope;
+  memory_scope_begin(&scope);
+  parse_stats_count_errors(&stats, root);
+  if (old_tree != NULL) {
+    stats.reused = parse_stats_reused(old_tree, tree, stats.bytes);
+  }
+  memory_scope_end(&scope);
+  parser->stats = stats;
+}
+
+// Run a parse, attributing what it allocated to the resulting tree.
+//
+// With nogvl, the GVL is released while parsing, so other threads can parse
+// in parallel; the input and the logger must not call into ruby.
+//
+// length is the length of the input in bytes, 0 when unknown.
+static VALUE parser_parse_input(VALUE self, VALUE old_tree, TSInput input,
+                                uint32_t length, VALUE opts, bool nogvl) {
+  parser_t *parser = idle(self);
+  parse_state_t parse;
+  parser_parse_options(opts, &parse);
+
+  TSTree *tree = NULL;
+  if (!NIL_P(old_tree)) {
+    tree = value_to_tree(old_tree);
+  }
+  parse_nogvl_t args = {
+      .parser = parser->data,
+      .old_tree = tree,
+      .input = input,
+      .options =
+          {
+              .payload = &parse,
+              .progress_callback =
+                  nogvl || parse.max_memory > 0 ? parser_progress : NULL,
+          },
+      .parse = &parse,
+      .self = parser,
+  };
+
+  uint64_t wall = parser_clock(CLOCK_MONOTONIC);
+  uint64_t cpu = parser_clock(CLOCK_THREAD_CPUTIME_ID);
+  if (nogvl) {
+    parser->parsing = true;
+    rb_ensure(parser_parse_without_gvl, (VALUE)&args, parser_parse_ensure,
+              (VALUE)&args);
+  } else {
+    parser_parse_nogvl(&args);
+  }
+  ssize_t bytes = parse.bytes + parse.scope.bytes;
+  TSTree *ret = args.res;
+  parser_record_stats(parser, &parse, tree, ret, length,
+                      parser_clock(CLOCK_MONOTONIC) - wall,
+                      parser_clock(CLOCK_THREAD_CPUTIME_ID) - cpu);
+
+  if (parse.over_budget) {
+    parse.halt_reason = ID2SYM(rb_intern("max_memory"));
+  }
+  parser->halt_reason = parse.halt_reason;
+  if (!NIL_P(parse.halt_reason)) {
+    // Don't let the next parse resume from, and hold on to, a state we
+    // deliberately gave up on.
+    memory_scope_begin(&parse.scope);
+    ts_parser_reset(parser->data);
+    bytes += memory_scope_end(&parse.scope);
+  }
+
+  memory_gc_sync();
+  if (ret == NULL) {
+    return Qnil;
+  } else {
+    return new_tree(ret, bytes > 0 ? (size_t)bytes : 0);
+  }
+}
+
+// Strings are parsed without the GVL unless a logger, which calls into ruby,
+// is set.
+static VALUE parser_parse_string_input(VALUE self, VALUE old_tree,
+                                       VALUE string, TSInputEncoding encoding,
+                                       VALUE opts) {
+  bool nogvl = ts_parser_logger(idle(self)->data).log == NULL;
+  StringValue(string);
+  if (nogvl) {
+    // Shares the buffer, which stays valid even if string is modified by
+    // another thread while we parse.
+    string = rb_str_new_frozen(string);
+  }
+  string_input_t payload = {
+      .str = RSTRING_PTR(string),
+      .len = (uint32_t)RSTRING_LEN(string),
+  };
+  TSInput input = {
+      .payload = &payload,
+      .read = string_input_read,
+      .encoding = encoding,
+      .decode = NULL,
+  };
+  VALUE res =
+      parser_parse_input(self, old_tree, input, payload.len, opts, nogvl);
+  RB_GC_GUARD(string);
+  return res;
+}
+
 /**
  * Use the parser to parse some source code and create a syntax tree.
  *
@@ -218,30 +619,29 @@ static VALUE parser_set_logger(VALUE self, VALUE logger) {
  *    earlier call to {Parser#cancellation_flag=}. You can resume parsing
  *    from where the parser left out by calling {Parser#parse} again with
  *    the same arguments.
+ * 4. Parsing allocated more than +max_memory+ bytes. The parser is reset,
+ *    and {Parser#halt_reason} is +:max_memory+.
  *
  * @note this is curently incomplete, as the {Input} class is incomplete.
  *
- * @param old_tree [Tree]
- * @param input    [Input]
+ * @param old_tree   [Tree]
+ * @param input      [Input]
+ * @param max_memory [Integer, nil] the maximum number of bytes tree-sitter
+ *   is allowed to allocate for this parse.
+ * @param stats      [Boolean] collect the {Parser#stats} of this parse.
  *
  * @return [Tree, nil] A parse tree if parsing was successful.
  */
-static VALUE parser_parse(VALUE self, VALUE old_tree, VALUE input) {
+static VALUE parser_parse(int argc, VALUE *argv, VALUE self) {
+  VALUE old_tree, input, opts;
+  rb_scan_args(argc, argv, "2:", &old_tree, &input, &opts);
+
   if (NIL_P(input)) {
     return Qnil;
   }
 
-  TSTree *tree = NULL;
-  if (!NIL_P(old_tree)) {
-    tree = value_to_tree(old_tree);
-  }
-
-  TSTree *ret = ts_parser_parse(SELF, tree, value_to_input(input));
-  if (ret == NULL) {
-    return Qnil;
-  } else {
-    return new_tree(ret);
-  }
+  return parser_parse_input(self, old_tree, value_to_input(input), 0, opts,
+                            false);
 }
 
 /**
@@ -250,29 +650,31 @@ static VALUE parser_parse(VALUE self, VALUE old_tree, VALUE input) {
  * above. The second two parameters indicate the location of the buffer and its
  * length in bytes.
  *
- * @param old_tree [Tree]
- * @param string   [String]
+ * @example Bound the memory of a parse
+ *   tree = parser.parse_string(nil, source, max_memory: 64 * 1024 * 1024)
+ *   raise 'too big' if tree.nil? && parser.halt_reason == :max_memory
+ *
+ * @example Collect the stats of a parse
+ *   tree = parser.parse_string(old_tree, source, stats: true)
+ *   parser.stats.reused # => 0.98
+ *
+ * @param old_tree   [Tree]
+ * @param string     [String]
+ * @param max_memory [Integer, nil] see {Parser#parse}.
+ * @param stats      [Boolean] see {Parser#parse}.
  *
  * @return [Tree, nil] A parse tree if parsing was successful.
  */
-static VALUE parser_parse_string(VALUE self, VALUE old_tree, VALUE string) {
+static VALUE parser_parse_string(int argc, VALUE *argv, VALUE self) {
+  VALUE old_tree, string, opts;
+  rb_scan_args(argc, argv, "2:", &old_tree, &string, &opts);
+
   if (NIL_P(string)) {
     return Qnil;
   }
 
-  const char *str = StringValuePtr(string);
-  uint32_t len = (uint32_t)RSTRING_LEN(string);
-  TSTree *tree = NULL;
-  if (!NIL_P(old_tree)) {
-    tree = value_to_tree(old_tree);
-  }
-
-  TSTree *ret = ts_parser_parse_string(SELF, tree, str, len);
-  if (ret == NULL) {
-    return Qnil;
-  } else {
-    return new_tree(ret);
-  }
+  return parser_parse_string_input(self, old_tree, string, TSInputEncodingUTF8,
+                                   opts);
 }
 
 /**
@@ -281,33 +683,104 @@ static VALUE parser_parse_string(VALUE self, VALUE old_tree, VALUE string) {
  * {Parser#parse_string} method above. The final parameter indicates whether
  * the text is encoded as {Encoding::UTF8} or {Encoding::UTF16}.
  *
- * @param old_tree [Tree]
- * @param string   [String]
- * @param encoding [Encoding]
+ * @param old_tree   [Tree]
+ * @param string     [String]
+ * @param encoding   [Encoding]
+ * @param max_memory [Integer, nil] see {Parser#parse}.
+ * @param stats      [Boolean] see {Parser#parse}.
  *
  * @return [Tree, nil] A parse tree if parsing was successful.
  */
-static VALUE parser_parse_string_encoding(VALUE self, VALUE old_tree,
-                                          VALUE string, VALUE encoding) {
+static VALUE parser_parse_string_encoding(int argc, VALUE *argv, VALUE self) {
+  VALUE old_tree, string, encoding, opts;
+  rb_scan_args(argc, argv, "3:", &old_tree, &string, &encoding, &opts);
+
   if (NIL_P(string)) {
     return Qnil;
   }
 
-  const char *str = StringValuePtr(string);
-  uint32_t len = (uint32_t)RSTRING_LEN(string);
-  TSTree *tree = NULL;
-  if (!NIL_P(old_tree)) {
-    tree = value_to_tree(old_tree);
-  }
+  return parser_parse_string_input(self, old_tree, string,
+                                   value_to_encoding(encoding), opts);
+}
 
-  TSTree *ret = ts_parser_parse_string_encoding(SELF, tree, str, len,
-                                                value_to_encoding(encoding));
+/**
+ * Why the last parse was halted.
+ *
+ * - +nil+: the last parse was not halted.
+ * - +:max_memory+: it allocated more than its +max_memory+.
+ *
+ * @return [Symbol, nil]
+ */
+static VALUE parser_get_halt_reason(VALUE self) {
+  return unwrap(self)->halt_reason;
+}
 
-  if (ret == NULL) {
+/**
+ * The stats of the last parse, if it was made with +stats: true+.
+ *
+ * - +wall_ns+, +cpu_ns+: the wall and CPU time of the parse.
+ * - +bytes+: the length of the input.
+ * - +nodes+: the nodes in the tree.
+ * - +errors+, +missing+: the error and missing nodes in the tree.
+ * - +reused+: for incremental parses, the share of the document outside of
+ *   the ranges that changed since the old tree, +nil+ otherwise.
+ *
+ * @see TreeSitter.stats
+ *
+ * @return [ParseStats, nil]
+ */
+static VALUE parser_get_stats(VALUE self) {
+  parser_t *parser = unwrap(self);
+  if (!parser->has_stats) {
     return Qnil;
-  } else {
-    return new_tree(ret);
   }
+  const parse_stats_t *stats = &parser->stats;
+  VALUE parse_stats = rb_const_get(mTreeSitter, rb_intern("ParseStats"));
+  return rb_funcall(parse_stats, rb_intern("new"), 7, ULL2NUM(stats->wall_ns),
+                    ULL2NUM(stats->cpu_ns), ULL2NUM(stats->bytes),
+                    ULL2NUM(stats->nodes), ULL2NUM(stats->errors),
+                    ULL2NUM(stats->missing),
+                    stats->reused < 0 ? Qnil : DBL2NUM(stats->reused));
+}
+
+/**
+ * Counters of all the parses since the extension was loaded, to export to
+ * monitoring.
+ *
+ * - +parses+: number of parses.
+ * - +incremental_parses+: number of parses given an old tree.
+ * - +failed_parses+: number of parses that didn't return a tree.
+ * - +trees_with_errors+: number of trees with syntax errors.
+ * - +bytes+: bytes parsed.
+ * - +nodes+: nodes created.
+ * - +wall_ns+, +cpu_ns+: wall and CPU time spent parsing.
+ *
+ * @see Parser#stats
+ *
+ * @return [Hash<Symbol, Integer>]
+ */
+static VALUE parser_stats(VALUE self) {
+  VALUE res = rb_hash_new();
+  rb_hash_aset(res, ID2SYM(rb_intern("parses")),
+               ULL2NUM(__atomic_load_n(&stats_parses, __ATOMIC_RELAXED)));
+  rb_hash_aset(
+      res, ID2SYM(rb_intern("incremental_parses")),
+      ULL2NUM(__atomic_load_n(&stats_incremental_parses, __ATOMIC_RELAXED)));
+  rb_hash_aset(
+      res, ID2SYM(rb_intern("failed_parses")),
+      ULL2NUM(__atomic_load_n(&stats_failed_parses, __ATOMIC_RELAXED)));
+  rb_hash_aset(
+      res, ID2SYM(rb_intern("trees_with_errors")),
+      ULL2NUM(__atomic_load_n(&stats_trees_with_errors, __ATOMIC_RELAXED)));
+  rb_hash_aset(res, ID2SYM(rb_intern("bytes")),
+               ULL2NUM(__atomic_load_n(&stats_bytes, __ATOMIC_RELAXED)));
+  rb_hash_aset(res, ID2SYM(rb_intern("nodes")),
+               ULL2NUM(__atomic_load_n(&stats_nodes, __ATOMIC_RELAXED)));
+  rb_hash_aset(res, ID2SYM(rb_intern("wall_ns")),
+               ULL2NUM(__atomic_load_n(&stats_wall_ns, __ATOMIC_RELAXED)));
+  rb_hash_aset(res, ID2SYM(rb_intern("cpu_ns")),
+               ULL2NUM(__atomic_load_n(&stats_cpu_ns, __ATOMIC_RELAXED)));
+  return res;
 }
 
 /**
@@ -322,16 +795,17 @@ static VALUE parser_parse_string_encoding(VALUE self, VALUE old_tree,
  * @return nil
  */
 static VALUE parser_print_dot_graphs(VALUE self, VALUE file) {
+  TSParser *parser = idle(self)->data;
   if (NIL_P(file)) {
-    ts_parser_print_dot_graphs(SELF, -1);
+    ts_parser_print_dot_graphs(parser, -1);
   } else if (rb_integer_type_p(file) && NUM2INT(file) < 0) {
-    ts_parser_print_dot_graphs(SELF, NUM2INT(file));
+    ts_parser_print_dot_graphs(parser, NUM2INT(file));
   } else {
     Check_Type(file, T_STRING);
     char *path = StringValueCStr(file);
     int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC,
                   0644); // 0644 = all read + user write
-    ts_parser_print_dot_graphs(SELF, fd);
+    ts_parser_print_dot_graphs(parser, fd);
   }
   return Qnil;
 }
@@ -348,7 +822,11 @@ static VALUE parser_print_dot_graphs(VALUE self, VALUE file) {
  * @return nil
  */
 static VALUE parser_reset(VALUE self) {
-  ts_parser_reset(SELF);
+  parser_t *parser = idle(self);
+  memory_scope_t scope;
+  memory_scope_begin(&scope);
+  ts_parser_reset(parser->data);
+  parser_account(parser, memory_scope_end(&scope));
   return Qnil;
 }
 
@@ -357,21 +835,26 @@ void init_parser(void) {
 
   rb_define_alloc_func(cParser, parser_allocate);
 
+  /* Module methods */
+  rb_define_module_function(mTreeSitter, "stats", parser_stats, 0);
+
   /* Class methods */
   rb_define_method(cParser, "cancellation_flag", parser_get_cancellation_flag,
                    0);
   rb_define_method(cParser, "cancellation_flag=", parser_set_cancellation_flag,
                    1);
+  rb_define_method(cParser, "halt_reason", parser_get_halt_reason, 0);
   rb_define_method(cParser, "included_ranges", parser_get_included_ranges, 0);
   rb_define_method(cParser, "included_ranges=", parser_set_included_ranges, 1);
   rb_define_method(cParser, "language", parser_get_language, 0);
   rb_define_method(cParser, "language=", parser_set_language, 1);
   rb_define_method(cParser, "logger", parser_get_logger, 0);
   rb_define_method(cParser, "logger=", parser_set_logger, 1);
-  rb_define_method(cParser, "parse", parser_parse, 2);
-  rb_define_method(cParser, "parse_string", parser_parse_string, 2);
+  rb_define_method(cParser, "parse", parser_parse, -1);
+  rb_define_method(cParser, "parse_string", parser_parse_string, -1);
   rb_define_method(cParser, "parse_string_encoding",
-                   parser_parse_string_encoding, 3);
+                   parser_parse_string_encoding, -1);
   rb_define_method(cParser, "print_dot_graphs", parser_print_dot_graphs, 1);
   rb_define_method(cParser, "reset", parser_reset, 0);
+  rb_define_method(cParser, "stats", parser_get_stats, 0);
 }
@@ -4,7 +4,67 @@ extern VALUE mTreeSitter;
 
 VALUE cQuery;
 
-DATA_PTR_WRAP(Query, query);
+// memsize:         the bytes tree-sitter allocated to compile the query.
+// text_predicates: evaluated natively while iterating over matches.
+// properties:      #set! settings, and #is? predicates evaluated natively.
+typedef struct {
+  TSQuery *data;
+  size_t memsize;
+  text_predicates_t *text_predicates;
+  query_properties_t *properties;
+} query_t;
+
+static void query_free(void *ptr) {
+  query_t *query = (query_t *)ptr;
+  text_predicates_free(query->text_predicates);
+  query_properties_free(query->properties);
+  if (query->data != NULL) {
+    memory_scope_t scope;
+    memory_scope_begin(&scope);
+    ts_query_delete(query->data);
+    memory_scope_end(&scope);
+    memory_gc_sync();
+  }
+  xfree(ptr);
+}
+
+static size_t query_memsize(const void *ptr) {
+  const query_t *query = (const query_t *)ptr;
+  return sizeof(query_t) + query->memsize +
+         text_predicates_memsize(query->text_predicates) +
+         query_properties_memsize(query->properties);
+}
+
+static void query_mark(void *ptr) {
+  query_t *query = (query_t *)ptr;
+  text_predicates_mark(query->text_predicates);
+  query_properties_mark(query->properties);
+}
+
+const rb_data_type_t query_data_type = {
+    .wrap_struct_name = "query",
+    .function =
+        {
+            .dmark = query_mark,
+            .dfree = query_free,
+            .dsize = query_memsize,
+            .dcompact = NULL,
+        },
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+DATA_ALLOCATE(query)
+DATA_UNWRAP(query)
+DATA_PTR_NEW(cQuery, TSQuery, query)
+DATA_FROM_VALUE(TSQuery *, query)
+
+const text_predicates_t *value_to_text_predicates(VALUE self) {
+  return unwrap(self)->text_predicates;
+}
+
+const query_properties_t *value_to_query_properties(VALUE self) {
+  return unwrap(self)->properties;
+}
 
 /**
  * Get the number of captures literals in the query.
@@ -109,6 +169,209 @@ static VALUE query_disable_pattern(VALUE self, VALUE pattern) {
   }
 }
 
+// The capture name or string literal of +step+, for error messages.
+static VALUE query_step_value(const TSQuery *query,
+                              const TSQueryPredicateStep *step) {
+  uint32_t length;
+  const char *value =
+      step->type == TSQueryPredicateStepTypeCapture
+          ? ts_query_capture_name_for_id(query, step->value_id, &length)
+          : ts_query_string_value_for_id(query, step->value_id, &length);
+  return safe_str2(value, length);
+}
+
+static bool query_operator_is(const char *op, uint32_t len, const char *name) {
+  return strlen(name) == len && memcmp(op, name, len) == 0;
+}
+
+// Raise an ArgumentError about the predicate of +pattern+, prefixed with its
+// line in +source+.
+//
+// Lines are only counted when raising, so valid queries don't pay for it.
+PRINTF_ARGS(NORETURN(static void query_predicate_error(
+                const TSQuery *query, uint32_t pattern, VALUE source,
+                const char *fmt, ...)),
+            4, 5);
+static void query_predicate_error(const TSQuery *query, uint32_t pattern,
+                                  VALUE source, const char *fmt, ...) {
+  const char *src = RSTRING_PTR(source);
+  uint32_t offset = ts_query_start_byte_for_pattern(query, pattern);
+  long row = 0;
+  for (uint32_t i = 0; i < offset && i < RSTRING_LEN(source); i++) {
+    row += src[i] == '\n';
+  }
+
+  va_list args;
+  va_start(args, fmt);
+  VALUE msg = rb_vsprintf(fmt, args);
+  va_end(args);
+
+  rb_raise(rb_eArgError, "L%ld: %" PRIsVALUE, row, msg);
+}
+
+// Validate one predicate, i.e. steps up to, but excluding, a DONE step.
+static void query_validate_predicate(const TSQuery *query, uint32_t pattern,
+                                     VALUE source,
+                                     const TSQueryPredicateStep *steps,
+                                     uint32_t length) {
+  if (steps[0].type != TSQueryPredicateStepTypeString) {
+    query_predicate_error(
+        query, pattern, source,
+        "Expected predicate to start with a function name. Got @%" PRIsVALUE
+        ".",
+        query_step_value(query, &steps[0]));
+  }
+
+  uint32_t op_len;
+  const char *op =
+      ts_query_string_value_for_id(query, steps[0].value_id, &op_len);
+  bool eq = query_operator_is(op, op_len, "eq?") ||
+            query_operator_is(op, op_len, "not-eq?") ||
+            query_operator_is(op, op_len, "any-eq?") ||
+            query_operator_is(op, op_len, "any-not-eq?");
+  bool match = query_operator_is(op, op_len, "match?") ||
+               query_operator_is(op, op_len, "not-match?") ||
+               query_operator_is(op, op_len, "any-match?") ||
+               query_operator_is(op, op_len, "any-not-match?");
+  bool any_of = query_operator_is(op, op_len, "any-of?") ||
+                query_operator_is(op, op_len, "not-any-of?");
+  bool property = query_operator_is(op, op_len, "set!") ||
+                  query_operator_is(op, op_len, "is?") ||
+                  query_operator_is(op, op_len, "is-not?");
+
+  if (property) {
+    // An optional capture, a key, and an optional value.
+    if (length < 2 || length > 4) {
+      query_predicate_error(query, pattern, source,
+                            "Wrong number of arguments to #%.*s predicate. "
+                            "Expected 1 to 3, got %u.",
+                            (int)op_len, op, length - 1);
+    }
+    bool capture = false;
+    uint32_t strings = 0;
+    for (uint32_t i = 1; i < length; i++) {
+      if (steps[i].type == TSQueryPredicateStepTypeCapture) {
+        if (capture) {
+          query_predicate_error(query, pattern, source,
+                                "Invalid arguments to #%.*s predicate. "
+                                "Unexpected second capture name @%" PRIsVALUE
+                                ".",
+                                (int)op_len, op,
+                                query_step_value(query, &steps[i]));
+        }
+        capture = true;
+      } else if (++strings > 2) {
+        query_predicate_error(query, pattern, source,
+                              "Invalid arguments to #%.*s predicate. "
+                              "Unexpected third argument \"%" PRIsVALUE "\".",
+                              (int)op_len, op,
+                              query_step_value(query, &steps[i]));
+      }
+    }
+    if (strings == 0) {
+      query_predicate_error(query, pattern, source,
+                            "Invalid arguments to #%.*s predicate. Missing "
+                            "key argument.",
+                            (int)op_len, op);
+    }
+    return;
+  }
+
+  if (!eq && !match && !any_of) {
+    return;
+  }
+
+  if ((eq || match) && length != 3) {
+    query_predicate_error(query, pattern, source,
+                          "Wrong number of arguments to #%.*s predicate. "
+                          "Expected 2, got %u.",
+                          (int)op_len, op, length - 1);
+  }
+  if (any_of && length < 2) {
+    query_predicate_error(query, pattern, source,
+                          "Wrong number of arguments to #%.*s predicate. "
+                          "Expected at least 1, got %u.",
+                          (int)op_len, op, length - 1);
+  }
+  if (steps[1].type != TSQueryPredicateStepTypeCapture) {
+    query_predicate_error(query, pattern, source,
+                          "First argument to #%.*s predicate must be a "
+                          "capture name. Got literal \"%" PRIsVALUE "\".",
+                          (int)op_len, op, query_step_value(query, &steps[1]));
+  }
+  if (match && steps[2].type == TSQueryPredicateStepTypeCapture) {
+    query_predicate_error(query, pattern, source,
+                          "Second argument to #%.*s predicate must be a "
+                          "literal. Got capture @%" PRIsVALUE ".",
+                          (int)op_len, op, query_step_value(query, &steps[2]));
+  }
+  if (any_of) {
+    for (uint32_t i = 2; i < length; i++) {
+      if (steps[i].type == TSQueryPredicateStepTypeCapture) {
+        query_predicate_error(query, pattern, source,
+                              "Arguments to #%.*s predicate must be literals. "
+                              "Got capture @%" PRIsVALUE ".",
+                              (int)op_len, op,
+                              query_step_value(query, &steps[i]));
+      }
+    }
+  }
+}
+
+// Validate the predicates of all the patterns, the way {Query#process} used
+// to, but without allocating anything unless there's an error to report.
+static void query_validate_predicates(const TSQuery *query, VALUE source) {
+  uint32_t pattern_count = ts_query_pattern_count(query);
+
+  for (uint32_t i = 0; i < pattern_count; i++) {
+    uint32_t length;
+    const TSQueryPredicateStep *steps =
+        ts_query_predicates_for_pattern(query, i, &length);
+    uint32_t start = 0;
+    for (uint32_t j = 0; j < length; j++) {
+      if (steps[j].type != TSQueryPredicateStepTypeDone) {
+        continue;
+      }
+      if (j > start) {
+        query_validate_predicate(query, i, source, &steps[start], j - start);
+      }
+      start = j + 1;
+    }
+  }
+}
+
+/**
+ * Get the quantifiers of all the captures in all the patterns.
+ *
+ * +capture_quantifiers[pattern][capture]+ is the same as
+ * +capture_quantifier_for_id(pattern, capture)+, and is built on first access.
+ *
+ * @return [Array<Array<Integer>>]
+ */
+static VALUE query_capture_quantifiers(VALUE self) {
+  VALUE res = rb_ivar_get(self, rb_intern("@capture_quantifiers"));
+  if (!NIL_P(res)) {
+    return res;
+  }
+
+  const TSQuery *query = SELF;
+  uint32_t pattern_count = ts_query_pattern_count(query);
+  uint32_t capture_count = ts_query_capture_count(query);
+  res = rb_ary_new_capa(pattern_count);
+  for (uint32_t i = 0; i < pattern_count; i++) {
+    VALUE row = rb_ary_new_capa(capture_count);
+    for (uint32_t j = 0; j < capture_count; j++) {
+      rb_ary_push(row,
+                  UINT2NUM(ts_query_capture_quantifier_for_id(query, i, j)));
+    }
+    rb_ary_push(res, rb_ary_freeze(row));
+  }
+  rb_ary_freeze(res);
+  rb_ivar_set(self, rb_intern("@capture_quantifiers"), res);
+
+  return res;
+}
+
 /**
  * Create a new query from a string containing one or more S-expression
  * patterns. The query is associated with a particular language, and can
@@ -116,7 +379,12 @@ static VALUE query_disable_pattern(VALUE self, VALUE pattern) {
  *
  * If all of the given patterns are valid, this returns a {Query}.
  *
- * @raise [RuntimeError]
+ * Predicates are validated eagerly, but the tables describing them
+ * ({#text_predicates}, {#general_predicates}, …) are only built when first
+ * accessed.
+ *
+ * @raise [QueryCreationError] if the patterns are invalid.
+ * @raise [ArgumentError] if a predicate is malformed.
  *
  * @param language [Language]
  * @param source   [String]
@@ -130,25 +398,46 @@ static VALUE query_initialize(VALUE self, VALUE language, VALUE source) {
   uint32_t len = (uint32_t)RSTRING_LEN(source);
   uint32_t error_offset = 0;
   TSQueryError error_type;
+  memory_scope_t scope;
 
+  memory_scope_begin(&scope);
   TSQuery *res = ts_query_new(lang, src, len, &error_offset, &error_type);
+  ssize_t bytes = memory_scope_end(&scope);
+  memory_gc_sync();
 
   if (res == NULL || error_offset > 0) {
     VALUE query_creation_error = rb_const_get(mTreeSitter, rb_intern("QueryCreationError"));
     rb_raise(query_creation_error, "Could not create query: TSQueryError%s",
              query_error_str(error_type));
   } else {
-    SELF = res;
+    query_t *query = unwrap(self);
+    query->data = res;
+    query->memsize = bytes > 0 ? (size_t)bytes : 0;
+    query_validate_predicates(res, source);
+    text_predicates_compile(res, &query->text_predicates);
+    query_properties_compile(res, &query->properties);
   }
 
-  rb_iv_set(self, "@text_predicates", rb_ary_new());
-  rb_iv_set(self, "@property_predicates", rb_ary_new());
-  rb_iv_set(self, "@property_settings", rb_ary_new());
-  rb_iv_set(self, "@general_predicates", rb_ary_new());
+  return self;
+}
 
-  rb_funcall(self, rb_intern("process"), 1, source);
+/**
+ * Get the +#set!+ properties of a pattern.
+ *
+ * @param pattern_index [Integer]
+ *
+ * @return [Hash<String, String|nil>] a frozen Hash, shared with
+ *   {QueryMatch#properties}.
+ */
+static VALUE query_properties_for_pattern(VALUE self, VALUE pattern_index) {
+  query_t *query = unwrap(self);
+  uint32_t index = NUM2UINT(pattern_index);
+  uint32_t range = ts_query_pattern_count(query->data);
 
-  return self;
+  if (index >= range) {
+    rb_raise(rb_eIndexError, "Index %d out of range (len = %d)", index, range);
+  }
+  return query_properties_settings(query->properties, index);
 }
 
 /**
@@ -173,6 +462,52 @@ static VALUE query_pattern_guaranteed_at_step(VALUE self, VALUE byte_offset) {
       ts_query_is_pattern_guaranteed_at_step(SELF, NUM2UINT(byte_offset)));
 }
 
+// The index of a pattern of +query+, raising if out of range.
+static uint32_t query_pattern_index(const TSQuery *query, VALUE pattern_index) {
+  uint32_t index = NUM2UINT(pattern_index);
+  uint32_t range = ts_query_pattern_count(query);
+  if (index >= range) {
+    rb_raise(rb_eIndexError, "Index %d out of range (len = %d)", index, range);
+  }
+  return index;
+}
+
+/**
+ * Check if a given pattern has a single root node.
+ *
+ * @raise [IndexError] if out of range.
+ *
+ * @param pattern_index [Integer]
+ *
+ * @return [Boolean]
+ */
+static VALUE query_pattern_rooted(VALUE self, VALUE pattern_index) {
+  const TSQuery *query = SELF;
+  return ts_query_is_pattern_rooted(query,
+                                    query_pattern_index(query, pattern_index))
+             ? Qtrue
+             : Qfalse;
+}
+
+/**
+ * Check if a given pattern is non-local: it has multiple root nodes, like
+ * +((comment)+ @doc . (method))+, so its matches can start before the
+ * range given to a {QueryCursor}.
+ *
+ * @raise [IndexError] if out of range.
+ *
+ * @param pattern_index [Integer]
+ *
+ * @return [Boolean]
+ */
+static VALUE query_pattern_non_local(VALUE self, VALUE pattern_index) {
+  const TSQuery *query = SELF;
+  return ts_query_is_pattern_non_local(
+             query, query_pattern_index(query, pattern_index))
+             ? Qtrue
+             : Qfalse;
+}
+
 /**
  * Get all of the predicates for the given pattern in the query.
  *
@@ -262,9 +597,6 @@ static VALUE query_string_value_for_id(VALUE self, VALUE id) {
   }
 }
 
-// FIXME: missing:
-// 1. ts_query_is_pattern_rooted
-// 1. ts_query_is_pattern_non_local
 void init_query(void) {
   cQuery = rb_define_class_under(mTreeSitter, "Query", rb_cObject);
 
@@ -275,14 +607,19 @@ void init_query(void) {
   rb_define_method(cQuery, "capture_name_for_id", query_capture_name_for_id, 1);
   rb_define_method(cQuery, "capture_quantifier_for_id",
                    query_capture_quantifier_for_id, 2);
+  rb_define_method(cQuery, "capture_quantifiers", query_capture_quantifiers, 0);
   rb_define_method(cQuery, "disable_capture", query_disable_capture, 1);
   rb_define_method(cQuery, "disable_pattern", query_disable_pattern, 1);
   rb_define_method(cQuery, "initialize", query_initialize, 2);
   rb_define_method(cQuery, "pattern_count", query_pattern_count, 0);
   rb_define_method(cQuery, "pattern_guaranteed_at_step?",
                    query_pattern_guaranteed_at_step, 1);
+  rb_define_method(cQuery, "pattern_non_local?", query_pattern_non_local, 1);
+  rb_define_method(cQuery, "pattern_rooted?", query_pattern_rooted, 1);
   rb_define_method(cQuery, "predicates_for_pattern",
                    query_predicates_for_pattern, 1);
+  rb_define_method(cQuery, "properties_for_pattern",
+                   query_properties_for_pattern, 1);
   rb_define_method(cQuery, "start_byte_for_pattern",
                    query_start_byte_for_pattern, 1);
   rb_define_method(cQuery, "string_count", query_string_count, 0);
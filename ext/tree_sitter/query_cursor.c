@@ -1,21 +1,143 @@
+// clock_gettime is POSIX, and we build with -std=c99.
+#define _POSIX_C_SOURCE 200809L
+
 #include "tree_sitter.h"
+#include <ruby/thread.h>
+#include <time.h>
 
 extern VALUE mTreeSitter;
 
 VALUE cQueryCursor;
 
-DATA_TYPE(TSQueryCursor *, query_cursor)
-DATA_FREE_PTR(query_cursor)
-DATA_MEMSIZE(query_cursor)
-DATA_DECLARE_DATA_TYPE(query_cursor)
+// memsize:     the bytes tree-sitter allocated for the cursor's state, which
+//              grows as it runs queries.
+// query:       the query being executed, kept alive for as long as the cursor
+//              might reach into it.
+// options:     handed to tree-sitter, which keeps a pointer to them.
+// deadline:    CLOCK_MONOTONIC nanoseconds after which the query is halted, 0
+//              when unlimited.
+// byte_offset: how far in the source the query went.
+// timed_out:   whether the query was halted by the deadline.
+// finished:    whether there are no more matches.
+// pattern:     the pattern of the last match of #next_capture_hash,
+//              UINT32_MAX if none.
+// properties:  the properties asserted for #is? predicates, kept as given.
+// assertions:  a copy of properties usable without the GVL, NULL when
+//              #is? predicates are not checked.
+// profiling:   whether to count what happens to the matches of each pattern.
+// profile:     QUERY_CURSOR_PROFILE_FIELDS counters per pattern of query,
+//              NULL when not profiling.
+// busy:        whether #exec_packed is draining the cursor without the GVL.
+typedef struct {
+  TSQueryCursor *data;
+  size_t memsize;
+  VALUE query;
+  TSQueryCursorOptions options;
+  uint64_t deadline;
+  uint32_t byte_offset;
+  bool timed_out;
+  bool finished;
+  uint32_t pattern;
+  VALUE properties;
+  query_property_assertions_t *assertions;
+  bool profiling;
+  uint64_t *profile;
+  uint32_t profile_pattern_count;
+  bool busy;
+} query_cursor_t;
+
+// The counters of a pattern in a profile: matches found by tree-sitter,
+// matches accepted, matches rejected by text predicates, matches rejected
+// by property predicates, and nanoseconds spent checking predicates.
+#define QUERY_CURSOR_PROFILE_FIELDS 5
+
+enum {
+  QUERY_CURSOR_PROFILE_MATCHES,
+  QUERY_CURSOR_PROFILE_ACCEPTED,
+  QUERY_CURSOR_PROFILE_TEXT_REJECTED,
+  QUERY_CURSOR_PROFILE_PROPERTY_REJECTED,
+  QUERY_CURSOR_PROFILE_PREDICATE_NS,
+};
+
+static void query_cursor_free(void *ptr) {
+  query_cursor_t *query_cursor = (query_cursor_t *)ptr;
+  query_property_assertions_free(query_cursor->assertions);
+  xfree(query_cursor->profile);
+  if (query_cursor->data != NULL) {
+    memory_scope_t scope;
+    memory_scope_begin(&scope);
+    ts_query_cursor_delete(query_cursor->data);
+    memory_scope_end(&scope);
+    memory_gc_sync();
+  }
+  xfree(ptr);
+}
+
+static size_t query_cursor_memsize(const void *ptr) {
+  const query_cursor_t *query_cursor = (const query_cursor_t *)ptr;
+  return sizeof(query_cursor_t) + query_cursor->memsize +
+         sizeof(uint64_t) * QUERY_CURSOR_PROFILE_FIELDS *
+             query_cursor->profile_pattern_count;
+}
+
+static void query_cursor_mark(void *ptr) {
+  query_cursor_t *query_cursor = (query_cursor_t *)ptr;
+  rb_gc_mark_movable(query_cursor->query);
+  rb_gc_mark_movable(query_cursor->properties);
+}
+
+static void query_cursor_compact(void *ptr) {
+  query_cursor_t *query_cursor = (query_cursor_t *)ptr;
+  query_cursor->query = rb_gc_location(query_cursor->query);
+  query_cursor->properties = rb_gc_location(query_cursor->properties);
+}
+
+const rb_data_type_t query_cursor_data_type = {
+    .wrap_struct_name = "query_cursor",
+    .function =
+        {
+            .dmark = query_cursor_mark,
+            .dfree = query_cursor_free,
+            .dsize = query_cursor_memsize,
+            .dcompact = query_cursor_compact,
+        },
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static void query_cursor_account(query_cursor_t *query_cursor, ssize_t bytes) {
+  if (bytes < 0 && (size_t)-bytes > query_cursor->memsize) {
+    query_cursor->memsize = 0;
+  } else {
+    query_cursor->memsize += bytes;
+  }
+  memory_gc_sync();
+}
+
 static VALUE query_cursor_allocate(VALUE klass) {
   query_cursor_t *query_cursor;
+  memory_scope_t scope;
   VALUE res = TypedData_Make_Struct(klass, query_cursor_t,
                                     &query_cursor_data_type, query_cursor);
+  query_cursor->query = Qnil;
+  query_cursor->properties = Qnil;
+  query_cursor->pattern = UINT32_MAX;
+  memory_scope_begin(&scope);
   query_cursor->data = ts_query_cursor_new();
+  query_cursor_account(query_cursor, memory_scope_end(&scope));
   return res;
 }
 DATA_UNWRAP(query_cursor)
+
+// The cursor, unless #exec_packed is draining it without the GVL, in which
+// case it must not be restarted, nor its state changed or freed.
+static query_cursor_t *idle(VALUE self) {
+  query_cursor_t *query_cursor = unwrap(self);
+  if (query_cursor->busy) {
+    rb_raise(rb_eRuntimeError, "QueryCursor is busy in another thread");
+  }
+  return query_cursor;
+}
+
 /**
  * Create a new cursor for executing a given query.
  *
@@ -41,37 +163,208 @@ DATA_UNWRAP(query_cursor)
 DATA_PTR_NEW(cQueryCursor, TSQueryCursor, query_cursor)
 DATA_FROM_VALUE(TSQueryCursor *, query_cursor)
 
+static uint64_t query_cursor_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Called by tree-sitter every so often while looking for matches, possibly
+// without the GVL.
+static bool query_cursor_progress(TSQueryCursorState *state) {
+  query_cursor_t *query_cursor = (query_cursor_t *)state->payload;
+  query_cursor->byte_offset = state->current_byte_offset;
+  if (query_cursor->deadline != 0 &&
+      query_cursor_now() >= query_cursor->deadline) {
+    query_cursor->timed_out = true;
+    return true;
+  }
+  return false;
+}
+
+// The bounds of a Range of +Integer+ or {Point}, +end+ being exclusive.
+static void query_cursor_range(VALUE range, VALUE *from, VALUE *to,
+                               bool *exclusive) {
+  int excl;
+  if (!rb_range_values(range, from, to, &excl)) {
+    rb_raise(rb_eTypeError, "Expected a Range, got %" PRIsVALUE,
+             rb_obj_class(range));
+  }
+  *exclusive = excl;
+}
+
+static void query_cursor_set_ranges(query_cursor_t *query_cursor,
+                                    VALUE byte_range, VALUE point_range) {
+  VALUE from, to;
+  bool exclusive;
+
+  if (!NIL_P(byte_range)) {
+    query_cursor_range(byte_range, &from, &to, &exclusive);
+    uint32_t start = NIL_P(from) ? 0 : NUM2UINT(from);
+    uint32_t end = NIL_P(to)      ? UINT32_MAX
+                   : exclusive    ? NUM2UINT(to)
+                                  : NUM2UINT(to) + 1;
+    if (!ts_query_cursor_set_byte_range(query_cursor->data, start, end)) {
+      rb_raise(rb_eArgError, "Invalid byte range %" PRIsVALUE, byte_range);
+    }
+  }
+
+  if (!NIL_P(point_range)) {
+    query_cursor_range(point_range, &from, &to, &exclusive);
+    TSPoint start = NIL_P(from) ? (TSPoint){0, 0} : value_to_point(from);
+    TSPoint end =
+        NIL_P(to) ? (TSPoint){UINT32_MAX, UINT32_MAX} : value_to_point(to);
+    if (!exclusive && !NIL_P(to)) {
+      end.column++;
+    }
+    if (!ts_query_cursor_set_point_range(query_cursor->data, start, end)) {
+      rb_raise(rb_eArgError, "Invalid point range %" PRIsVALUE, point_range);
+    }
+  }
+}
+
+// Zero the profile of the current query, or drop it when not profiling.
+static void query_cursor_profile_reset(query_cursor_t *query_cursor) {
+  xfree(query_cursor->profile);
+  query_cursor->profile = NULL;
+  query_cursor->profile_pattern_count = 0;
+  if (query_cursor->profiling && RTEST(query_cursor->query)) {
+    uint32_t count = ts_query_pattern_count(value_to_query(query_cursor->query));
+    query_cursor->profile =
+        ZALLOC_N(uint64_t, (size_t)count * QUERY_CURSOR_PROFILE_FIELDS);
+    query_cursor->profile_pattern_count = count;
+  }
+}
+
+// Start running +query+ on +node+, with the options given to {#exec}.
+static void query_cursor_start(VALUE self, VALUE query, VALUE node,
+                               VALUE opts) {
+  query_cursor_t *query_cursor = idle(self);
+  uint64_t deadline = 0;
+
+  if (!NIL_P(opts)) {
+    ID keys[3] = {rb_intern("timeout"), rb_intern("byte_range"),
+                  rb_intern("point_range")};
+    VALUE values[3];
+    rb_get_kwargs(opts, keys, 0, 3, values);
+
+    if (values[0] != Qundef && !NIL_P(values[0])) {
+      double timeout = NUM2DBL(values[0]);
+      if (!(timeout > 0)) {
+        rb_raise(rb_eArgError, "timeout must be positive, got %" PRIsVALUE,
+                 values[0]);
+      }
+      deadline = query_cursor_now() + (uint64_t)(timeout * 1e9);
+    }
+    query_cursor_set_ranges(query_cursor,
+                            values[1] == Qundef ? Qnil : values[1],
+                            values[2] == Qundef ? Qnil : values[2]);
+  }
+
+  bool same_query = query_cursor->query == query;
+  RB_OBJ_WRITE(self, &query_cursor->query, query);
+  // Profiles accumulate over the executions of the same query.
+  if (query_cursor->profiling && !(same_query && query_cursor->profile)) {
+    query_cursor_profile_reset(query_cursor);
+  }
+  query_cursor->deadline = deadline;
+  query_cursor->byte_offset = 0;
+  query_cursor->timed_out = false;
+  query_cursor->finished = false;
+  query_cursor->pattern = UINT32_MAX;
+  query_cursor->options.payload = query_cursor;
+  query_cursor->options.progress_callback = query_cursor_progress;
+
+  memory_scope_t scope;
+  memory_scope_begin(&scope);
+  ts_query_cursor_exec_with_options(query_cursor->data, value_to_query(query),
+                                    value_to_node(node),
+                                    &query_cursor->options);
+  query_cursor_account(query_cursor, memory_scope_end(&scope));
+}
+
 /**
  * Start running a given query on a given node.
  *
+ * @see QueryCursor#exec
+ *
  * @param query [Query]
  * @param node  [Node]
  *
  * @return [QueryCursor]
  */
-static VALUE query_cursor_exec_static(VALUE self, VALUE query, VALUE node) {
+static VALUE query_cursor_exec_static(int argc, VALUE *argv, VALUE self) {
+  VALUE query, node, opts;
+  rb_scan_args(argc, argv, "2:", &query, &node, &opts);
   VALUE res = query_cursor_allocate(cQueryCursor);
-  query_cursor_t *query_cursor = unwrap(res);
-  ts_query_cursor_exec(query_cursor->data, value_to_query(query),
-                       value_to_node(node));
+  query_cursor_start(res, query, node, opts);
   return res;
 }
 
 /**
  * Start running a given query on a given node.
  *
+ * Ranges are kept for the following executions, like with
+ * {#set_byte_range} and {#set_point_range}.
+ *
+ * @example Enforce a budget
+ *   cursor.exec(query, root, timeout: 0.05, byte_range: 0...4096)
+ *   matches = cursor.matches_packed(…)
+ *   warn "partial results" if cursor.status == :timed_out
+ *
  * @param query [Query]
  * @param node  [Node]
+ * @param timeout [Numeric, nil] seconds after which the query is halted,
+ *   checked natively while looking for matches.
+ * @param byte_range [Range<Integer>, nil] only look for matches in this range.
+ * @param point_range [Range<Point>, nil] only look for matches in this range.
+ *
+ * @raise [ArgumentError] if a range is invalid.
  *
  * @return [QueryCursor]
  */
-static VALUE query_cursor_exec(VALUE self, VALUE query, VALUE node) {
-  query_cursor_t *query_cursor = unwrap(self);
-  ts_query_cursor_exec(query_cursor->data, value_to_query(query),
-                       value_to_node(node));
+static VALUE query_cursor_exec(int argc, VALUE *argv, VALUE self) {
+  VALUE query, node, opts;
+  rb_scan_args(argc, argv, "2:", &query, &node, &opts);
+  query_cursor_start(self, query, node, opts);
   return self;
 }
 
+/**
+ * Why the cursor stopped, or didn't.
+ *
+ * - +:running+: there might be more matches.
+ * - +:completed+: all the matches were returned.
+ * - +:timed_out+: the query was halted by the +timeout+ given to {#exec};
+ *   the matches returned so far are valid, but there might be more.
+ * - +:exceeded_match_limit+: all the matches were returned, but some
+ *   in-progress matches were dropped because of {#match_limit}.
+ *
+ * @return [Symbol]
+ */
+static VALUE query_cursor_status(VALUE self) {
+  query_cursor_t *query_cursor = unwrap(self);
+  if (query_cursor->timed_out) {
+    return ID2SYM(rb_intern("timed_out"));
+  } else if (!query_cursor->finished) {
+    return ID2SYM(rb_intern("running"));
+  } else if (ts_query_cursor_did_exceed_match_limit(query_cursor->data)) {
+    return ID2SYM(rb_intern("exceeded_match_limit"));
+  } else {
+    return ID2SYM(rb_intern("completed"));
+  }
+}
+
+/**
+ * How far in the source the query went, as reported by tree-sitter while
+ * looking for matches.
+ *
+ * @return [Integer]
+ */
+static VALUE query_cursor_byte_offset(VALUE self) {
+  return UINT2NUM(unwrap(self)->byte_offset);
+}
+
 /**
  * Manage the maximum number of in-progress matches allowed by this query
  * cursor.
@@ -93,7 +386,7 @@ static VALUE query_cursor_did_exceed_match_limit(VALUE self) {
  * @return [nil]
  */
 static VALUE query_cursor_set_match_limit(VALUE self, VALUE limit) {
-  ts_query_cursor_set_match_limit(SELF, NUM2UINT(limit));
+  ts_query_cursor_set_match_limit(idle(self)->data, NUM2UINT(limit));
   return Qnil;
 }
 
@@ -127,10 +420,95 @@ static VALUE query_cursor_set_max_start_depth(VALUE self,
   if (!NIL_P(max_start_depth)) {
     max = NUM2UINT(max_start_depth);
   }
-  ts_query_cursor_set_max_start_depth(SELF, max);
+  ts_query_cursor_set_max_start_depth(idle(self)->data, max);
   return Qnil;
 }
 
+// What matches must satisfy to be returned.
+//
+// text:       the text predicates, NULL when there's no source to check them
+//             against.
+// properties: the #is? predicates, NULL when no properties were asserted.
+// profile:    the counters of the cursor, NULL when not profiling.
+typedef struct {
+  const text_predicates_t *text;
+  const char *src;
+  size_t src_len;
+  const query_properties_t *properties;
+  const query_property_assertions_t *assertions;
+  uint64_t *profile;
+} query_cursor_filter_t;
+
+// Whether anything needs to be checked at all.
+static bool query_cursor_filter(query_cursor_t *query_cursor, VALUE source,
+                                query_cursor_filter_t *filter) {
+  *filter = (query_cursor_filter_t){0};
+  if (!RTEST(query_cursor->query)) {
+    return false;
+  }
+  if (!NIL_P(source)) {
+    StringValue(source);
+    filter->text = value_to_text_predicates(query_cursor->query);
+    filter->src = RSTRING_PTR(source);
+    filter->src_len = RSTRING_LEN(source);
+  }
+  if (query_cursor->assertions != NULL) {
+    filter->properties = value_to_query_properties(query_cursor->query);
+    filter->assertions = query_cursor->assertions;
+  }
+  filter->profile = query_cursor->profile;
+  return filter->text != NULL || filter->properties != NULL ||
+         filter->profile != NULL;
+}
+
+// Like query_cursor_accept, counting what happened to +match+.
+static bool query_cursor_profile_accept(const query_cursor_filter_t *filter,
+                                        const TSQueryMatch *match) {
+  uint64_t *counters =
+      filter->profile + (size_t)match->pattern_index * QUERY_CURSOR_PROFILE_FIELDS;
+  uint64_t start = query_cursor_now();
+  bool res = true;
+  counters[QUERY_CURSOR_PROFILE_MATCHES]++;
+  if (filter->text != NULL &&
+      !text_predicates_satisfied(filter->text, match, filter->src,
+                                 filter->src_len)) {
+    counters[QUERY_CURSOR_PROFILE_TEXT_REJECTED]++;
+    res = false;
+  } else if (filter->properties != NULL &&
+             !query_properties_satisfied(filter->properties, match,
+                                         filter->assertions)) {
+    counters[QUERY_CURSOR_PROFILE_PROPERTY_REJECTED]++;
+    res = false;
+  } else {
+    counters[QUERY_CURSOR_PROFILE_ACCEPTED]++;
+  }
+  counters[QUERY_CURSOR_PROFILE_PREDICATE_NS] += query_cursor_now() - start;
+  return res;
+}
+
+// Whether +match+ satisfies the predicates of its pattern.
+static bool query_cursor_accept(const query_cursor_filter_t *filter,
+                                const TSQueryMatch *match) {
+  if (filter->profile != NULL) {
+    return query_cursor_profile_accept(filter, match);
+  }
+  return (filter->text == NULL ||
+          text_predicates_satisfied(filter->text, match, filter->src,
+                                    filter->src_len)) &&
+         (filter->properties == NULL ||
+          query_properties_satisfied(filter->properties, match,
+                                     filter->assertions));
+}
+
+// A match with the #set! properties of its pattern.
+static VALUE query_cursor_new_match(query_cursor_t *query_cursor,
+                                    const TSQueryMatch *match) {
+  return new_query_match_with_properties(
+      match, query_properties_settings(
+                 value_to_query_properties(query_cursor->query),
+                 match->pattern_index));
+}
+
 // FIXME: maybe this is the limit of how "transparent" the bindings need to be.
 // Pending benchmarks, this can be very inefficient because obviously
 // ts_query_cursor_next_capture is intended to be used in a loop.  Creating an
@@ -141,16 +519,40 @@ static VALUE query_cursor_set_max_start_depth(VALUE self,
 /**
  * Advance to the next capture of the currently running query.
  *
+ * If a +source+ is given, matches not satisfying the text predicates of the
+ * query (+#eq?+, +#match?+, +#any-of?+, …) are skipped and removed natively.
+ *
+ * @param source [String, nil] the source the tree was parsed from.
+ *
  * @return [Array<Integer|Boolean>|nil] If there is a capture, return a tuple
  * [Integer, Boolean], otherwise return +nil+.
  */
-static VALUE query_cursor_next_capture(VALUE self) {
+static VALUE query_cursor_next_capture(int argc, VALUE *argv, VALUE self) {
+  VALUE source;
+  rb_scan_args(argc, argv, "01", &source);
+
+  query_cursor_t *query_cursor = idle(self);
+  if (NIL_P(query_cursor->query)) {
+    return Qnil;
+  }
+  query_cursor_filter_t filter;
+  bool filtered = query_cursor_filter(query_cursor, source, &filter);
   TSQueryMatch match;
   uint32_t index;
-  if (ts_query_cursor_next_capture(SELF, &match, &index)) {
+  bool found;
+  memory_scope_t scope;
+  memory_scope_begin(&scope);
+  while ((found = ts_query_cursor_next_capture(query_cursor->data, &match,
+                                               &index)) &&
+         filtered && !query_cursor_accept(&filter, &match)) {
+    ts_query_cursor_remove_match(query_cursor->data, match.id);
+  }
+  query_cursor_account(query_cursor, memory_scope_end(&scope));
+  query_cursor->finished = !found;
+  if (found) {
     VALUE res = rb_ary_new_capa(2);
     rb_ary_push(res, UINT2NUM(index));
-    rb_ary_push(res, new_query_match(&match));
+    rb_ary_push(res, query_cursor_new_match(query_cursor, &match));
     return res;
   } else {
     return Qnil;
@@ -160,19 +562,472 @@ static VALUE query_cursor_next_capture(VALUE self) {
 /**
  * Advance to the next match of the currently running query.
  *
+ * If a +source+ is given, matches not satisfying the text predicates of the
+ * query (+#eq?+, +#match?+, +#any-of?+, …) are skipped natively.
+ *
+ * @param source [String, nil] the source the tree was parsed from.
+ *
  * @return [Boolean] Whether there's a match.
  */
-static VALUE query_cursor_next_match(VALUE self) {
+static VALUE query_cursor_next_match(int argc, VALUE *argv, VALUE self) {
+  VALUE source;
+  rb_scan_args(argc, argv, "01", &source);
+
+  query_cursor_t *query_cursor = idle(self);
+  if (NIL_P(query_cursor->query)) {
+    return Qnil;
+  }
+  query_cursor_filter_t filter;
+  bool filtered = query_cursor_filter(query_cursor, source, &filter);
   TSQueryMatch match;
-  if (ts_query_cursor_next_match(SELF, &match)) {
-    return new_query_match(&match);
+  bool found;
+  memory_scope_t scope;
+  memory_scope_begin(&scope);
+  while ((found = ts_query_cursor_next_match(query_cursor->data, &match)) &&
+         filtered && !query_cursor_accept(&filter, &match)) {
+  }
+  query_cursor_account(query_cursor, memory_scope_end(&scope));
+  query_cursor->finished = !found;
+  if (found) {
+    return query_cursor_new_match(query_cursor, &match);
   } else {
     return Qnil;
   }
 }
 
+/**
+ * Advance to the next match of the currently running query, and return its
+ * captures as a hash of +name => node+.
+ *
+ * Matches not satisfying the text predicates of the query are skipped.
+ *
+ * @see QueryMatches#each_capture_hash
+ * @see #pattern_index
+ *
+ * @param source [String, nil] the source the tree was parsed from.
+ * @param names  [Array] the keys of the hash, indexed by capture id, usually
+ *   {Query#capture_names} or {Query#capture_symbols}.
+ *
+ * @return [Hash, nil] +nil+ if there are no more matches.
+ */
+static VALUE query_cursor_next_capture_hash(VALUE self, VALUE source,
+                                            VALUE names) {
+  query_cursor_t *query_cursor = idle(self);
+  if (NIL_P(query_cursor->query)) {
+    return Qnil;
+  }
+  query_cursor_filter_t filter;
+  bool filtered = query_cursor_filter(query_cursor, source, &filter);
+  Check_Type(names, T_ARRAY);
+  TSQueryMatch match;
+  bool found;
+  memory_scope_t scope;
+  memory_scope_begin(&scope);
+  while ((found = ts_query_cursor_next_match(query_cursor->data, &match)) &&
+         filtered && !query_cursor_accept(&filter, &match)) {
+  }
+  query_cursor_account(query_cursor, memory_scope_end(&scope));
+  query_cursor->finished = !found;
+  query_cursor->pattern = found ? match.pattern_index : UINT32_MAX;
+  if (!found) {
+    return Qnil;
+  }
+
+  VALUE res = rb_hash_new();
+  for (uint16_t i = 0; i < match.capture_count; i++) {
+    uint32_t index = match.captures[i].index;
+    if (index >= (uint32_t)RARRAY_LEN(names)) {
+      rb_raise(rb_eIndexError, "Capture ID %d out of range (len = %ld)", index,
+               RARRAY_LEN(names));
+    }
+    rb_hash_aset(res, RARRAY_AREF(names, index),
+                 new_node(&match.captures[i].node));
+  }
+  return res;
+}
+
+/**
+ * The pattern of the last match returned by {#next_capture_hash}, which
+ * only returns its captures.
+ *
+ * @return [Integer, nil] +nil+ if there was no such match since the last
+ *   {#exec}.
+ */
+static VALUE query_cursor_pattern_index(VALUE self) {
+  uint32_t pattern = unwrap(self)->pattern;
+  return pattern == UINT32_MAX ? Qnil : UINT2NUM(pattern);
+}
+
+// The number of uint32 in a packed capture: pattern index, capture index,
+// start byte, end byte, and node symbol.
+#define QUERY_CURSOR_PACKED_FIELDS 5
+
+/**
+ * Advance by up to +limit+ matches of the currently running query, exporting
+ * their captures without creating a {QueryMatch}, {QueryCapture}, or {Node}.
+ *
+ * Each capture is exported as 5 integers: pattern index, capture index, start
+ * byte, end byte, and the symbol of the captured node.
+ *
+ * If a +source+ is given, matches not satisfying the text predicates of the
+ * query are skipped natively, and don't count towards +limit+.
+ *
+ * @see QueryCursor#each_packed
+ *
+ * @param limit  [Integer] the maximum number of matches to export.
+ * @param source [String, nil] the source the tree was parsed from.
+ * @param string [Boolean] export to a binary +String+ of native-endian
+ *   uint32 (+unpack('L*')+) instead of an +Array+ of +Integer+.
+ *
+ * @return [String, Array<Integer>, nil] +nil+ if there are no more matches.
+ */
+static VALUE query_cursor_next_packed(VALUE self, VALUE limit, VALUE source,
+                                      VALUE string) {
+  query_cursor_t *query_cursor = idle(self);
+  long max = NUM2LONG(limit);
+  if (max <= 0) {
+    rb_raise(rb_eArgError, "limit must be positive, got %ld", max);
+  }
+  if (NIL_P(query_cursor->query)) {
+    return Qnil;
+  }
+  query_cursor_filter_t filter;
+  bool filtered = query_cursor_filter(query_cursor, source, &filter);
+  bool packed = RTEST(string);
+  // Matches usually have a capture or two; don't trust huge limits blindly.
+  long capa = (max < 4096 ? max : 4096) * QUERY_CURSOR_PACKED_FIELDS;
+  VALUE res = packed ? rb_str_buf_new(capa * (long)sizeof(uint32_t))
+                     : rb_ary_new_capa(capa);
+  long count = 0;
+  TSQueryMatch match;
+  memory_scope_t scope;
+
+  memory_scope_begin(&scope);
+  while (count < max &&
+         !(query_cursor->finished =
+               !ts_query_cursor_next_match(query_cursor->data, &match))) {
+    if (filtered && !query_cursor_accept(&filter, &match)) {
+      continue;
+    }
+    count++;
+    for (uint16_t i = 0; i < match.capture_count; i++) {
+      TSNode node = match.captures[i].node;
+      uint32_t fields[QUERY_CURSOR_PACKED_FIELDS] = {
+          match.pattern_index,
+          match.captures[i].index,
+          ts_node_start_byte(node),
+          ts_node_end_byte(node),
+          ts_node_symbol(node),
+      };
+      if (packed) {
+        rb_str_buf_cat(res, (const char *)fields, sizeof(fields));
+      } else {
+        for (int j = 0; j < QUERY_CURSOR_PACKED_FIELDS; j++) {
+          rb_ary_push(res, UINT2NUM(fields[j]));
+        }
+      }
+    }
+  }
+  query_cursor_account(query_cursor, memory_scope_end(&scope));
+
+  return count == 0 ? Qnil : res;
+}
+
+// State of a cursor drained without the GVL by {QueryCursor#exec_packed}.
+//
+// data:  the packed captures, allocated with the libc since we can't call
+//        ruby's allocator without the GVL.
+// bytes: what tree-sitter allocated, over all the resumes.
+typedef struct {
+  query_cursor_t *owner;
+  TSQueryCursor *cursor;
+  query_cursor_filter_t filter;
+  bool filtered;
+  TSQueryMatch match;
+  uint32_t *data;
+  size_t length;
+  size_t capacity;
+  ssize_t bytes;
+  bool interrupted;
+  bool failed;
+  bool finished;
+} query_cursor_drain_t;
+
+// Called with the GVL, for the patterns with regexes.
+static void *query_cursor_drain_satisfied(void *ptr) {
+  query_cursor_drain_t *drain = (query_cursor_drain_t *)ptr;
+  return query_cursor_accept(&drain->filter, &drain->match) ? ptr : NULL;
+}
+
+static bool query_cursor_drain_push(query_cursor_drain_t *drain,
+                                    const uint32_t *fields) {
+  if (drain->length + QUERY_CURSOR_PACKED_FIELDS > drain->capacity) {
+    size_t capacity = drain->capacity == 0 ? 1024 : drain->capacity * 2;
+    uint32_t *data = realloc(drain->data, capacity * sizeof(uint32_t));
+    if (data == NULL) {
+      return false;
+    }
+    drain->data = data;
+    drain->capacity = capacity;
+  }
+  memcpy(drain->data + drain->length, fields,
+         QUERY_CURSOR_PACKED_FIELDS * sizeof(uint32_t));
+  drain->length += QUERY_CURSOR_PACKED_FIELDS;
+  return true;
+}
+
+static void *query_cursor_drain(void *ptr) {
+  query_cursor_drain_t *drain = (query_cursor_drain_t *)ptr;
+  memory_scope_t scope;
+  memory_scope_begin(&scope);
+
+  while (!__atomic_load_n(&drain->interrupted, __ATOMIC_RELAXED) &&
+         !(drain->finished =
+               !ts_query_cursor_next_match(drain->cursor, &drain->match))) {
+    TSQueryMatch *match = &drain->match;
+    if (drain->filtered) {
+      bool satisfied =
+          drain->filter.text != NULL &&
+                  text_predicates_need_gvl(drain->filter.text,
+                                           match->pattern_index)
+              ? rb_thread_call_with_gvl(query_cursor_drain_satisfied, drain) !=
+                    NULL
+              : query_cursor_accept(&drain->filter, match);
+      if (!satisfied) {
+        continue;
+      }
+    }
+    for (uint16_t i = 0; i < match->capture_count; i++) {
+      TSNode node = match->captures[i].node;
+      uint32_t fields[QUERY_CURSOR_PACKED_FIELDS] = {
+          match->pattern_index,
+          match->captures[i].index,
+          ts_node_start_byte(node),
+          ts_node_end_byte(node),
+          ts_node_symbol(node),
+      };
+      if (!query_cursor_drain_push(drain, fields)) {
+        drain->failed = true;
+        goto done;
+      }
+    }
+  }
+
+done:
+  drain->bytes += memory_scope_end(&scope);
+  return NULL;
+}
+
+static void query_cursor_drain_interrupt(void *ptr) {
+  query_cursor_drain_t *drain = (query_cursor_drain_t *)ptr;
+  __atomic_store_n(&drain->interrupted, true, __ATOMIC_RELAXED);
+}
+
+// Drain without the GVL, checking for interrupts whenever ruby asks us to,
+// and export the captures.
+static VALUE query_cursor_drain_without_gvl(VALUE ptr) {
+  query_cursor_drain_t *drain = (query_cursor_drain_t *)ptr;
+  rb_thread_call_without_gvl(query_cursor_drain, drain,
+                             query_cursor_drain_interrupt, drain);
+  // The cursor resumes where it was interrupted, unless ruby raises.
+  while (!drain->finished && !drain->failed) {
+    drain->interrupted = false;
+    rb_thread_check_ints();
+    rb_thread_call_without_gvl(query_cursor_drain, drain,
+                               query_cursor_drain_interrupt, drain);
+  }
+  if (drain->failed) {
+    rb_raise(rb_eNoMemError, "failed to allocate packed captures");
+  }
+
+  VALUE res = rb_ary_new_capa((long)drain->length);
+  for (size_t i = 0; i < drain->length; i++) {
+    rb_ary_push(res, UINT2NUM(drain->data[i]));
+  }
+  return res;
+}
+
+static VALUE query_cursor_drain_ensure(VALUE ptr) {
+  query_cursor_drain_t *drain = (query_cursor_drain_t *)ptr;
+  drain->owner->busy = false;
+  drain->owner->finished = drain->finished;
+  query_cursor_account(drain->owner, drain->bytes);
+  free(drain->data);
+  return Qnil;
+}
+
+/**
+ * Run +query+ on +node+, and export all of its captures like
+ * {QueryCursor#next_packed}, as an +Array+ of +Integer+.
+ *
+ * The GVL is released while the cursor runs, so other threads, e.g. other
+ * cursors in {Query#exec_many}, can run in parallel. It's only taken back to
+ * check +#match?+ predicates.
+ *
+ * The tree of +node+ must not be edited until this returns; use {Tree#copy}
+ * when sharing trees with other threads. The cursor can't be used by other
+ * threads until this returns either: they raise.
+ *
+ * @param query  [Query]
+ * @param node   [Node]
+ * @param source [String, nil] when given, matches not satisfying the text
+ *   predicates of the query are skipped.
+ * @param opts   [Hash] the options of {#exec}.
+ *
+ * @return [Array<Integer>]
+ */
+static VALUE query_cursor_exec_packed(int argc, VALUE *argv, VALUE self) {
+  VALUE query, node, source, opts;
+  rb_scan_args(argc, argv, "3:", &query, &node, &source, &opts);
+  query_cursor_t *query_cursor = idle(self);
+  query_cursor_start(self, query, node, opts);
+  if (!NIL_P(source)) {
+    // Shares the buffer, which stays valid even if source is modified by
+    // another thread while we drain.
+    source = rb_str_new_frozen(StringValue(source));
+  }
+
+  query_cursor_drain_t drain = {.owner = query_cursor,
+                                .cursor = query_cursor->data};
+  drain.filtered = query_cursor_filter(query_cursor, source, &drain.filter);
+  query_cursor->busy = true;
+  VALUE res = rb_ensure(query_cursor_drain_without_gvl, (VALUE)&drain,
+                        query_cursor_drain_ensure, (VALUE)&drain);
+
+  RB_GC_GUARD(node);
+  RB_GC_GUARD(source);
+  return res;
+}
+
+/**
+ * The properties asserted for the +#is?+ and +#is-not?+ predicates of the
+ * query, see {#properties=}.
+ *
+ * @return [Hash, nil]
+ */
+static VALUE query_cursor_get_properties(VALUE self) {
+  return unwrap(self)->properties;
+}
+
+/**
+ * Assert properties for the +#is?+ and +#is-not?+ predicates of the query.
+ *
+ * Once set, matches whose property predicates don't hold are skipped, like
+ * the ones failing text predicates. A +true+ value asserts a key regardless
+ * of its value, e.g. +(#is? local)+; +false+ and +nil+ values are not
+ * asserted.
+ *
+ * Properties apply to the whole cursor, not to nodes: the capture of a
+ * predicate, as in +(#is? @name local)+, is ignored, and the predicate
+ * holds for every capture of the match or for none.
+ *
+ * @example
+ *   cursor.properties = { 'local' => true, 'kind' => 'function' }
+ *
+ * @param properties [Hash, nil] +nil+ to stop checking property predicates,
+ *   which is the default.
+ *
+ * @return [Hash, nil]
+ */
+static VALUE query_cursor_set_properties(VALUE self, VALUE properties) {
+  query_cursor_t *query_cursor = idle(self);
+  query_property_assertions_t *assertions =
+      NIL_P(properties) ? NULL : query_property_assertions_new(properties);
+  query_property_assertions_free(query_cursor->assertions);
+  query_cursor->assertions = assertions;
+  RB_OBJ_WRITE(self, &query_cursor->properties,
+               NIL_P(properties) ? Qnil : rb_hash_freeze(rb_hash_dup(properties)));
+  return properties;
+}
+
+/**
+ * Whether to profile the patterns of the query, see {#profile}.
+ *
+ * @return [Boolean]
+ */
+static VALUE query_cursor_get_profiling(VALUE self) {
+  return unwrap(self)->profiling ? Qtrue : Qfalse;
+}
+
+/**
+ * Start, or stop, profiling the patterns of the query.
+ *
+ * Starting resets the profile, which then accumulates over the executions of
+ * the same query, so a query can be profiled over a whole corpus.
+ *
+ * @param profiling [Boolean]
+ *
+ * @return [Boolean]
+ */
+static VALUE query_cursor_set_profiling(VALUE self, VALUE profiling) {
+  query_cursor_t *query_cursor = idle(self);
+  query_cursor->profiling = RTEST(profiling);
+  query_cursor_profile_reset(query_cursor);
+  return profiling;
+}
+
+/**
+ * The profile of the patterns of the query, see {#profiling=}.
+ *
+ * Each pattern has 5 counters, {PROFILE_FIELDS}: the matches found by
+ * tree-sitter, the ones accepted, the ones rejected by text predicates, the
+ * ones rejected by property predicates, and the nanoseconds spent checking
+ * predicates.
+ *
+ * Matches are counted when checked, so with {#next_capture} a match is
+ * counted once per capture.
+ *
+ * @see Query#profile
+ *
+ * @return [Array<Integer>, nil] +nil+ when not profiling.
+ */
+static VALUE query_cursor_profile(VALUE self) {
+  query_cursor_t *query_cursor = idle(self);
+  if (query_cursor->profile == NULL) {
+    return Qnil;
+  }
+  size_t length =
+      (size_t)query_cursor->profile_pattern_count * QUERY_CURSOR_PROFILE_FIELDS;
+  VALUE res = rb_ary_new_capa((long)length);
+  for (size_t i = 0; i < length; i++) {
+    rb_ary_push(res, ULL2NUM(query_cursor->profile[i]));
+  }
+  return res;
+}
+
+/**
+ * Forget the running query and restore the default settings: no match limit,
+ * maximum start depth, ranges, timeout, properties, nor profiling.
+ *
+ * The native buffers grown by the previous executions are kept, which is
+ * what makes reusing a cursor, e.g. through {QueryCursor.with}, cheaper than
+ * creating a new one.
+ *
+ * @return [QueryCursor] self.
+ */
+static VALUE query_cursor_reset(VALUE self) {
+  query_cursor_t *query_cursor = idle(self);
+  ts_query_cursor_set_match_limit(query_cursor->data, UINT32_MAX);
+  ts_query_cursor_set_max_start_depth(query_cursor->data, UINT32_MAX);
+  ts_query_cursor_set_byte_range(query_cursor->data, 0, UINT32_MAX);
+  ts_query_cursor_set_point_range(query_cursor->data, (TSPoint){0, 0},
+                                  (TSPoint){UINT32_MAX, UINT32_MAX});
+  query_property_assertions_free(query_cursor->assertions);
+  query_cursor->assertions = NULL;
+  query_cursor->properties = Qnil;
+  query_cursor->profiling = false;
+  query_cursor->query = Qnil;
+  query_cursor_profile_reset(query_cursor);
+  query_cursor->deadline = 0;
+  query_cursor->byte_offset = 0;
+  query_cursor->timed_out = false;
+  query_cursor->finished = true;
+  query_cursor->pattern = UINT32_MAX;
+  return self;
+}
+
 static VALUE query_cursor_remove_match(VALUE self, VALUE id) {
-  ts_query_cursor_remove_match(SELF, NUM2UINT(id));
+  ts_query_cursor_remove_match(idle(self)->data, NUM2UINT(id));
   return Qnil;
 }
 
@@ -183,7 +1038,8 @@ static VALUE query_cursor_remove_match(VALUE self, VALUE id) {
  * @return [nil]
  */
 static VALUE query_cursor_set_byte_range(VALUE self, VALUE from, VALUE to) {
-  ts_query_cursor_set_byte_range(SELF, NUM2UINT(from), NUM2UINT(to));
+  ts_query_cursor_set_byte_range(idle(self)->data, NUM2UINT(from),
+                                 NUM2UINT(to));
   return Qnil;
 }
 
@@ -194,7 +1050,7 @@ static VALUE query_cursor_set_byte_range(VALUE self, VALUE from, VALUE to) {
  * @return [nil]
  */
 static VALUE query_cursor_set_point_range(VALUE self, VALUE from, VALUE to) {
-  ts_query_cursor_set_point_range(SELF, value_to_point(from),
+  ts_query_cursor_set_point_range(idle(self)->data, value_to_point(from),
                                   value_to_point(to));
   return Qnil;
 }
@@ -205,27 +1061,44 @@ void init_query_cursor(void) {
   rb_define_alloc_func(cQueryCursor, query_cursor_allocate);
 
   /* Module methods */
-  rb_define_module_function(cQueryCursor, "exec", query_cursor_exec_static, 2);
+  rb_define_module_function(cQueryCursor, "exec", query_cursor_exec_static,
+                            -1);
 
   /* Class methods */
   // Accessors
   DECLARE_ACCESSOR(cQueryCursor, query_cursor, match_limit)
 
   // Other
-  rb_define_method(cQueryCursor, "exec", query_cursor_exec, 2);
+  rb_define_method(cQueryCursor, "byte_offset", query_cursor_byte_offset, 0);
+  rb_define_method(cQueryCursor, "exec", query_cursor_exec, -1);
+  rb_define_method(cQueryCursor, "exec_packed", query_cursor_exec_packed, -1);
   rb_define_method(cQueryCursor, "exceed_match_limit?",
                    query_cursor_did_exceed_match_limit, 0);
+  rb_define_method(cQueryCursor, "profile", query_cursor_profile, 0);
+  rb_define_method(cQueryCursor, "profiling?", query_cursor_get_profiling, 0);
+  rb_define_method(cQueryCursor, "profiling=", query_cursor_set_profiling, 1);
+  rb_define_method(cQueryCursor, "properties", query_cursor_get_properties, 0);
+  rb_define_method(cQueryCursor, "properties=", query_cursor_set_properties,
+                   1);
   rb_define_method(cQueryCursor, "match_limit", query_cursor_get_match_limit,
                    0);
   rb_define_method(cQueryCursor, "match_limit=", query_cursor_set_match_limit,
                    1);
   rb_define_method(cQueryCursor,
                    "max_start_depth=", query_cursor_set_max_start_depth, 1);
-  rb_define_method(cQueryCursor, "next_capture", query_cursor_next_capture, 0);
-  rb_define_method(cQueryCursor, "next_match", query_cursor_next_match, 0);
+  rb_define_method(cQueryCursor, "next_capture", query_cursor_next_capture,
+                   -1);
+  rb_define_method(cQueryCursor, "next_match", query_cursor_next_match, -1);
+  rb_define_method(cQueryCursor, "next_capture_hash",
+                   query_cursor_next_capture_hash, 2);
+  rb_define_method(cQueryCursor, "next_packed", query_cursor_next_packed, 3);
+  rb_define_method(cQueryCursor, "pattern_index", query_cursor_pattern_index,
+                   0);
   rb_define_method(cQueryCursor, "remove_match", query_cursor_remove_match, 1);
+  rb_define_method(cQueryCursor, "reset", query_cursor_reset, 0);
   rb_define_method(cQueryCursor, "set_byte_range", query_cursor_set_byte_range,
                    2);
   rb_define_method(cQueryCursor, "set_point_range",
                    query_cursor_set_point_range, 2);
+  rb_define_method(cQueryCursor, "status", query_cursor_status, 0);
 }
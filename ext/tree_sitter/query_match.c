@@ -4,7 +4,57 @@ extern VALUE mTreeSitter;
 
 VALUE cQueryMatch;
 
-DATA_WRAP(QueryMatch, query_match)
+// properties: the frozen #set! properties of the pattern, shared with the
+//             query, or nil.
+typedef struct {
+  TSQueryMatch data;
+  VALUE properties;
+} query_match_t;
+
+DATA_FREE(query_match)
+DATA_MEMSIZE(query_match)
+
+static void query_match_mark(void *ptr) {
+  query_match_t *query_match = (query_match_t *)ptr;
+  rb_gc_mark_movable(query_match->properties);
+}
+
+static void query_match_compact(void *ptr) {
+  query_match_t *query_match = (query_match_t *)ptr;
+  query_match->properties = rb_gc_location(query_match->properties);
+}
+
+const rb_data_type_t query_match_data_type = {
+    .wrap_struct_name = "query_match",
+    .function =
+        {
+            .dmark = query_match_mark,
+            .dfree = query_match_free,
+            .dsize = query_match_memsize,
+            .dcompact = query_match_compact,
+        },
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static VALUE query_match_allocate(VALUE klass) {
+  query_match_t *query_match;
+  VALUE res = TypedData_Make_Struct(klass, query_match_t,
+                                    &query_match_data_type, query_match);
+  query_match->properties = Qnil;
+  return res;
+}
+
+DATA_UNWRAP(query_match)
+DATA_NEW(cQueryMatch, TSQueryMatch, query_match)
+DATA_FROM_VALUE(TSQueryMatch, query_match)
+
+VALUE new_query_match_with_properties(const TSQueryMatch *ptr,
+                                      VALUE properties) {
+  VALUE res = new_query_match(ptr);
+  RB_OBJ_WRITE(res, &unwrap(res)->properties, properties);
+  return res;
+}
+
 DATA_DEFINE_GETTER(query_match, id, UINT2NUM)
 DATA_DEFINE_GETTER(query_match, pattern_index, INT2FIX)
 DATA_DEFINE_GETTER(query_match, capture_count, INT2FIX)
@@ -22,6 +72,17 @@ static VALUE query_match_get_captures(VALUE self) {
   return res;
 }
 
+/**
+ * The +#set!+ properties of the pattern that matched.
+ *
+ * @return [Hash<String, String|nil>] a frozen Hash, shared by all the
+ *   matches of the pattern.
+ */
+static VALUE query_match_get_properties(VALUE self) {
+  VALUE properties = unwrap(self)->properties;
+  return NIL_P(properties) ? rb_hash_freeze(rb_hash_new()) : properties;
+}
+
 static VALUE query_match_inspect(VALUE self) {
   TSQueryMatch query_match = SELF;
   return rb_sprintf("{id=%d, pattern_inex=%d, capture_count=%d}",
@@ -39,6 +100,7 @@ void init_query_match(void) {
   DECLARE_GETTER(cQueryMatch, query_match, pattern_index)
   DECLARE_GETTER(cQueryMatch, query_match, capture_count)
   DECLARE_GETTER(cQueryMatch, query_match, captures)
+  DECLARE_GETTER(cQueryMatch, query_match, properties)
   rb_define_method(cQueryMatch, "inspect", query_match_inspect, 0);
   rb_define_method(cQueryMatch, "to_s", query_match_inspect, 0);
 }
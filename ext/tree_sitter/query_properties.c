@@ -0,0 +1,318 @@
+#include "tree_sitter.h"
+
+// Properties of query patterns: +#set!+ settings, and +#is?+ / +#is-not?+
+// predicates, compiled from a query's predicate steps.
+//
+// Settings are exposed as one frozen Hash per pattern, shared by all the
+// matches of the pattern.  Predicates are checked natively against the
+// properties asserted on a {QueryCursor}.
+
+// A string literal, borrowed from the TSQuery which outlives us.
+//
+// str is NULL for a missing value.
+typedef struct {
+  const char *str;
+  uint32_t len;
+} query_property_string_t;
+
+typedef struct {
+  query_property_string_t key;
+  query_property_string_t value;
+  bool positive;
+} query_property_predicate_t;
+
+// The predicates of pattern i are predicates[offsets[i]...offsets[i + 1]].
+struct query_properties {
+  uint32_t pattern_count;
+  VALUE *settings;
+  uint32_t *offsets;
+  query_property_predicate_t *predicates;
+  uint32_t predicate_count;
+};
+
+// A copy of the properties asserted on a cursor.
+//
+// keys and values have room for capacity entries, zeroed past count, so a
+// copy interrupted by an exception can be released like a complete one.
+struct query_property_assertions {
+  uint32_t count;
+  uint32_t capacity;
+  query_property_string_t *keys;
+  query_property_string_t *values;
+};
+
+static bool query_property_operator_is(const char *op, uint32_t len,
+                                       const char *name) {
+  return strlen(name) == len && memcmp(op, name, len) == 0;
+}
+
+// The key and value of a property predicate or setting, which were already
+// validated by query.c: an optional capture, a key, and an optional value.
+static void query_property_parse(const TSQuery *query,
+                                 const TSQueryPredicateStep *steps,
+                                 uint32_t length, query_property_string_t *key,
+                                 query_property_string_t *value) {
+  key->str = value->str = NULL;
+  key->len = value->len = 0;
+  for (uint32_t i = 1; i < length; i++) {
+    if (steps[i].type != TSQueryPredicateStepTypeString) {
+      continue;
+    }
+    query_property_string_t *dst = key->str == NULL ? key : value;
+    dst->str = ts_query_string_value_for_id(query, steps[i].value_id, &dst->len);
+  }
+}
+
+static VALUE query_property_string(query_property_string_t str) {
+  return str.str == NULL ? Qnil : rb_str_freeze(safe_str2(str.str, str.len));
+}
+
+/**
+ * Compile the properties of all the patterns in +query+.
+ *
+ * +*out+ is assigned before any ruby object is created, so whatever was
+ * built is released with the query if compilation raises.
+ */
+void query_properties_compile(const TSQuery *query, query_properties_t **out) {
+  uint32_t pattern_count = ts_query_pattern_count(query);
+  uint32_t total_steps = 0;
+
+  for (uint32_t i = 0; i < pattern_count; i++) {
+    uint32_t length;
+    ts_query_predicates_for_pattern(query, i, &length);
+    total_steps += length;
+  }
+
+  query_properties_t *self = ZALLOC(query_properties_t);
+  self->pattern_count = pattern_count;
+  self->settings = ZALLOC_N(VALUE, pattern_count);
+  self->offsets = ZALLOC_N(uint32_t, pattern_count + 1);
+  // Every predicate ends with a DONE step.
+  self->predicates = ZALLOC_N(query_property_predicate_t, total_steps);
+  for (uint32_t i = 0; i < pattern_count; i++) {
+    self->settings[i] = Qnil;
+  }
+  *out = self;
+
+  VALUE empty = rb_hash_freeze(rb_hash_new());
+  for (uint32_t i = 0; i < pattern_count; i++) {
+    uint32_t length;
+    const TSQueryPredicateStep *steps =
+        ts_query_predicates_for_pattern(query, i, &length);
+    VALUE settings = Qnil;
+    self->offsets[i] = self->predicate_count;
+
+    uint32_t start = 0;
+    for (uint32_t j = 0; j < length; j++) {
+      if (steps[j].type != TSQueryPredicateStepTypeDone) {
+        continue;
+      }
+      const TSQueryPredicateStep *predicate = &steps[start];
+      uint32_t predicate_length = j - start;
+      start = j + 1;
+      if (predicate_length == 0 ||
+          predicate[0].type != TSQueryPredicateStepTypeString) {
+        continue;
+      }
+
+      uint32_t op_len;
+      const char *op =
+          ts_query_string_value_for_id(query, predicate[0].value_id, &op_len);
+      query_property_string_t key, value;
+
+      if (query_property_operator_is(op, op_len, "set!")) {
+        query_property_parse(query, predicate, predicate_length, &key, &value);
+        if (NIL_P(settings)) {
+          settings = rb_hash_new();
+        }
+        rb_hash_aset(settings, query_property_string(key),
+                     query_property_string(value));
+      } else if (query_property_operator_is(op, op_len, "is?") ||
+                 query_property_operator_is(op, op_len, "is-not?")) {
+        query_property_parse(query, predicate, predicate_length, &key, &value);
+        query_property_predicate_t *res =
+            &self->predicates[self->predicate_count++];
+        res->key = key;
+        res->value = value;
+        res->positive = query_property_operator_is(op, op_len, "is?");
+      }
+    }
+
+    self->settings[i] = NIL_P(settings) ? empty : rb_hash_freeze(settings);
+  }
+  self->offsets[pattern_count] = self->predicate_count;
+}
+
+void query_properties_free(query_properties_t *self) {
+  if (self == NULL) {
+    return;
+  }
+  xfree(self->settings);
+  xfree(self->offsets);
+  xfree(self->predicates);
+  xfree(self);
+}
+
+void query_properties_mark(const query_properties_t *self) {
+  if (self == NULL) {
+    return;
+  }
+  for (uint32_t i = 0; i < self->pattern_count; i++) {
+    rb_gc_mark(self->settings[i]);
+  }
+}
+
+size_t query_properties_memsize(const query_properties_t *self) {
+  if (self == NULL) {
+    return 0;
+  }
+  return sizeof(query_properties_t) +
+         sizeof(VALUE) * self->pattern_count +
+         sizeof(uint32_t) * (self->pattern_count + 1) +
+         sizeof(query_property_predicate_t) * self->predicate_count;
+}
+
+/**
+ * The +#set!+ properties of +pattern_index+, as a frozen Hash of
+ * +key => value+, +value+ being +nil+ when missing.
+ */
+VALUE query_properties_settings(const query_properties_t *self,
+                                uint32_t pattern_index) {
+  if (self == NULL || pattern_index >= self->pattern_count) {
+    return Qnil;
+  }
+  return self->settings[pattern_index];
+}
+
+/**
+ * Whether +pattern_index+ has +#is?+ or +#is-not?+ predicates.
+ */
+bool query_properties_any(const query_properties_t *self,
+                          uint32_t pattern_index) {
+  return self != NULL && pattern_index < self->pattern_count &&
+         self->offsets[pattern_index] < self->offsets[pattern_index + 1];
+}
+
+static bool query_property_string_eq(query_property_string_t a,
+                                     query_property_string_t b) {
+  return a.len == b.len && memcmp(a.str, b.str, a.len) == 0;
+}
+
+static bool
+query_property_asserted(const query_property_assertions_t *assertions,
+                        const query_property_predicate_t *predicate) {
+  for (uint32_t i = 0; i < assertions->count; i++) {
+    if (!query_property_string_eq(assertions->keys[i], predicate->key)) {
+      continue;
+    }
+    return predicate->value.str == NULL ||
+           (assertions->values[i].str != NULL &&
+            query_property_string_eq(assertions->values[i], predicate->value));
+  }
+  return false;
+}
+
+/**
+ * Whether +match+ satisfies the +#is?+ and +#is-not?+ predicates of its
+ * pattern, given the properties asserted on the cursor.
+ *
+ * Doesn't need the GVL.
+ */
+bool query_properties_satisfied(const query_properties_t *self,
+                                const TSQueryMatch *match,
+                                const query_property_assertions_t *assertions) {
+  if (assertions == NULL ||
+      !query_properties_any(self, match->pattern_index)) {
+    return true;
+  }
+  for (uint32_t i = self->offsets[match->pattern_index];
+       i < self->offsets[match->pattern_index + 1]; i++) {
+    const query_property_predicate_t *predicate = &self->predicates[i];
+    if (query_property_asserted(assertions, predicate) != predicate->positive) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static query_property_string_t query_property_copy(VALUE str) {
+  query_property_string_t res = {.str = NULL, .len = 0};
+  if (NIL_P(str) || str == Qtrue) {
+    return res;
+  }
+  str = rb_obj_as_string(str);
+  res.len = (uint32_t)RSTRING_LEN(str);
+  char *copy = ALLOC_N(char, res.len + 1);
+  memcpy(copy, RSTRING_PTR(str), res.len);
+  copy[res.len] = '\0';
+  res.str = copy;
+  return res;
+}
+
+static int query_property_assertions_add(VALUE key, VALUE value, VALUE arg) {
+  query_property_assertions_t *self = (query_property_assertions_t *)arg;
+  if (!RTEST(value)) {
+    return ST_CONTINUE;
+  }
+  // #to_s may have grown the hash.
+  if (self->count == self->capacity) {
+    return ST_STOP;
+  }
+  // Copied in place, so they're released with self if the other one raises.
+  self->keys[self->count] = query_property_copy(key);
+  self->values[self->count] = query_property_copy(value);
+  self->count++;
+  return ST_CONTINUE;
+}
+
+struct query_property_assertions_copy {
+  VALUE hash;
+  query_property_assertions_t *self;
+};
+
+static VALUE query_property_assertions_copy(VALUE arg) {
+  struct query_property_assertions_copy *copy =
+      (struct query_property_assertions_copy *)arg;
+  rb_hash_foreach(copy->hash, query_property_assertions_add,
+                  (VALUE)copy->self);
+  return Qnil;
+}
+
+/**
+ * Copy the asserted properties in +hash+, +key => value+, +value+ being
+ * +true+ to assert a key regardless of its value. Keys with a +false+ or
+ * +nil+ value are not asserted.
+ *
+ * Keys and values are converted with +#to_s+; if that raises, what was
+ * copied is released before the exception propagates.
+ */
+query_property_assertions_t *query_property_assertions_new(VALUE hash) {
+  Check_Type(hash, T_HASH);
+  long size = RHASH_SIZE(hash);
+  query_property_assertions_t *self = ZALLOC(query_property_assertions_t);
+  self->capacity = (uint32_t)size;
+  self->keys = ZALLOC_N(query_property_string_t, size);
+  self->values = ZALLOC_N(query_property_string_t, size);
+
+  struct query_property_assertions_copy copy = {.hash = hash, .self = self};
+  int state = 0;
+  rb_protect(query_property_assertions_copy, (VALUE)&copy, &state);
+  if (state) {
+    query_property_assertions_free(self);
+    rb_jump_tag(state);
+  }
+  return self;
+}
+
+void query_property_assertions_free(query_property_assertions_t *self) {
+  if (self == NULL) {
+    return;
+  }
+  for (uint32_t i = 0; i < self->capacity; i++) {
+    xfree((void *)self->keys[i].str);
+    xfree((void *)self->values[i].str);
+  }
+  xfree(self->keys);
+  xfree(self->values);
+  xfree(self);
+}
@@ -0,0 +1,506 @@
+#include "tree_sitter.h"
+#include <ruby/encoding.h>
+#include <ruby/re.h>
+
+extern VALUE mTreeSitter;
+extern VALUE cQuery;
+
+VALUE cTagger;
+
+// The fields of a packed tag.
+enum {
+  TAGGER_KIND,
+  TAGGER_DEFINITION,
+  TAGGER_NAME_START,
+  TAGGER_NAME_END,
+  TAGGER_START,
+  TAGGER_END,
+  TAGGER_ROW,
+  TAGGER_FIELDS,
+};
+
+// query:           the tags query.
+// kinds:           the kinds of tags, e.g. +function+ for
+//                  +@definition.function+.
+// capture_kinds:   the index in kinds of each capture, -1 if it's not a
+//                  +@definition.*+ or +@reference.*+ capture.
+// definitions:     whether each capture is a +@definition.*+.
+// name, doc:       the ids of the +@name+ and +@doc+ captures, UINT32_MAX if
+//                  missing.
+// strips:          the +#strip!+ Regexp of each pattern, or nil.
+// adjacent:        the capture the docs of each pattern must be adjacent
+//                  to, per +#select-adjacent!+, UINT32_MAX if none.
+typedef struct {
+  VALUE query;
+  VALUE kinds;
+  uint32_t capture_count;
+  int32_t *capture_kinds;
+  bool *definitions;
+  uint32_t name;
+  uint32_t doc;
+  uint32_t pattern_count;
+  VALUE *strips;
+  uint32_t *adjacent;
+} tagger_t;
+
+static void tagger_free(void *ptr) {
+  tagger_t *tagger = (tagger_t *)ptr;
+  xfree(tagger->capture_kinds);
+  xfree(tagger->definitions);
+  xfree(tagger->strips);
+  xfree(tagger->adjacent);
+  xfree(ptr);
+}
+
+static size_t tagger_memsize(const void *ptr) {
+  const tagger_t *tagger = (const tagger_t *)ptr;
+  return sizeof(tagger_t) +
+         (sizeof(int32_t) + sizeof(bool)) * tagger->capture_count +
+         (sizeof(VALUE) + sizeof(uint32_t)) * tagger->pattern_count;
+}
+
+static void tagger_mark(void *ptr) {
+  tagger_t *tagger = (tagger_t *)ptr;
+  rb_gc_mark_movable(tagger->query);
+  rb_gc_mark_movable(tagger->kinds);
+  for (uint32_t i = 0; i < tagger->pattern_count; i++) {
+    rb_gc_mark_movable(tagger->strips[i]);
+  }
+}
+
+static void tagger_compact(void *ptr) {
+  tagger_t *tagger = (tagger_t *)ptr;
+  tagger->query = rb_gc_location(tagger->query);
+  tagger->kinds = rb_gc_location(tagger->kinds);
+  for (uint32_t i = 0; i < tagger->pattern_count; i++) {
+    tagger->strips[i] = rb_gc_location(tagger->strips[i]);
+  }
+}
+
+const rb_data_type_t tagger_data_type = {
+    .wrap_struct_name = "tagger",
+    .function =
+        {
+            .dmark = tagger_mark,
+            .dfree = tagger_free,
+            .dsize = tagger_memsize,
+            .dcompact = tagger_compact,
+        },
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static VALUE tagger_allocate(VALUE klass) {
+  tagger_t *tagger;
+  VALUE res =
+      TypedData_Make_Struct(klass, tagger_t, &tagger_data_type, tagger);
+  tagger->query = Qnil;
+  tagger->kinds = Qnil;
+  tagger->name = UINT32_MAX;
+  tagger->doc = UINT32_MAX;
+  return res;
+}
+
+DATA_UNWRAP(tagger)
+
+static bool tagger_string_is(const char *str, uint32_t len, const char *name) {
+  return strlen(name) == len && memcmp(str, name, len) == 0;
+}
+
+static bool tagger_prefix_is(const char *str, uint32_t len,
+                             const char *prefix) {
+  size_t prefix_len = strlen(prefix);
+  return len > prefix_len && memcmp(str, prefix, prefix_len) == 0;
+}
+
+static void tagger_compile_captures(tagger_t *tagger, const TSQuery *query) {
+  VALUE kinds = rb_ary_new();
+  tagger->capture_count = ts_query_capture_count(query);
+  tagger->capture_kinds = ALLOC_N(int32_t, tagger->capture_count);
+  tagger->definitions = ZALLOC_N(bool, tagger->capture_count);
+
+  for (uint32_t i = 0; i < tagger->capture_count; i++) {
+    uint32_t len;
+    const char *name = ts_query_capture_name_for_id(query, i, &len);
+    const char *kind = NULL;
+    tagger->capture_kinds[i] = -1;
+    if (tagger_prefix_is(name, len, "definition.")) {
+      kind = name + strlen("definition.");
+      tagger->definitions[i] = true;
+    } else if (tagger_prefix_is(name, len, "reference.")) {
+      kind = name + strlen("reference.");
+    } else if (tagger_string_is(name, len, "name")) {
+      tagger->name = i;
+    } else if (tagger_string_is(name, len, "doc")) {
+      tagger->doc = i;
+    }
+    if (kind == NULL) {
+      continue;
+    }
+    VALUE str = rb_str_freeze(
+        safe_str2(kind, len - (uint32_t)(kind - name)));
+    long j;
+    for (j = 0; j < RARRAY_LEN(kinds); j++) {
+      if (RTEST(rb_str_equal(RARRAY_AREF(kinds, j), str))) {
+        break;
+      }
+    }
+    if (j == RARRAY_LEN(kinds)) {
+      rb_ary_push(kinds, str);
+    }
+    tagger->capture_kinds[i] = (int32_t)j;
+  }
+  tagger->kinds = rb_obj_freeze(kinds);
+}
+
+static void tagger_compile_predicates(tagger_t *tagger, const TSQuery *query) {
+  uint32_t pattern_count = ts_query_pattern_count(query);
+  tagger->strips = ALLOC_N(VALUE, pattern_count);
+  tagger->adjacent = ALLOC_N(uint32_t, pattern_count);
+  for (uint32_t i = 0; i < pattern_count; i++) {
+    tagger->strips[i] = Qnil;
+    tagger->adjacent[i] = UINT32_MAX;
+  }
+  // Only mark strips once they're all initialized.
+  tagger->pattern_count = pattern_count;
+
+  for (uint32_t i = 0; i < tagger->pattern_count; i++) {
+    uint32_t length;
+    const TSQueryPredicateStep *steps =
+        ts_query_predicates_for_pattern(query, i, &length);
+    uint32_t start = 0;
+    for (uint32_t j = 0; j < length; j++) {
+      if (steps[j].type != TSQueryPredicateStepTypeDone) {
+        continue;
+      }
+      const TSQueryPredicateStep *predicate = &steps[start];
+      uint32_t predicate_length = j - start;
+      start = j + 1;
+      if (predicate_length == 0 ||
+          predicate[0].type != TSQueryPredicateStepTypeString) {
+        continue;
+      }
+
+      uint32_t op_len;
+      const char *op =
+          ts_query_string_value_for_id(query, predicate[0].value_id, &op_len);
+      if (tagger_string_is(op, op_len, "strip!")) {
+        if (predicate_length != 3 ||
+            predicate[1].type != TSQueryPredicateStepTypeCapture ||
+            predicate[2].type != TSQueryPredicateStepTypeString) {
+          rb_raise(rb_eArgError, "Invalid arguments to #strip! predicate. "
+                                 "Expected a capture and a regex.");
+        }
+        uint32_t len;
+        const char *regex =
+            ts_query_string_value_for_id(query, predicate[2].value_id, &len);
+        tagger->strips[i] = rb_reg_new_str(safe_str2(regex, len), 0);
+      } else if (tagger_string_is(op, op_len, "select-adjacent!")) {
+        if (predicate_length != 3 ||
+            predicate[1].type != TSQueryPredicateStepTypeCapture ||
+            predicate[2].type != TSQueryPredicateStepTypeCapture) {
+          rb_raise(rb_eArgError, "Invalid arguments to #select-adjacent! "
+                                 "predicate. Expected two captures.");
+        }
+        tagger->adjacent[i] = predicate[2].value_id;
+      }
+    }
+  }
+}
+
+/**
+ * Create a tagger from a +tags.scm+ query.
+ *
+ * Each match of a pattern with a +@definition.<kind>+ or
+ * +@reference.<kind>+ capture, and a +@name+ capture, is a tag. The +@doc+
+ * captures of a definition are its documentation, cleaned up by
+ * +(#strip! @doc "regex")+, and limited to the comments right before the
+ * definition by +(#select-adjacent! @doc @definition.function)+.
+ *
+ * @raise [QueryCreationError] if the query is invalid.
+ * @raise [ArgumentError] if +#strip!+ or +#select-adjacent!+ are misused.
+ * @raise [RuntimeError] if the tagger was already initialized.
+ *
+ * @param language [Language]
+ * @param source   [String] the tags query.
+ */
+static VALUE tagger_initialize(VALUE self, VALUE language, VALUE source) {
+  tagger_t *tagger = unwrap(self);
+  // The compiled tables are sized for the query: they're never replaced.
+  if (!NIL_P(tagger->query)) {
+    rb_raise(rb_eRuntimeError, "Tagger is already initialized");
+  }
+  VALUE args[2] = {language, source};
+  VALUE query = rb_class_new_instance(2, args, cQuery);
+  RB_OBJ_WRITE(self, &tagger->query, query);
+
+  const TSQuery *ts_query = value_to_query(query);
+  tagger_compile_captures(tagger, ts_query);
+  tagger_compile_predicates(tagger, ts_query);
+  return self;
+}
+
+/**
+ * @return [Array<String>] the kinds of tags, e.g. +function+ for
+ *   +@definition.function+; tags refer to them by index.
+ */
+static VALUE tagger_get_kinds(VALUE self) { return unwrap(self)->kinds; }
+
+/**
+ * @return [Query] the tags query.
+ */
+static VALUE tagger_get_query(VALUE self) { return unwrap(self)->query; }
+
+// A tag, the order it was found in, and where its docs are, if any.
+typedef struct {
+  uint32_t fields[TAGGER_FIELDS];
+  size_t order;
+  long docs;
+} tagger_tag_t;
+
+// tags: the tags found, in match order.
+// docs: the docs of the tags, a hidden Array, or nil when not needed.
+typedef struct {
+  tagger_t *tagger;
+  const text_predicates_t *text_predicates;
+  TSQueryCursor *cursor;
+  VALUE source;
+  tagger_tag_t *tags;
+  size_t tags_len;
+  size_t tags_capa;
+  VALUE docs;
+} tagger_run_t;
+
+// The documentation of a tag, or nil.
+//
+// Docs are read from the captures of the match in place, so there's no limit
+// on their number.
+static VALUE tagger_docs(tagger_run_t *run, const TSQueryMatch *match) {
+  tagger_t *tagger = run->tagger;
+  uint32_t adjacent = tagger->adjacent[match->pattern_index];
+  const TSQueryCapture *captures = match->captures;
+  uint16_t count = match->capture_count;
+  uint16_t docs_len = 0;
+  TSNode target = {0};
+  bool has_target = false;
+  for (uint16_t i = 0; i < count; i++) {
+    if (captures[i].index == tagger->doc) {
+      docs_len++;
+    } else if (captures[i].index == adjacent && !has_target) {
+      target = captures[i].node;
+      has_target = true;
+    }
+  }
+  if (docs_len == 0) {
+    return Qnil;
+  }
+
+  // The index in captures of the first doc kept.
+  uint16_t first = 0;
+  if (has_target) {
+    // Keep the docs ending on the row before the target, or before another
+    // kept doc.
+    uint32_t row = ts_node_start_point(target).row;
+    first = count;
+    for (uint16_t i = count; i > 0; i--) {
+      TSNode doc = captures[i - 1].node;
+      if (captures[i - 1].index != tagger->doc) {
+        continue;
+      }
+      if (ts_node_end_point(doc).row + 1 < row ||
+          ts_node_end_byte(doc) > ts_node_start_byte(target)) {
+        break;
+      }
+      first = i - 1;
+      row = ts_node_start_point(doc).row;
+    }
+    if (first == count) {
+      return Qnil;
+    }
+  }
+
+  VALUE strip = tagger->strips[match->pattern_index];
+  VALUE res = rb_str_new(NULL, 0);
+  rb_enc_copy(res, run->source);
+  bool separate = false;
+  for (uint16_t i = first; i < count; i++) {
+    if (captures[i].index != tagger->doc) {
+      continue;
+    }
+    uint32_t start = ts_node_start_byte(captures[i].node);
+    uint32_t end = ts_node_end_byte(captures[i].node);
+    if (separate) {
+      rb_str_cat_cstr(res, "\n");
+    }
+    separate = true;
+    if (end > (uint32_t)RSTRING_LEN(run->source) || start > end) {
+      continue;
+    }
+    VALUE doc = rb_str_subseq(run->source, start, end - start);
+    if (!NIL_P(strip)) {
+      doc = rb_funcall(doc, rb_intern("gsub"), 2, strip, rb_str_new(NULL, 0));
+    }
+    rb_str_append(res, doc);
+  }
+  return rb_str_freeze(res);
+}
+
+static void tagger_match(tagger_run_t *run, const TSQueryMatch *match) {
+  tagger_t *tagger = run->tagger;
+  const TSQueryCapture *tag = NULL;
+  const TSQueryCapture *name = NULL;
+  for (uint16_t i = 0; i < match->capture_count; i++) {
+    const TSQueryCapture *capture = &match->captures[i];
+    if (capture->index == tagger->name) {
+      name = capture;
+    } else if (tag == NULL && tagger->capture_kinds[capture->index] >= 0) {
+      tag = capture;
+    }
+  }
+  if (tag == NULL || name == NULL) {
+    return;
+  }
+
+  if (run->tags_len == run->tags_capa) {
+    run->tags_capa = run->tags_capa == 0 ? 64 : run->tags_capa * 2;
+    REALLOC_N(run->tags, tagger_tag_t, run->tags_capa);
+  }
+  tagger_tag_t *res = &run->tags[run->tags_len++];
+  bool definition = tagger->definitions[tag->index];
+  res->fields[TAGGER_KIND] = (uint32_t)tagger->capture_kinds[tag->index];
+  res->fields[TAGGER_DEFINITION] = definition;
+  res->fields[TAGGER_NAME_START] = ts_node_start_byte(name->node);
+  res->fields[TAGGER_NAME_END] = ts_node_end_byte(name->node);
+  res->fields[TAGGER_START] = ts_node_start_byte(tag->node);
+  res->fields[TAGGER_END] = ts_node_end_byte(tag->node);
+  res->fields[TAGGER_ROW] = ts_node_start_point(name->node).row;
+  res->order = run->tags_len - 1;
+  res->docs = -1;
+  if (!NIL_P(run->docs) && definition) {
+    VALUE docs = tagger_docs(run, match);
+    if (!NIL_P(docs)) {
+      res->docs = RARRAY_LEN(run->docs);
+      rb_ary_push(run->docs, docs);
+    }
+  }
+}
+
+static VALUE tagger_run_body(VALUE arg) {
+  tagger_run_t *run = (tagger_run_t *)arg;
+  TSQueryMatch match;
+  while (ts_query_cursor_next_match(run->cursor, &match)) {
+    if (run->text_predicates != NULL &&
+        !text_predicates_satisfied(run->text_predicates, &match,
+                                   RSTRING_PTR(run->source),
+                                   RSTRING_LEN(run->source))) {
+      continue;
+    }
+    tagger_match(run, &match);
+  }
+  return Qnil;
+}
+
+// Tags by name, definitions first, then in the order they were found.
+static int tagger_tag_cmp(const void *a, const void *b) {
+  const tagger_tag_t *s = (const tagger_tag_t *)a;
+  const tagger_tag_t *t = (const tagger_tag_t *)b;
+  const uint32_t *x = s->fields;
+  const uint32_t *y = t->fields;
+  if (x[TAGGER_NAME_START] != y[TAGGER_NAME_START]) {
+    return x[TAGGER_NAME_START] < y[TAGGER_NAME_START] ? -1 : 1;
+  }
+  if (x[TAGGER_NAME_END] != y[TAGGER_NAME_END]) {
+    return x[TAGGER_NAME_END] < y[TAGGER_NAME_END] ? -1 : 1;
+  }
+  if (x[TAGGER_DEFINITION] != y[TAGGER_DEFINITION]) {
+    return x[TAGGER_DEFINITION] ? -1 : 1;
+  }
+  return s->order < t->order ? -1 : s->order > t->order;
+}
+
+/**
+ * Tag +node+, exporting every tag as {FIELDS}, i.e. 7 integers: the index of
+ * its kind in {#kinds}, 1 for a definition or 0 for a reference, the byte
+ * range of its name, the byte range of its node, and the row of its name.
+ *
+ * Tags are sorted by name; when a name is tagged more than once, only the
+ * first tag is kept, definitions taking precedence over references.
+ *
+ * @param node   [Node]
+ * @param source [String] the source of the tree.
+ * @param docs   [Array, nil] when given, the documentation of every tag is
+ *   pushed to it, +nil+ for tags without documentation.
+ *
+ * @return [Array<Integer>]
+ */
+static VALUE tagger_tags_packed(int argc, VALUE *argv, VALUE self) {
+  VALUE node, source, docs;
+  rb_scan_args(argc, argv, "21", &node, &source, &docs);
+  tagger_t *tagger = unwrap(self);
+  StringValue(source);
+  if (!NIL_P(docs)) {
+    Check_Type(docs, T_ARRAY);
+  }
+  TSNode ts_node = value_to_node(node);
+
+  tagger_run_t run = {
+      .tagger = tagger,
+      .text_predicates = value_to_text_predicates(tagger->query),
+      .source = source,
+      .docs = NIL_P(docs) ? Qnil : rb_ary_new(),
+  };
+
+  memory_scope_t scope;
+  memory_scope_begin(&scope);
+  run.cursor = ts_query_cursor_new();
+  ts_query_cursor_exec(run.cursor, value_to_query(tagger->query), ts_node);
+  memory_scope_end(&scope);
+
+  int state;
+  rb_protect(tagger_run_body, (VALUE)&run, &state);
+  memory_scope_begin(&scope);
+  ts_query_cursor_delete(run.cursor);
+  memory_scope_end(&scope);
+  if (state) {
+    xfree(run.tags);
+    rb_jump_tag(state);
+  }
+
+  if (run.tags_len > 1) {
+    qsort(run.tags, run.tags_len, sizeof(tagger_tag_t), tagger_tag_cmp);
+  }
+
+  VALUE res = rb_ary_new_capa((long)run.tags_len * TAGGER_FIELDS);
+  const tagger_tag_t *last = NULL;
+  for (size_t i = 0; i < run.tags_len; i++) {
+    const tagger_tag_t *tag = &run.tags[i];
+    if (last != NULL &&
+        last->fields[TAGGER_NAME_START] == tag->fields[TAGGER_NAME_START] &&
+        last->fields[TAGGER_NAME_END] == tag->fields[TAGGER_NAME_END]) {
+      continue;
+    }
+    last = tag;
+    for (int j = 0; j < TAGGER_FIELDS; j++) {
+      rb_ary_push(res, UINT2NUM(tag->fields[j]));
+    }
+    if (!NIL_P(docs)) {
+      rb_ary_push(docs,
+                  tag->docs < 0 ? Qnil : rb_ary_entry(run.docs, tag->docs));
+    }
+  }
+  xfree(run.tags);
+  RB_GC_GUARD(run.docs);
+  RB_GC_GUARD(source);
+  return res;
+}
+
+void init_tagger(void) {
+  cTagger = rb_define_class_under(mTreeSitter, "Tagger", rb_cObject);
+
+  rb_define_alloc_func(cTagger, tagger_allocate);
+
+  /* Class methods */
+  rb_define_method(cTagger, "initialize", tagger_initialize, 2);
+  rb_define_method(cTagger, "kinds", tagger_get_kinds, 0);
+  rb_define_method(cTagger, "query", tagger_get_query, 0);
+  rb_define_method(cTagger, "tags_packed", tagger_tags_packed, -1);
+}
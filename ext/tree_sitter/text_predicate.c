@@ -0,0 +1,386 @@
+#include "tree_sitter.h"
+#include <ruby/re.h>
+
+// Text predicates (#eq?, #match?, #any-of?, …) compiled from a query's
+// predicate steps, so they can be checked against the source without going
+// through ruby.
+//
+// This mirrors what {Query#process} and {QueryMatch#satisfies_text_predicate?}
+// do in ruby.
+
+typedef enum {
+  TEXT_PREDICATE_EQ_CAPTURE,
+  TEXT_PREDICATE_EQ_STRING,
+  TEXT_PREDICATE_MATCH_STRING,
+  TEXT_PREDICATE_ANY_STRING,
+} text_predicate_type_t;
+
+// A string literal, borrowed from the TSQuery which outlives us.
+typedef struct {
+  const char *str;
+  uint32_t len;
+} text_predicate_string_t;
+
+// capture:         the capture whose text is checked.
+// other_capture:   the capture compared to, for EQ_CAPTURE.
+// strings_offset:  the literals compared to, for EQ_STRING and ANY_STRING.
+// strings_count:
+// regex:           a ruby Regexp for MATCH_STRING, Qnil otherwise.
+typedef struct {
+  text_predicate_type_t type;
+  uint32_t capture;
+  uint32_t other_capture;
+  uint32_t strings_offset;
+  uint32_t strings_count;
+  VALUE regex;
+  bool positive;
+  bool match_all;
+} text_predicate_t;
+
+// The predicates of pattern i are predicates[offsets[i]...offsets[i + 1]].
+struct text_predicates {
+  uint32_t pattern_count;
+  uint32_t *offsets;
+  text_predicate_t *predicates;
+  uint32_t predicate_count;
+  text_predicate_string_t *strings;
+  uint32_t string_count;
+};
+
+static text_predicate_string_t
+text_predicate_string(const TSQuery *query, uint32_t id) {
+  text_predicate_string_t res;
+  res.str = ts_query_string_value_for_id(query, id, &res.len);
+  return res;
+}
+
+static bool text_predicate_operator_is(text_predicate_string_t op,
+                                       const char *name) {
+  size_t len = strlen(name);
+  return op.len == len && memcmp(op.str, name, len) == 0;
+}
+
+// Compile one predicate, i.e. steps up to, but excluding, a DONE step.
+//
+// Malformed predicates, and predicates that are not about text, are ignored:
+// validation and reporting happen in {Query#process}.
+static bool text_predicate_compile(text_predicates_t *self,
+                                   const TSQuery *query,
+                                   const TSQueryPredicateStep *steps,
+                                   uint32_t length, text_predicate_t *res) {
+  if (length < 2 || steps[0].type != TSQueryPredicateStepTypeString ||
+      steps[1].type != TSQueryPredicateStepTypeCapture) {
+    return false;
+  }
+
+  text_predicate_string_t op = text_predicate_string(query, steps[0].value_id);
+  res->capture = steps[1].value_id;
+  res->other_capture = 0;
+  res->strings_offset = self->string_count;
+  res->strings_count = 0;
+  res->regex = Qnil;
+
+  if (text_predicate_operator_is(op, "eq?") ||
+      text_predicate_operator_is(op, "not-eq?") ||
+      text_predicate_operator_is(op, "any-eq?") ||
+      text_predicate_operator_is(op, "any-not-eq?")) {
+    if (length != 3) {
+      return false;
+    }
+    res->positive = text_predicate_operator_is(op, "eq?") ||
+                    text_predicate_operator_is(op, "any-eq?");
+    res->match_all = text_predicate_operator_is(op, "eq?") ||
+                     text_predicate_operator_is(op, "not-eq?");
+    if (steps[2].type == TSQueryPredicateStepTypeCapture) {
+      res->type = TEXT_PREDICATE_EQ_CAPTURE;
+      res->other_capture = steps[2].value_id;
+    } else {
+      res->type = TEXT_PREDICATE_EQ_STRING;
+      res->strings_count = 1;
+      self->strings[self->string_count++] =
+          text_predicate_string(query, steps[2].value_id);
+    }
+    return true;
+  }
+
+  if (text_predicate_operator_is(op, "match?") ||
+      text_predicate_operator_is(op, "not-match?") ||
+      text_predicate_operator_is(op, "any-match?") ||
+      text_predicate_operator_is(op, "any-not-match?")) {
+    if (length != 3 || steps[2].type != TSQueryPredicateStepTypeString) {
+      return false;
+    }
+    text_predicate_string_t pattern =
+        text_predicate_string(query, steps[2].value_id);
+    res->type = TEXT_PREDICATE_MATCH_STRING;
+    res->positive = text_predicate_operator_is(op, "match?") ||
+                    text_predicate_operator_is(op, "any-match?");
+    res->match_all = text_predicate_operator_is(op, "match?") ||
+                     text_predicate_operator_is(op, "not-match?");
+    res->regex = rb_reg_new_str(rb_utf8_str_new(pattern.str, pattern.len), 0);
+    return true;
+  }
+
+  if (text_predicate_operator_is(op, "any-of?") ||
+      text_predicate_operator_is(op, "not-any-of?")) {
+    res->type = TEXT_PREDICATE_ANY_STRING;
+    res->positive = text_predicate_operator_is(op, "any-of?");
+    res->match_all = false;
+    for (uint32_t i = 2; i < length; i++) {
+      if (steps[i].type != TSQueryPredicateStepTypeString) {
+        self->string_count = res->strings_offset;
+        return false;
+      }
+      self->strings[self->string_count++] =
+          text_predicate_string(query, steps[i].value_id);
+    }
+    res->strings_count = self->string_count - res->strings_offset;
+    return true;
+  }
+
+  return false;
+}
+
+/**
+ * Compile the text predicates of all the patterns in +query+.
+ *
+ * +*out+ is assigned before any regex is compiled, so whatever was built is
+ * released with the query if compilation raises.
+ */
+void text_predicates_compile(const TSQuery *query, text_predicates_t **out) {
+  uint32_t pattern_count = ts_query_pattern_count(query);
+  uint32_t total_steps = 0;
+
+  for (uint32_t i = 0; i < pattern_count; i++) {
+    uint32_t length;
+    ts_query_predicates_for_pattern(query, i, &length);
+    total_steps += length;
+  }
+
+  text_predicates_t *self = ZALLOC(text_predicates_t);
+  self->pattern_count = pattern_count;
+  self->offsets = ZALLOC_N(uint32_t, pattern_count + 1);
+  // Every predicate ends with a DONE step, and every literal is a step.
+  self->predicates = ZALLOC_N(text_predicate_t, total_steps);
+  self->strings = ZALLOC_N(text_predicate_string_t, total_steps);
+  for (uint32_t i = 0; i < total_steps; i++) {
+    self->predicates[i].regex = Qnil;
+  }
+  *out = self;
+
+  for (uint32_t i = 0; i < pattern_count; i++) {
+    uint32_t length;
+    const TSQueryPredicateStep *steps =
+        ts_query_predicates_for_pattern(query, i, &length);
+    self->offsets[i] = self->predicate_count;
+
+    uint32_t start = 0;
+    for (uint32_t j = 0; j < length; j++) {
+      if (steps[j].type != TSQueryPredicateStepTypeDone) {
+        continue;
+      }
+      text_predicate_t *predicate = &self->predicates[self->predicate_count];
+      if (text_predicate_compile(self, query, &steps[start], j - start,
+                                 predicate)) {
+        self->predicate_count++;
+      }
+      start = j + 1;
+    }
+  }
+  self->offsets[pattern_count] = self->predicate_count;
+}
+
+void text_predicates_free(text_predicates_t *self) {
+  if (self == NULL) {
+    return;
+  }
+  xfree(self->offsets);
+  xfree(self->predicates);
+  xfree(self->strings);
+  xfree(self);
+}
+
+void text_predicates_mark(const text_predicates_t *self) {
+  if (self == NULL) {
+    return;
+  }
+  for (uint32_t i = 0; i < self->predicate_count; i++) {
+    // Pinned: onig_search is handed the compiled regex directly.
+    rb_gc_mark(self->predicates[i].regex);
+  }
+}
+
+size_t text_predicates_memsize(const text_predicates_t *self) {
+  if (self == NULL) {
+    return 0;
+  }
+  return sizeof(text_predicates_t) +
+         sizeof(uint32_t) * (self->pattern_count + 1) +
+         sizeof(text_predicate_t) * self->predicate_count +
+         sizeof(text_predicate_string_t) * self->string_count;
+}
+
+/**
+ * Whether +pattern_index+ has text predicates at all.
+ */
+bool text_predicates_any(const text_predicates_t *self,
+                         uint32_t pattern_index) {
+  return self != NULL && pattern_index < self->pattern_count &&
+         self->offsets[pattern_index] < self->offsets[pattern_index + 1];
+}
+
+/**
+ * Whether checking the text predicates of +pattern_index+ needs the GVL.
+ *
+ * Onigmo allocates through ruby's allocator when backtracking deeply, so
+ * regexes must only be run while holding it.
+ */
+bool text_predicates_need_gvl(const text_predicates_t *self,
+                              uint32_t pattern_index) {
+  if (!text_predicates_any(self, pattern_index)) {
+    return false;
+  }
+  for (uint32_t i = self->offsets[pattern_index];
+       i < self->offsets[pattern_index + 1]; i++) {
+    if (self->predicates[i].type == TEXT_PREDICATE_MATCH_STRING) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static text_predicate_string_t text_predicate_node_text(TSNode node,
+                                                        const char *src,
+                                                        size_t len) {
+  uint32_t start = ts_node_start_byte(node);
+  uint32_t end = ts_node_end_byte(node);
+  if (end > len) {
+    end = (uint32_t)len;
+  }
+  if (start > end) {
+    start = end;
+  }
+  text_predicate_string_t res = {.str = src + start, .len = end - start};
+  return res;
+}
+
+static bool text_predicate_string_eq(text_predicate_string_t a,
+                                     text_predicate_string_t b) {
+  return a.len == b.len && memcmp(a.str, b.str, a.len) == 0;
+}
+
+// The index of the first capture of +capture+ at or after +from+, or
+// +capture_count+ if there are none.
+static uint16_t text_predicate_next_capture(const TSQueryMatch *match,
+                                            uint32_t capture, uint16_t from) {
+  while (from < match->capture_count &&
+         match->captures[from].index != capture) {
+    from++;
+  }
+  return from;
+}
+
+static bool text_predicate_eval_eq_capture(const text_predicate_t *predicate,
+                                           const TSQueryMatch *match,
+                                           const char *src, size_t len) {
+  uint16_t count = match->capture_count;
+  uint16_t i = text_predicate_next_capture(match, predicate->capture, 0);
+  uint16_t j = text_predicate_next_capture(match, predicate->other_capture, 0);
+
+  while (i < count && j < count) {
+    bool eq = text_predicate_string_eq(
+        text_predicate_node_text(match->captures[i].node, src, len),
+        text_predicate_node_text(match->captures[j].node, src, len));
+    if (eq != predicate->positive && predicate->match_all) {
+      return false;
+    }
+    if (eq == predicate->positive && !predicate->match_all) {
+      return true;
+    }
+    i = text_predicate_next_capture(match, predicate->capture, i + 1);
+    j = text_predicate_next_capture(match, predicate->other_capture, j + 1);
+  }
+
+  return i >= count && j >= count;
+}
+
+static bool text_predicate_test(const text_predicates_t *self,
+                                const text_predicate_t *predicate,
+                                text_predicate_string_t text) {
+  switch (predicate->type) {
+  case TEXT_PREDICATE_EQ_STRING:
+    return text_predicate_string_eq(text,
+                                    self->strings[predicate->strings_offset]);
+  case TEXT_PREDICATE_MATCH_STRING: {
+    const OnigUChar *start = (const OnigUChar *)text.str;
+    const OnigUChar *end = start + text.len;
+    return onig_search(RREGEXP_PTR(predicate->regex), start, end, start, end,
+                       NULL, ONIG_OPTION_NONE) >= 0;
+  }
+  case TEXT_PREDICATE_ANY_STRING:
+    for (uint32_t i = 0; i < predicate->strings_count; i++) {
+      if (text_predicate_string_eq(
+              text, self->strings[predicate->strings_offset + i])) {
+        return true;
+      }
+    }
+    return false;
+  default:
+    return false;
+  }
+}
+
+static bool text_predicate_eval(const text_predicates_t *self,
+                                const text_predicate_t *predicate,
+                                const TSQueryMatch *match, const char *src,
+                                size_t len) {
+  if (predicate->type == TEXT_PREDICATE_EQ_CAPTURE) {
+    return text_predicate_eval_eq_capture(predicate, match, src, len);
+  }
+
+  for (uint16_t i = 0; i < match->capture_count; i++) {
+    if (match->captures[i].index != predicate->capture) {
+      continue;
+    }
+    text_predicate_string_t text =
+        text_predicate_node_text(match->captures[i].node, src, len);
+    bool ok = text_predicate_test(self, predicate, text);
+
+    if (predicate->type == TEXT_PREDICATE_ANY_STRING) {
+      if (ok != predicate->positive) {
+        return false;
+      }
+      continue;
+    }
+    if (ok != predicate->positive && predicate->match_all) {
+      return false;
+    }
+    if (ok == predicate->positive && !predicate->match_all) {
+      return true;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Whether +match+ satisfies all the text predicates of its pattern, reading
+ * the text of the captured nodes from +src+.
+ */
+bool text_predicates_satisfied(const text_predicates_t *self,
+                               const TSQueryMatch *match, const char *src,
+                               size_t len) {
+  if (!text_predicates_any(self, match->pattern_index)) {
+    return true;
+  }
+
+  uint32_t from = self->offsets[match->pattern_index];
+  uint32_t to = self->offsets[match->pattern_index + 1];
+  for (uint32_t i = from; i < to; i++) {
+    if (!text_predicate_eval(self, &self->predicates[i], match, src, len)) {
+      return false;
+    }
+  }
+
+  return true;
+}
@@ -4,6 +4,14 @@ extern VALUE mTreeSitter;
 
 VALUE cTree;
 
+static void tree_delete(TSTree *tree) {
+  memory_scope_t scope;
+  memory_scope_begin(&scope);
+  ts_tree_delete(tree);
+  memory_scope_end(&scope);
+  memory_gc_sync();
+}
+
 int tree_rc_free(const TSTree *tree) {
   VALUE ptr = ULONG2NUM((uintptr_t)tree);
   VALUE rc = rb_cv_get(cTree, "@@rc");
@@ -14,7 +22,7 @@ int tree_rc_free(const TSTree *tree) {
     --count;
     if (count < 1) {
       rb_hash_delete(rc, ptr);
-      ts_tree_delete((TSTree *)tree);
+      tree_delete((TSTree *)tree);
       return 1;
     } else {
       rb_hash_aset(rc, ptr, ULONG2NUM(count));
@@ -37,7 +45,14 @@ void tree_rc_new(const TSTree *tree) {
   }
 }
 
-DATA_TYPE(TSTree *, tree)
+// memsize: the bytes tree-sitter allocated to produce this tree.  Subtrees
+//          shared with older trees (incremental parsing) or copies are not
+//          counted.
+typedef struct {
+  TSTree *data;
+  size_t memsize;
+} tree_t;
+
 static void tree_free(void *ptr) {
   tree_t *type = (tree_t *)ptr;
   if (tree_rc_free(type->data)) {
@@ -45,18 +60,23 @@ static void tree_free(void *ptr) {
   }
 }
 
-DATA_MEMSIZE(tree)
+static size_t tree_memsize(const void *ptr) {
+  const tree_t *type = (const tree_t *)ptr;
+  return sizeof(tree_t) + type->memsize;
+}
+
 DATA_DECLARE_DATA_TYPE(tree)
 DATA_ALLOCATE(tree)
 DATA_UNWRAP(tree)
 
-VALUE new_tree(TSTree *ptr) {
+VALUE new_tree(TSTree *ptr, size_t memsize) {
   if (ptr == NULL) {
     return Qnil;
   }
   VALUE res = tree_allocate(cTree);
   tree_t *type = unwrap(res);
   type->data = ptr;
+  type->memsize = memsize;
   tree_rc_new(ptr);
   return res;
 }
@@ -89,9 +109,7 @@ static VALUE tree_changed_ranges(VALUE _self, VALUE old_tree, VALUE new_tree) {
     rb_ary_push(res, new_range(&ranges[i]));
   }
 
-  if (ranges) {
-    free(ranges);
-  }
+  memory_free(ranges);
 
   return res;
 }
@@ -105,7 +123,7 @@ static VALUE tree_finalizer(VALUE _self) {
     VALUE curr = RARRAY_AREF(keys, i);
     unsigned int val = NUM2UINT(rb_hash_lookup(rc, curr));
     if (val > 0) {
-      ts_tree_delete((TSTree *)NUM2ULONG(curr));
+      tree_delete((TSTree *)NUM2ULONG(curr));
     }
 
     rb_hash_delete(rc, curr);
@@ -122,7 +140,7 @@ static VALUE tree_finalizer(VALUE _self) {
  *
  * @return [Tree]
  */
-static VALUE tree_copy(VALUE self) { return new_tree(ts_tree_copy(SELF)); }
+static VALUE tree_copy(VALUE self) { return new_tree(ts_tree_copy(SELF), 0); }
 
 /**
  * Edit the syntax tree to keep it in sync with source code that has been
@@ -138,6 +156,7 @@ static VALUE tree_copy(VALUE self) { return new_tree(ts_tree_copy(SELF)); }
 static VALUE tree_edit(VALUE self, VALUE edit) {
   TSInputEdit in = value_to_input_edit(edit);
   ts_tree_edit(SELF, &in);
+  memory_gc_sync();
   return Qnil;
 }
 
@@ -148,11 +167,12 @@ static VALUE tree_edit(VALUE self, VALUE edit) {
  */
 static VALUE included_ranges(VALUE self) {
   uint32_t length;
-  const TSRange *ranges = ts_tree_included_ranges(SELF, &length);
+  TSRange *ranges = ts_tree_included_ranges(SELF, &length);
   VALUE res = rb_ary_new_capa(length);
   for (uint32_t i = 0; i < length; i++) {
     rb_ary_push(res, new_range(&ranges[i]));
   }
+  memory_free(ranges);
   return res;
 }
 
@@ -233,6 +233,78 @@ VALUE tree_cursor_reset_to(VALUE self, VALUE src) {
   return Qnil;
 }
 
+// A walk of the subtree of a cursor's current node, on a copy of the cursor.
+//
+// Neither the cursor nor the view keep the tree alive, so the walk holds a
+// reference to it until it's over.
+typedef struct {
+  TSTreeCursor cursor;
+  VALUE view;
+} tree_cursor_walk_t;
+
+static VALUE tree_cursor_walk_each(VALUE ptr) {
+  tree_cursor_walk_t *walk = (tree_cursor_walk_t *)ptr;
+  uint32_t depth = 0;
+  for (;;) {
+    node_view_set(walk->view, &walk->cursor, depth);
+    rb_yield(walk->view);
+    if (!node_view_skipped(walk->view) &&
+        ts_tree_cursor_goto_first_child(&walk->cursor)) {
+      depth++;
+      continue;
+    }
+    for (;;) {
+      if (depth == 0) {
+        return Qnil;
+      }
+      if (ts_tree_cursor_goto_next_sibling(&walk->cursor)) {
+        break;
+      }
+      ts_tree_cursor_goto_parent(&walk->cursor);
+      depth--;
+    }
+  }
+}
+
+static VALUE tree_cursor_walk_ensure(VALUE ptr) {
+  tree_cursor_walk_t *walk = (tree_cursor_walk_t *)ptr;
+  const TSTree *tree = walk->cursor.tree;
+  node_view_invalidate(walk->view);
+  ts_tree_cursor_delete(&walk->cursor);
+  tree_rc_free(tree);
+  return Qnil;
+}
+
+/**
+ * Walk the subtree of the current node, depth-first, without allocating a
+ * {Node} per step.
+ *
+ * A single {NodeView} is yielded, updated in place at every step: it is only
+ * valid until the next step, and raises once the walk is over. Use
+ * {NodeView#to_node} to keep a node. The cursor itself doesn't move.
+ *
+ * @example Count the identifiers, skipping comments' subtrees
+ *   count = 0
+ *   cursor.walk do |view|
+ *     view.skip_children! if view.type == :comment
+ *     count += 1 if view.type == :identifier
+ *   end
+ *
+ * @yieldparam view [NodeView]
+ *
+ * @return [TreeCursor] self.
+ */
+static VALUE tree_cursor_walk(VALUE self) {
+  RETURN_ENUMERATOR(self, 0, NULL);
+  tree_cursor_walk_t walk = {.view = node_view_new()};
+  walk.cursor = ts_tree_cursor_copy(&SELF);
+  tree_rc_new(walk.cursor.tree);
+  rb_ensure(tree_cursor_walk_each, (VALUE)&walk, tree_cursor_walk_ensure,
+            (VALUE)&walk);
+  RB_GC_GUARD(walk.view);
+  return self;
+}
+
 void init_tree_cursor(void) {
   cTreeCursor = rb_define_class_under(mTreeSitter, "TreeCursor", rb_cObject);
 
@@ -266,4 +338,6 @@ void init_tree_cursor(void) {
   rb_define_method(cTreeCursor, "initialize", tree_cursor_initialize, 1);
   rb_define_method(cTreeCursor, "reset", tree_cursor_reset, 1);
   rb_define_method(cTreeCursor, "reset_to", tree_cursor_reset_to, 1);
+  rb_define_method(cTreeCursor, "walk", tree_cursor_walk, 0);
+  rb_define_alias(cTreeCursor, "each_step", "walk");
 }
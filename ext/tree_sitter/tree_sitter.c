@@ -22,12 +22,15 @@ void Init_tree_sitter() {
   rb_define_const(mTreeSitter, "MIN_COMPATIBLE_LANGUAGE_VERSION",
                   TREE_SITTER_MIN_COMPATIBLE_LANGUAGE_VERSION);
 
+  init_allocator();
   init_encoding();
+  init_highlighter();
   init_input();
   init_input_edit();
   init_language();
   init_logger();
   init_node();
+  init_node_view();
   init_parser();
   init_point();
   init_quantifier();
@@ -39,6 +42,7 @@ void Init_tree_sitter() {
   init_query_predicate_step();
   init_range();
   init_symbol_type();
+  init_tagger();
   init_tree();
   init_tree_cursor();
 }
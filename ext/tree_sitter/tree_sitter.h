@@ -67,18 +67,22 @@ VALUE new_point(const TSPoint *);
 VALUE new_point_by_val(TSPoint);
 VALUE new_query_capture(const TSQueryCapture *);
 VALUE new_query_match(const TSQueryMatch *);
+VALUE new_query_match_with_properties(const TSQueryMatch *, VALUE);
 VALUE new_query_predicate_step(const TSQueryPredicateStep *);
 VALUE new_range(const TSRange *);
 VALUE new_symbol_type(TSSymbolType);
-VALUE new_tree(TSTree *);
+VALUE new_tree(TSTree *, size_t);
 
 // All init_* functions are called from Init_tree_sitter
+void init_allocator(void);
 void init_encoding(void);
+void init_highlighter(void);
 void init_input(void);
 void init_input_edit(void);
 void init_language(void);
 void init_logger(void);
 void init_node(void);
+void init_node_view(void);
 void init_parser(void);
 void init_point(void);
 void init_quantifier(void);
@@ -90,6 +94,7 @@ void init_query_match(void);
 void init_query_predicate_step(void);
 void init_range(void);
 void init_symbol_type(void);
+void init_tagger(void);
 void init_tree(void);
 void init_tree_cursor(void);
 
@@ -97,6 +102,53 @@ void init_tree_cursor(void);
 const char *quantifier_str(TSQuantifier);
 const char *query_error_str(TSQueryError);
 
+// Memory accounting of the allocations made by tree-sitter
+typedef struct memory_scope {
+  ssize_t bytes;
+  struct memory_scope *parent;
+} memory_scope_t;
+
+void memory_free(void *);
+void memory_gc_sync(void);
+void memory_scope_begin(memory_scope_t *);
+ssize_t memory_scope_end(memory_scope_t *);
+
+// Native text predicates of a query
+typedef struct text_predicates text_predicates_t;
+
+bool text_predicates_any(const text_predicates_t *, uint32_t);
+void text_predicates_compile(const TSQuery *, text_predicates_t **);
+void text_predicates_free(text_predicates_t *);
+void text_predicates_mark(const text_predicates_t *);
+bool text_predicates_need_gvl(const text_predicates_t *, uint32_t);
+size_t text_predicates_memsize(const text_predicates_t *);
+bool text_predicates_satisfied(const text_predicates_t *, const TSQueryMatch *,
+                               const char *, size_t);
+const text_predicates_t *value_to_text_predicates(VALUE);
+
+// Native properties (#set!, #is?, #is-not?) of a query
+typedef struct query_properties query_properties_t;
+typedef struct query_property_assertions query_property_assertions_t;
+
+bool query_properties_any(const query_properties_t *, uint32_t);
+void query_properties_compile(const TSQuery *, query_properties_t **);
+void query_properties_free(query_properties_t *);
+void query_properties_mark(const query_properties_t *);
+size_t query_properties_memsize(const query_properties_t *);
+bool query_properties_satisfied(const query_properties_t *,
+                                const TSQueryMatch *,
+                                const query_property_assertions_t *);
+VALUE query_properties_settings(const query_properties_t *, uint32_t);
+query_property_assertions_t *query_property_assertions_new(VALUE);
+void query_property_assertions_free(query_property_assertions_t *);
+const query_properties_t *value_to_query_properties(VALUE);
+
+// Reusable node views of TreeCursor#walk
+bool node_view_skipped(VALUE);
+void node_view_invalidate(VALUE);
+VALUE node_view_new(void);
+void node_view_set(VALUE, const TSTreeCursor *, uint32_t);
+
 // TSTree reference counting
 int tree_rc_free(const TSTree *);
 void tree_rc_new(const TSTree *);
@@ -11,15 +11,28 @@ require 'tree_sitter/version'
 
 require 'tree_sitter/mixins/language'
 
+require 'tree_sitter/cursor_pool'
 require 'tree_sitter/error'
+require 'tree_sitter/highlighter'
+require 'tree_sitter/injector'
+require 'tree_sitter/language'
+require 'tree_sitter/language_registry'
 require 'tree_sitter/node'
+require 'tree_sitter/parse_stats'
 require 'tree_sitter/query'
+require 'tree_sitter/query_cache'
 require 'tree_sitter/query_captures'
 require 'tree_sitter/query_cursor'
 require 'tree_sitter/query_match'
 require 'tree_sitter/query_matches'
 require 'tree_sitter/query_predicate'
+require 'tree_sitter/query_profile'
+require 'tree_sitter/query_property'
+require 'tree_sitter/query_set'
+require 'tree_sitter/tagger'
 require 'tree_sitter/text_predicate_capture'
+require 'tree_sitter/tree_cursor'
+require 'tree_sitter/warmup'
 
 require 'oppen'
 
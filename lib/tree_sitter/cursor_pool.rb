@@ -0,0 +1,79 @@
+# frozen_string_literal: true
+
+module TreeSitter
+  # A per-thread pool of cursors, {QueryCursor} or {TreeCursor}.
+  #
+  # Cursors keep the native buffers they grew while running, so reusing one
+  # for many small queries or walks avoids paying again for their allocation
+  # and growth. Each thread has its own stack of idle cursors: checking out
+  # and in never takes a lock, and a cursor is never shared between threads.
+  #
+  # Nested checkouts get distinct cursors.
+  #
+  # @see QueryCursor.with
+  # @see TreeCursor.with
+  class CursorPool
+    # The default number of idle cursors kept per thread.
+    DEFAULT_MAX_IDLE = 8
+
+    # @return [Integer] the maximum number of idle cursors kept per thread.
+    attr_reader :max_idle
+
+    # @param max_idle [Integer] the maximum number of idle cursors kept per
+    #   thread; cursors checked in past that are left to the GC.
+    #
+    # @yieldparam args the arguments given to {#checkout}.
+    # @yieldreturn [QueryCursor, TreeCursor] a new cursor.
+    def initialize(max_idle: DEFAULT_MAX_IDLE, &factory)
+      raise ArgumentError, 'CursorPool needs a block creating cursors' if !factory
+      raise ArgumentError, "max_idle must be non-negative, got #{max_idle}" if max_idle.negative?
+
+      @max_idle = max_idle
+      @factory = factory
+      # Thread variables are per thread, not per fiber like Thread#[].
+      @key = :"tree_sitter_cursor_pool_#{object_id}"
+    end
+
+    # Take an idle cursor of the current thread, or create one.
+    #
+    # @param args the arguments of the factory block, when creating a cursor.
+    #
+    # @return [QueryCursor, TreeCursor]
+    def checkout(*args)
+      idle.pop || @factory.call(*args)
+    end
+
+    # Give a cursor back to the current thread's pool.
+    #
+    # The cursor must not be used afterwards.
+    #
+    # @param cursor [QueryCursor, TreeCursor]
+    #
+    # @return [void]
+    def checkin(cursor)
+      pool = idle
+      pool.push(cursor) if pool.size < @max_idle
+      nil
+    end
+
+    # @return [Integer] the number of idle cursors of the current thread.
+    def idle_size
+      idle.size
+    end
+
+    # Drop the idle cursors of the current thread.
+    #
+    # @return [void]
+    def clear
+      idle.clear
+      nil
+    end
+
+    private
+
+    def idle
+      thread = Thread.current
+      thread.thread_variable_get(@key) || thread.thread_variable_set(@key, [])
+    end
+  end
+end
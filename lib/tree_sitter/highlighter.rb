@@ -0,0 +1,76 @@
+# frozen_string_literal: true
+
+module TreeSitter
+  # Syntax highlighting with `highlights.scm` and `locals.scm` queries.
+  #
+  # Captures are resolved natively: overlapping captures are nested, the same
+  # node captured by many patterns is highlighted once, and locals are
+  # tracked.  See {#initialize} for the details.
+  #
+  # @example
+  #   highlighter = TreeSitter::Highlighter.new(ruby, highlights, locals:, names: %w[keyword function variable])
+  #   highlighter.html(tree.root_node, src)
+  #   # => "<span class=\"keyword\">def</span> <span class=\"function\">mul</span>…"
+  class Highlighter
+    # The injections of {#events} and {#render} for the layers of an
+    # {Injector}.
+    #
+    # @example
+    #   layers = injector.parse(tree, src)
+    #   highlighter.html(tree.root_node, src, injections: Highlighter.injections(layers, { 'math' => math }))
+    #
+    # @param layers [Hash<String, Injector::Layer>] the layers of the document.
+    # @param highlighters [Hash<String, Highlighter>, #call] the highlighters by
+    #   language name; layers without a highlighter (`nil`) or a tree are not
+    #   highlighted.
+    #
+    # @return [Array<Array(Highlighter, Node, Array<Range>)>]
+    def self.injections(layers, highlighters)
+      layers.filter_map do |name, layer|
+        highlighter = highlighters.is_a?(Hash) ? highlighters[name] : highlighters.call(name)
+        [highlighter, layer.tree.root_node, layer.ranges] if highlighter && layer.tree
+      end
+    end
+
+    # Render `node` as HTML, each highlight being a `span` whose classes are
+    # the dot-separated parts of its name, like `function builtin`.
+    #
+    # @param node [Node]
+    # @param src [String] the source of the tree.
+    # @param class_prefix [String] prepended to every class.
+    # @param injections [Array<Array(Highlighter, Node, Array<Range>)>, nil]
+    #   see {#events}.
+    #
+    # @return [String]
+    def html(node, src, class_prefix: '', injections: nil)
+      open = names.map do |name|
+        %(<span class="#{name.split('.').map { |n| "#{class_prefix}#{n}" }.join(' ')}">)
+      end
+      render(node, src, open, '</span>', true, false, injections)
+    end
+
+    # Render `node` with ANSI escape sequences.
+    #
+    # @example
+    #   highlighter.ansi(tree.root_node, src, { 'keyword' => '1;35', 'string' => '32' })
+    #
+    # @param node [Node]
+    # @param src [String] the source of the tree.
+    # @param theme [Hash<String, String>] the SGR parameters of each highlight
+    #   name; names missing from the theme use their longest prefix found in
+    #   it, or no style at all.
+    # @param injections [Array<Array(Highlighter, Node, Array<Range>)>, nil]
+    #   see {#events}.
+    #
+    # @return [String]
+    def ansi(node, src, theme, injections: nil)
+      sgrs = names.map do |name|
+        parts = name.split('.')
+        parts.size.downto(1).filter_map { |i| theme[parts.take(i).join('.')] }.first
+      end
+      open = sgrs.map { |sgr| sgr ? "\e[#{sgr}m" : '' }
+      close = sgrs.map { |sgr| sgr ? "\e[0m" : '' }
+      render(node, src, open, close, false, true, injections)
+    end
+  end
+end
@@ -0,0 +1,182 @@
+# frozen_string_literal: true
+
+require 'etc'
+
+module TreeSitter
+  # Parse the languages embedded in a document, like SQL in ruby heredocs, or
+  # JS and CSS in HTML, with an `injections.scm` query.
+  #
+  # The content of every injection is found with the usual captures and
+  # properties:
+  # - `@injection.content`: the node holding the injected code.
+  # - `@injection.language`, or `(#set! injection.language "name")`: the
+  #   name of the injected language.
+  # - `(#set! injection.include-children)`: keep the children of the content
+  #   node, which are excluded by default.
+  #
+  # The ranges of each language are parsed together as a single document using
+  # {Parser#included_ranges=}, each language in its own thread, so every
+  # language is parsed once per document.
+  #
+  # @example
+  #   injector = TreeSitter::Injector.new(html, File.read('injections.scm'), languages: ->(name) { TreeSitter.lang(name) })
+  #   layers = injector.parse(tree, src)
+  #   layers['javascript'].tree.root_node
+  #
+  #   # After an edit, reuse the layers.
+  #   tree.edit(edit)
+  #   layers.each_value { |layer| layer.edit(edit) }
+  #   layers = injector.parse(parser.parse_string(tree, new_src), new_src, layers)
+  class Injector
+    # An injected language, and its tree.
+    #
+    # - `name`: the name of the language in the query.
+    # - `language`: the {Language}.
+    # - `ranges`: the {Range}s of the document in that language.
+    # - `tree`: the tree of the ranges, `nil` if parsing failed.
+    Layer = Struct.new(:name, :language, :ranges, :tree) do
+      # Edit the tree of the layer, so it can be reused by {Injector#parse}.
+      #
+      # @param edit [InputEdit]
+      def edit(edit)
+        tree&.edit(edit)
+      end
+    end
+
+    # @return [Query] the injections query.
+    attr_reader :query
+
+    # @param language [Language] the language of the host documents.
+    # @param injections [String] the injections query.
+    # @param languages [Hash<String, Language>, #call] the languages by name;
+    #   injections of unknown languages (`nil`) are ignored.
+    def initialize(language, injections, languages:)
+      @query = Query.new(language, injections)
+      @languages = languages
+      @content = @query.capture_names.index('injection.content')
+      @language = @query.capture_names.index('injection.language')
+      @resolved = {}
+      @mutex = Mutex.new
+    end
+
+    # The ranges of every injected language in `tree`.
+    #
+    # @param node [Node]
+    # @param src [String] the source of the tree.
+    #
+    # @return [Hash<String, Array<Range>>] sorted, non-overlapping ranges by
+    #   language name.
+    def ranges(node, src)
+      res = Hash.new { |h, k| h[k] = [] }
+      return res if @content.nil?
+
+      QueryCursor.with do |cursor|
+        cursor.exec(@query, node)
+        while (match = cursor.next_match(src))
+          name = language_name(match, src)
+          next if name.nil?
+
+          include_children = match.properties.key?('injection.include-children')
+          match.nodes_for_capture_index(@content).each do |content|
+            res[name].concat(content_ranges(content, include_children))
+          end
+        end
+      end
+      res.transform_values { |ranges| disjoint(ranges) }
+    end
+
+    # Parse the injected languages of `tree`.
+    #
+    # @param tree [Tree] the tree of the host document.
+    # @param src [String] its source.
+    # @param previous [Hash<String, Layer>, nil] the layers of the previous
+    #   version of the document, edited with {Layer#edit}, so their trees are
+    #   reparsed incrementally.
+    # @param threads [Integer] the maximum number of languages parsed at once.
+    #
+    # @return [Hash<String, Layer>] the layers by language name.
+    def parse(tree, src, previous = nil, threads: Etc.nprocessors)
+      if !threads.is_a?(Integer) || threads <= 0
+        raise ArgumentError, "threads must be a positive Integer, got #{threads.inspect}"
+      end
+
+      layers =
+        ranges(tree.root_node, src).filter_map do |name, ranges|
+          language = resolve(name)
+          Layer.new(name, language, ranges, previous&.[](name)&.tree) if language
+        end
+      queue = Queue.new
+      layers.each { |layer| queue << layer }
+      queue.close
+
+      Array.new([threads, layers.size].min) do
+        Thread.new do
+          parser = Parser.new
+          while (layer = queue.pop)
+            parser.language = layer.language
+            parser.included_ranges = layer.ranges
+            layer.tree = parser.parse_string(layer.tree, src)
+            parser.reset
+          end
+        end
+      end.each(&:join)
+
+      layers.to_h { |layer| [layer.name, layer] }
+    end
+
+    private
+
+    def language_name(match, src)
+      name = match.properties['injection.language']
+      if name.nil? && @language
+        node = match.nodes_for_capture_index(@language).first
+        name = src.byteslice(node.start_byte...node.end_byte) if node
+      end
+      name
+    end
+
+    def resolve(name)
+      @mutex.synchronize do
+        return @resolved[name] if @resolved.key?(name)
+
+        @resolved[name] = @languages.is_a?(Hash) ? @languages[name] : @languages.call(name)
+      end
+    end
+
+    # The ranges of `node`, without its children unless `include_children`.
+    def content_ranges(node, include_children)
+      return [range(node.start_byte, node.start_point, node.end_byte, node.end_point)] if include_children
+
+      res = []
+      start_byte = node.start_byte
+      start_point = node.start_point
+      node.child_count.times do |i|
+        child = node.child(i)
+        if child.start_byte > start_byte
+          res << range(start_byte, start_point, child.start_byte, child.start_point)
+        end
+        start_byte = child.end_byte
+        start_point = child.end_point
+      end
+      res << range(start_byte, start_point, node.end_byte, node.end_point) if node.end_byte > start_byte
+      res
+    end
+
+    def range(start_byte, start_point, end_byte, end_point)
+      Range.new.tap do |r|
+        r.start_byte = start_byte
+        r.start_point = start_point
+        r.end_byte = end_byte
+        r.end_point = end_point
+      end
+    end
+
+    # Sort ranges, dropping the ones overlapping a previous one, as required
+    # by {Parser#included_ranges=}.
+    def disjoint(ranges)
+      ranges.sort_by(&:start_byte).each_with_object([]) do |r, res|
+        res << r if res.empty? || r.start_byte >= res.last.end_byte
+      end
+    end
+  end
+end
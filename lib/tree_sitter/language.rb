@@ -0,0 +1,21 @@
+# frozen_string_literal: true
+
+module TreeSitter
+  # A grammar, loaded with {TreeSitter.language}.
+  class Language
+    # The names of the node types, indexed by symbol id, as interned Symbols
+    # like the ones returned by {Node#type}.
+    #
+    # @return [Array<Symbol>]
+    def symbol_names
+      @symbol_names ||= symbol_count.times.map { |i| symbol_name(i).to_sym }.freeze
+    end
+
+    # The names of the fields, indexed by field id; id 0 is never a field.
+    #
+    # @return [Array<Symbol, nil>]
+    def field_names
+      @field_names ||= (field_count + 1).times.map { |i| field_name_for_id(i)&.to_sym }.freeze
+    end
+  end
+end
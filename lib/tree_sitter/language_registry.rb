@@ -0,0 +1,124 @@
+# frozen_string_literal: true
+
+module TreeSitter
+  # A thread-safe, process-wide registry of the languages loaded by
+  # {Mixins::Language#language}.
+  #
+  # Looking a parser up probes many paths on disk; the registry remembers where
+  # each language was found, and the {Language} loaded from there, so only the
+  # first lookup of a name pays for it. {Language.load} itself opens each
+  # library once.
+  #
+  # Lookups are keyed by the name and the directories searched, so
+  # {TreeStand::Parser}, which has its own directories, gets its own entries.
+  #
+  # @example Preload the languages at boot, before forking workers
+  #   TreeSitter.preload('ruby', 'javascript')
+  class LanguageRegistry
+    def initialize
+      @mutex = Mutex.new
+      @languages = {}
+      @paths = {}
+      @registered = {}
+      @hits = 0
+      @misses = 0
+    end
+
+    # Get the language for `name`, resolving and loading it on a miss.
+    #
+    # @param name [String]
+    # @param lib_dirs [Array<Pathname>] the directories searched for `name`.
+    #
+    # @yieldreturn [(Language, Pathname)] the language, loaded on a miss, and
+    #   where it was found; failures are not cached.
+    #
+    # @return [Language]
+    def fetch(name, lib_dirs = nil)
+      key = [name, lib_dirs]
+      @mutex.synchronize do
+        if (language = @registered[name] || @languages[key])
+          @hits += 1
+          return language
+        end
+
+        @misses += 1
+      end
+
+      # Load outside of the lock; Language.load returns the same Language to
+      # threads loading the same library.
+      language, path = yield
+      @mutex.synchronize do
+        @paths[key] = path
+        @languages[key] ||= language
+      end
+    end
+
+    # Register a language under `name`, taking precedence over the ones found
+    # on disk, e.g. for grammars linked in another extension.
+    #
+    # @param name [String]
+    # @param language [Language]
+    #
+    # @return [Language]
+    def register(name, language)
+      if !language.is_a?(Language)
+        raise TypeError, "Expected a TreeSitter::Language, got #{language.class}"
+      end
+
+      @mutex.synchronize { @registered[name] = language }
+    end
+
+    # @param name [String]
+    #
+    # @return [Boolean] whether `name` was loaded or registered.
+    def loaded?(name)
+      @mutex.synchronize { @registered.key?(name) || @languages.each_key.any? { |n, _| n == name } }
+    end
+
+    # @return [Hash<String, Pathname, nil>] where each loaded language was
+    #   found, `nil` for the grammars linked into the extension.
+    def paths
+      @mutex.synchronize { @paths.to_h { |(name, _), path| [name, path] } }
+    end
+
+    # Forget all the languages, so the next lookups search the disk again.
+    # Statistics are kept.
+    #
+    # @return [void]
+    def clear
+      @mutex.synchronize do
+        @languages.clear
+        @paths.clear
+        @registered.clear
+      end
+    end
+
+    # - `hits`: lookups served from the registry.
+    # - `misses`: lookups that searched for the language.
+    # - `size`: the number of languages known.
+    #
+    # @return [Hash<Symbol, Integer>]
+    def stats
+      @mutex.synchronize { { hits: @hits, misses: @misses, size: @languages.size + @registered.size } }
+    end
+
+    # Reset the lock, which a forked child might have inherited locked by a
+    # thread that doesn't exist anymore. Loaded languages are kept.
+    #
+    # @see TreeSitter.after_fork
+    #
+    # @return [void]
+    def after_fork
+      @mutex = Mutex.new
+    end
+  end
+
+  @language_registry = LanguageRegistry.new
+
+  class << self
+    # The process-wide language registry, used by {Mixins::Language#language}.
+    #
+    # @return [LanguageRegistry]
+    attr_reader :language_registry
+  end
+end
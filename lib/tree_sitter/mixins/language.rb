@@ -78,23 +78,43 @@ module TreeSitter
       #
       # @raise [RuntimeError] if the parser was not found.
       #
+      # @note languages are cached by {TreeSitter.language_registry}: the
+      #   disk is only searched the first time a name is looked up.
+      # @note grammars linked into the extension with `--enable-static-grammars`
+      #   take precedence, and are never searched for on disk.
+      #
       # @see search_for_lib
       def language(name)
-        lib = search_for_lib(name)
+        ::TreeSitter.language_registry.fetch(name, lib_dirs) do
+          linked = TreeSitter::Language.linked(name.tr('-', '_'))
+          next [linked, nil] if linked
 
-        if lib.nil?
-          raise ::TreeSitter::ParserNotFoundError, <<~MSG.chomp
-            Failed to load a parser for #{name}.
+          lib = search_for_lib(name)
 
-            #{search_lib_message}
-          MSG
-        end
+          if lib.nil?
+            raise ::TreeSitter::ParserNotFoundError, <<~MSG.chomp
+              Failed to load a parser for #{name}.
 
-        # We know that the bindings will accept `lib`, but I don't know how to tell sorbet
-        # the types in ext/tree_sitter where `load` is defined.
-        TreeSitter::Language.load(name.tr('-', '_'), lib)
+              #{search_lib_message}
+            MSG
+          end
+
+          # We know that the bindings will accept `lib`, but I don't know how to tell sorbet
+          # the types in ext/tree_sitter where `load` is defined.
+          [TreeSitter::Language.load(name.tr('-', '_'), lib), lib]
+        end
       end
 
+      # Load languages ahead of time, e.g. at boot before forking workers, so
+      # later lookups are served by {TreeSitter.language_registry}.
+      #
+      # @param names [Array<String>]
+      #
+      # @raise [ParserNotFoundError] if one of the languages was not found.
+      #
+      # @return [Hash<String, TreeSitter::Language>]
+      def preload(*names) = names.to_h { |name| [name, language(name)] }
+
       # The platform-specific extension of the parser.
       # @return [String] `dylib` or `so` for mac or linux.
       def ext
@@ -0,0 +1,19 @@
+# frozen_string_literal: true
+
+module TreeSitter
+  # What a parse did, see {Parser#stats}.
+  #
+  # - `wall_ns`, `cpu_ns`: the wall and CPU time of the parse.
+  # - `bytes`: the length of the input.
+  # - `nodes`: the nodes in the tree.
+  # - `errors`, `missing`: the error and missing nodes in the tree.
+  # - `reused`: for incremental parses, the share of the document outside of
+  #   the ranges that changed since the old tree, `nil` otherwise.
+  ParseStats = Struct.new(:wall_ns, :cpu_ns, :bytes, :nodes, :errors, :missing, :reused) do
+    # @return [Float] the bytes parsed per second of wall time.
+    def throughput = wall_ns.zero? ? Float::INFINITY : bytes * 1e9 / wall_ns
+
+    # @return [Boolean] whether the parse was given an old tree.
+    def incremental? = !reused.nil?
+  end
+end
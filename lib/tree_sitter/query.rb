@@ -1,90 +1,197 @@
 # frozen_string_literal: true
 
+require 'etc'
+
 require_relative 'helpers'
 
 module TreeSitter
   # Query is a wrapper around a tree-sitter query.
+  #
+  # Predicates are validated and compiled natively when the query is created;
+  # the ruby tables describing them are only built when first accessed.
   class Query
-    attr_reader :capture_names
-    attr_reader :capture_quantifiers
-    attr_reader :text_predicates
-    attr_reader :property_predicates
-    attr_reader :property_settings
-    attr_reader :general_predicates
+    # The names of the captures, indexed by capture id.
+    #
+    # Names are interned, frozen Strings, so they can be used as keys without
+    # allocating a new String per capture.
+    #
+    # @return [Array<String>]
+    def capture_names
+      @capture_names ||= capture_count.times.map { |i| -capture_name_for_id(i) }.freeze
+    end
 
-    private
+    # Like {#capture_names}, as Symbols.
+    #
+    # @return [Array<Symbol>]
+    def capture_symbols
+      @capture_symbols ||= capture_names.map(&:to_sym).freeze
+    end
+
+    # @return [Array<Integer>] the indices of the patterns that are
+    #   {#pattern_non_local?}.
+    def non_local_patterns
+      @non_local_patterns ||= pattern_count.times.select { |i| pattern_non_local?(i) }.freeze
+    end
+
+    # @return [Array<Array<TextPredicateCapture>>] the text predicates of each pattern.
+    def text_predicates
+      process if !@processed
+      @text_predicates
+    end
+
+    # @return [Array<Array<(QueryProperty, Boolean)>>] the `#is?` and
+    #   `#is-not?` predicates of each pattern, with whether they're positive.
+    def property_predicates
+      process if !@processed
+      @property_predicates
+    end
+
+    # @return [Array<Array<QueryProperty>>] the `#set!` directives of each pattern.
+    def property_settings
+      process if !@processed
+      @property_settings
+    end
 
-    # Called from query.c on initialize.
+    # @return [Array<Array<QueryPredicate>>] the predicates of each pattern
+    #   that tree-sitter doesn't know about.
+    def general_predicates
+      process if !@processed
+      @general_predicates
+    end
+
+    # Run the query over many trees in parallel.
     #
-    # Prepares all the predicates so we could process them in places like
-    # {QueryMatch#satisfies_text_predicate?}.
+    # Every tree is queried by a {QueryCursor#exec_packed} on its own copy of
+    # the tree, so the GVL is released while the cursors run, and the trees
+    # can still be used, or edited, by other threads.
     #
-    # This is translation from the [rust bindings](https://github.com/tree-sitter/tree-sitter/blob/e553578696fe86071846ed612ee476d0167369c1/lib/binding_rust/lib.rs#L1860)
-    # Because it's a direct translation, it's way too long and we need to shut up rubocop.
-    # TODO: refactor + simplify when stable.
-    def process(source) # rubocop:disable Metrics/AbcSize,Metrics/CyclomaticComplexity,Metrics/MethodLength,Metrics/PerceivedComplexity
-      string_count = self.string_count
-      capture_count = self.capture_count
-      pattern_count = self.pattern_count
-
-      # Build a vector of strings to store the capture names.
-      capture_names = capture_count.times.map { |i| capture_name_for_id(i) }
-
-      # Build a vector to store capture qunatifiers.
-      capture_quantifiers =
-        pattern_count.times.map do |i|
-          capture_count.times.map do |j|
-            capture_quantifier_for_id(i, j)
+    # @example
+    #   query.exec_many(trees, sources).each_with_index do |captures, i|
+    #     captures.each_slice(QueryCursor::PACKED_FIELDS.size) do |pattern, capture, start_byte, end_byte, symbol|
+    #       # …
+    #     end
+    #   end
+    #
+    # @param trees [Array<Tree>]
+    # @param sources [Array<String>, nil] the sources of the trees, to check text
+    #   predicates; ignored when `nil`.
+    # @param threads [Integer] the number of threads to run cursors on.
+    #
+    # @return [Array<Array<Integer>>] the captures of each tree, packed like
+    #   {QueryCursor#each_packed}.
+    def exec_many(trees, sources = nil, threads: Etc.nprocessors)
+      if !threads.is_a?(Integer) || threads <= 0
+        raise ArgumentError, "threads must be a positive Integer, got #{threads.inspect}"
+      end
+      if sources && sources.size != trees.size
+        raise ArgumentError, "Expected #{trees.size} sources, got #{sources.size}"
+      end
+
+      copies = trees.map(&:copy)
+      results = Array.new(trees.size)
+      next_index = 0
+      mutex = Mutex.new
+
+      workers =
+        [threads, trees.size].min.times.map do
+          Thread.new do
+            cursor = QueryCursor.new
+            loop do
+              i = mutex.synchronize { next_index.tap { next_index += 1 } }
+              break if i >= copies.size
+
+              results[i] = cursor.exec_packed(self, copies[i].root_node, sources&.[](i))
+            end
           end
         end
+      workers.each(&:join)
 
-      # Build a vector of strings to represent literal values used in predicates.
+      results
+    end
+
+    # Profile the patterns of the query over one or more trees, to find out
+    # which patterns are expensive.
+    #
+    # Every match is counted and timed natively, see {QueryCursor#profile}.
+    # When a block is given, it is called with every accepted match, and the
+    # time it takes, e.g. to check {#general_predicates} or to run a lint
+    # rule, is attributed to the pattern of the match.
+    #
+    # @example
+    #   profile = query.profile(trees, sources)
+    #   puts profile
+    #   profile.slowest(5).each { |pattern| puts source.byteslice(pattern.start_byte, 80) }
+    #
+    # @param trees [Tree, Node, Array<Tree, Node>]
+    # @param sources [String, Array<String>, nil] the sources of the trees, to
+    #   check text predicates; ignored when `nil`.
+    #
+    # @yieldparam match [QueryMatch]
+    #
+    # @return [QueryProfile]
+    def profile(trees, sources = nil)
+      trees = [trees] if !trees.is_a?(Array)
+      sources = [sources] if sources && !sources.is_a?(Array)
+      if sources && sources.size != trees.size
+        raise ArgumentError, "Expected #{trees.size} sources, got #{sources.size}"
+      end
+
+      ruby_ns = Array.new(pattern_count, 0)
+      cursor = QueryCursor.new
+      cursor.profiling = true
+      start = Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond)
+      trees.each_with_index do |tree, i|
+        cursor.exec(self, tree.is_a?(Tree) ? tree.root_node : tree)
+        src = sources&.[](i)
+        while (match = cursor.next_match(src))
+          next if !block_given?
+
+          before = Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond)
+          yield match
+          ruby_ns[match.pattern_index] += Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond) - before
+        end
+      end
+      elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond) - start
+
+      QueryProfile.new(self, cursor.profile, ruby_ns, elapsed)
+    end
+
+    private
+
+    # Prepares all the predicates so we could process them in places like
+    # {QueryMatch#satisfies_text_predicate?}.
+    #
+    # This is translation from the [rust bindings](https://github.com/tree-sitter/tree-sitter/blob/e553578696fe86071846ed612ee476d0167369c1/lib/binding_rust/lib.rs#L1860)
+    # Predicates were already validated by query.c, so this only builds the
+    # tables.
+    def process # rubocop:disable Metrics/AbcSize,Metrics/CyclomaticComplexity,Metrics/MethodLength,Metrics/PerceivedComplexity
       string_values = string_count.times.map { |i| string_value_for_id(i) }
+      text_predicates = []
+      property_predicates = []
+      property_settings = []
+      general_predicates = []
 
       # Build a vector of predicates for each pattern.
       pattern_count.times do |i| # rubocop:disable Metrics/BlockLength
-        predicate_steps = predicates_for_pattern(i)
-        byte_offset = start_byte_for_pattern(i)
-        row = source[0...byte_offset].count("\n")
-        text_predicates = []
-        property_predicates = []
-        property_settings = []
-        general_predicates = []
-
-        array_split_like_rust(predicate_steps) { |s| s.type == QueryPredicateStep::DONE } # rubocop:disable Metrics/BlockLength
+        pattern_text_predicates = []
+        pattern_property_predicates = []
+        pattern_property_settings = []
+        pattern_general_predicates = []
+
+        array_split_like_rust(predicates_for_pattern(i)) { |s| s.type == QueryPredicateStep::DONE }
           .each do |p|
             next if p.empty?
 
-            if p[0] == QueryPredicateStep::STRING
-              cap = capture_names[p[0].value_id]
-              raise ArgumentError, <<~MSG.chomp
-                L#{row}: Expected predicate to start with a function name. Got @#{cap}.
-              MSG
-            end
-
             # Build a predicate for each of the known predicate function names.
             operator_name = string_values[p[0].value_id]
 
             case operator_name
             in 'any-eq?' | 'any-not-eq?' | 'eq?' | 'not-eq?'
-              if p.size != 3
-                raise ArgumentError, <<~MSG.chomp
-                  L#{row}: Wrong number of arguments to ##{operator_name} predicate. Expected 2, got #{p.size - 1}.
-                MSG
-              end
-
-              if p[1].type != QueryPredicateStep::CAPTURE
-                lit = string_values[p[1].value_id]
-                raise ArgumentError, <<~MSG.chomp
-                  L#{row}: First argument to ##{operator_name} predicate must be a capture name. Got literal "#{lit}".
-                MSG
-              end
-
               is_positive = %w[eq? any-eq?].include?(operator_name)
               match_all = %w[eq? not-eq?].include?(operator_name)
               # NOTE: in the rust impl, match_all can hit an unreachable! but I am simplifying
               # for readability. Same applies for the other `in` branches.
-              text_predicates <<
+              pattern_text_predicates <<
                 if p[2].type == QueryPredicateStep::CAPTURE
                   TextPredicateCapture.eq_capture(p[1].value_id, p[2].value_id, is_positive, match_all)
                 else
@@ -92,70 +199,26 @@ module TreeSitter
                 end
 
             in 'match?' | 'not-match?' | 'any-match?' | 'any-not-match?'
-              if p.size != 3
-                raise ArgumentError, <<~MSG.chomp
-                  L#{row}: Wrong number of arguments to ##{operator_name} predicate. Expected 2, got #{p.size - 1}.
-                MSG
-              end
-
-              if p[1].type != QueryPredicateStep::CAPTURE
-                lit = string_values[p[1].value_id]
-                raise ArgumentError, <<~MSG.chomp
-                  L#{row}: First argument to ##{operator_name} predicate must be a capture name. Got literal "#{lit}".
-                MSG
-              end
-
-              if p[2].type == QueryPredicateStep::CAPTURE
-                cap = capture_names[p[2].value_id]
-                raise ArgumentError, <<~MSG.chomp
-                  L#{row}: First argument to ##{operator_name} predicate must be a literal. Got capture @#{cap}".
-                MSG
-              end
-
               is_positive = %w[match? any-match?].include?(operator_name)
               match_all = %w[match? not-match?].include?(operator_name)
               regex = /#{string_values[p[2].value_id]}/
 
-              text_predicates << TextPredicateCapture.match_string(p[1].value_id, regex, is_positive, match_all)
+              pattern_text_predicates << TextPredicateCapture.match_string(p[1].value_id, regex, is_positive, match_all)
 
             in 'set!'
-              property_settings << 'todo!'
+              pattern_property_settings << parse_property(p, string_values)
 
             in 'is?' | 'is-not?'
-              property_predicates << 'todo!'
+              pattern_property_predicates << [parse_property(p, string_values), operator_name == 'is?']
 
             in 'any-of?' | 'not-any-of?'
-              if p.size < 2
-                raise ArgumentError, <<~MSG.chomp
-                  L#{row}: Wrong number of arguments to ##{operator_name} predicate. Expected at least 1, got #{p.size - 1}.
-                MSG
-              end
-
-              if p[1].type != QueryPredicateStep::CAPTURE
-                lit = string_values[p[1].value_id]
-                raise ArgumentError, <<~MSG.chomp
-                  L#{row}: First argument to ##{operator_name} predicate must be a capture name. Got literal "#{lit}".
-                MSG
-              end
-
-              is_positive = operator_name == 'any_of'
-              values = []
-
-              p[2..].each do |arg|
-                if arg.type == QueryPredicateStep::CAPTURE
-                  lit = string_values[arg.value_id]
-                  raise ArgumentError, <<~MSG.chomp
-                    L#{row}: First argument to ##{operator_name} predicate must be a capture name. Got literal "#{lit}".
-                  MSG
-                end
-                values << string_values[arg.value_id]
-              end
+              is_positive = operator_name == 'any-of?'
+              values = p[2..].map { |arg| string_values[arg.value_id] }
 
-              # TODO: is the map to to_s necessary in ruby?
-              text_predicates <<
-                TextPredicateCapture.any_string(p[1].value_id, values.map(&:to_s), is_positive, match_all)
+              pattern_text_predicates <<
+                TextPredicateCapture.any_string(p[1].value_id, values, is_positive, false)
             else
-              general_predicates <<
+              pattern_general_predicates <<
                 QueryPredicate.new(
                   operator_name,
                   p[1..].map do |a|
@@ -167,21 +230,27 @@ module TreeSitter
                   end,
                 )
             end
-
-            @text_predicates << text_predicates
-            @property_predicates << property_predicates
-            @property_settings << property_settings
-            @general_predicates << general_predicates
           end
 
-        @capture_names = capture_names
-        @capture_quantifiers = capture_quantifiers
+        text_predicates << pattern_text_predicates
+        property_predicates << pattern_property_predicates
+        property_settings << pattern_property_settings
+        general_predicates << pattern_general_predicates
       end
+
+      @text_predicates = text_predicates
+      @property_predicates = property_predicates
+      @property_settings = property_settings
+      @general_predicates = general_predicates
+      @processed = true
     end
 
-    # TODO
-    def parse_property
-      # todo
+    # The steps of a property predicate, already validated by query.c: an
+    # optional capture, a key, and an optional value.
+    def parse_property(steps, string_values)
+      capture = steps[1..].find { |s| s.type == QueryPredicateStep::CAPTURE }
+      key, value = steps[1..].select { |s| s.type == QueryPredicateStep::STRING }.map { |s| string_values[s.value_id] }
+      QueryProperty.new(key, value, capture&.value_id)
     end
   end
 end
@@ -0,0 +1,149 @@
+# frozen_string_literal: true
+
+require 'digest'
+
+module TreeSitter
+  # A thread-safe, least-recently-used cache of compiled {Query}.
+  #
+  # Compiling a query runs `ts_query_new` and {Query#process}, which is wasted
+  # work when the same query is run over many documents. Queries are keyed by
+  # their {Language} and a digest of their source.
+  #
+  # Cached queries are shared: don't disable their captures or patterns.
+  #
+  # @example
+  #   query = TreeSitter.query_cache.fetch(ruby, '(identifier) @id')
+  #   TreeSitter.query_cache.stats # => {hits: 0, misses: 1, …}
+  class QueryCache
+    # The number of queries kept by {TreeSitter.query_cache} by default.
+    DEFAULT_CAPACITY = 256
+
+    # @return [Integer] the maximum number of queries kept.
+    attr_reader :capacity
+
+    # @param capacity [Integer] the maximum number of queries kept.
+    def initialize(capacity = DEFAULT_CAPACITY)
+      @capacity = validate_capacity(capacity)
+      @mutex = Mutex.new
+      # Hashes keep insertion order: the first entry is the least recently used.
+      @queries = {}
+      @hits = 0
+      @misses = 0
+      @evictions = 0
+    end
+
+    # Set the maximum number of queries kept, evicting the least recently used
+    # ones if needed.
+    #
+    # @param capacity [Integer]
+    def capacity=(capacity)
+      capacity = validate_capacity(capacity)
+      @mutex.synchronize do
+        @capacity = capacity
+        evict
+      end
+    end
+
+    # Get the compiled query for `source`, compiling and caching it on a miss.
+    #
+    # @param language [Language]
+    # @param source [String]
+    #
+    # @raise [QueryCreationError] if `source` is not a valid query; failures
+    #   are not cached.
+    #
+    # @return [Query]
+    def fetch(language, source)
+      key = [language, Digest::SHA256.digest(source)]
+
+      @mutex.synchronize do
+        if (query = @queries.delete(key))
+          @hits += 1
+          return @queries[key] = query
+        end
+
+        @misses += 1
+      end
+
+      # Compile outside of the lock so threads compiling different queries
+      # don't wait for each other.  Two threads missing on the same query both
+      # compile it, and the last one wins.
+      query = Query.new(language, source)
+
+      @mutex.synchronize do
+        @queries.delete(key)
+        @queries[key] = query
+        evict
+      end
+
+      query
+    end
+
+    # Remove all the cached queries.  Statistics are kept.
+    #
+    # @return [void]
+    def clear
+      @mutex.synchronize { @queries.clear }
+    end
+
+    # @return [Integer] the number of cached queries.
+    def size
+      @mutex.synchronize { @queries.size }
+    end
+
+    # - `hits`: lookups served from the cache.
+    # - `misses`: lookups that compiled the query.
+    # - `evictions`: queries dropped to respect the capacity.
+    # - `size`: the number of cached queries.
+    # - `capacity`: the maximum number of cached queries.
+    #
+    # @return [Hash<Symbol, Integer>]
+    def stats
+      @mutex.synchronize do
+        {
+          hits: @hits,
+          misses: @misses,
+          evictions: @evictions,
+          size: @queries.size,
+          capacity: @capacity,
+        }
+      end
+    end
+
+    # Reset the lock, which a forked child might have inherited locked by a
+    # thread that doesn't exist anymore. Cached queries are kept.
+    #
+    # @see TreeSitter.after_fork
+    #
+    # @return [void]
+    def after_fork
+      @mutex = Mutex.new
+    end
+
+    private
+
+    def evict
+      while @queries.size > @capacity
+        @queries.shift
+        @evictions += 1
+      end
+    end
+
+    def validate_capacity(capacity)
+      if !capacity.is_a?(Integer) || capacity.negative?
+        raise ArgumentError, "capacity must be a non-negative Integer, got #{capacity.inspect}"
+      end
+
+      capacity
+    end
+  end
+
+  @query_cache = QueryCache.new
+
+  class << self
+    # The process-wide query cache, used by {TreeStand}.
+    #
+    # @return [QueryCache]
+    attr_reader :query_cache
+  end
+end
@@ -13,17 +13,18 @@ module TreeSitter
 
     # Iterator over captures.
     #
+    # Text predicates are evaluated natively by {QueryCursor#next_capture}, so
+    # only the captures of matches satisfying them are yielded.
+    #
     # @yieldparam match [TreeSitter::QueryMatch]
     # @yieldparam capture_index [Integer]
     def each(&)
       return enum_for __method__ if !block_given?
 
-      while (capture_index, match = @cursor.next_capture)
+      while (capture_index, match = @cursor.next_capture(@src))
         next if !match.is_a?(TreeSitter::QueryMatch)
 
-        if match.satisfies_text_predicate?(@query, @src)
-          yield [match, capture_index]
-        end
+        yield [match, capture_index]
       end
     end
   end
@@ -3,14 +3,42 @@
 module TreeSitter
   # A Cursor for {Query}.
   class QueryCursor
+    # The pool of {with}.
+    POOL = CursorPool.new { QueryCursor.new }
+
+    # Run a block with a cursor taken from a per-thread pool, instead of
+    # creating a new cursor, so the native buffers grown by previous queries
+    # are reused.
+    #
+    # The cursor is {#reset} and given back to the pool when the block
+    # returns: it, and the {QueryMatches} or {QueryCaptures} built on it,
+    # must not escape the block.
+    #
+    # @example
+    #   TreeSitter::QueryCursor.with do |cursor|
+    #     cursor.matches(query, tree.root_node, src).each { |match| … }
+    #   end
+    #
+    # @yieldparam cursor [QueryCursor]
+    #
+    # @return [Object] the value of the block.
+    def self.with
+      cursor = POOL.checkout
+      yield cursor
+    ensure
+      POOL.checkin(cursor.reset) if cursor
+    end
+
     # Iterate over all of the matches in the order that they were found.
     #
     # Each match contains the index of the pattern that matched, and a list of
     # captures. Because multiple patterns can match the same set of nodes,
     # one match may contain captures that appear *before* some of the
     # captures from a previous match.
-    def matches(query, node, src)
-      self.exec(query, node)
+    #
+    # Options (`timeout:`, `byte_range:`, `point_range:`) are passed to {#exec}.
+    def matches(query, node, src, **)
+      self.exec(query, node, **)
       QueryMatches.new(self, query, src)
     end
 
@@ -19,9 +47,181 @@ module TreeSitter
     #
     # This is useful if you don't care about which pattern matched, and just
     # want a single, ordered sequence of captures.
-    def captures(query, node, src)
-      self.exec(query, node)
+    #
+    # Options (`timeout:`, `byte_range:`, `point_range:`) are passed to {#exec}.
+    def captures(query, node, src, **)
+      self.exec(query, node, **)
       QueryCaptures.new(self, query, src)
     end
+
+    # The counters of every pattern in {#profile}, in order.
+    PROFILE_FIELDS = %i[matches accepted text_rejected property_rejected predicate_ns].freeze
+
+    # The fields of every capture exported by {#each_packed}, in order.
+    PACKED_FIELDS = %i[pattern_index capture_index start_byte end_byte symbol].freeze
+
+    # Drain the currently running query in batches of up to `limit` matches,
+    # without creating a {QueryMatch}, {QueryCapture}, or {Node} per capture.
+    #
+    # Each capture is exported as {PACKED_FIELDS}, i.e. 5 integers.
+    #
+    # @example
+    #   cursor.exec(query, tree.root_node)
+    #   cursor.each_packed(source: src) do |batch|
+    #     batch.unpack('L*').each_slice(5) do |pattern, capture, start_byte, end_byte, symbol|
+    #       # …
+    #     end
+    #   end
+    #
+    # @param limit [Integer] the maximum number of matches per batch.
+    # @param source [String, nil] when given, matches not satisfying the text
+    #   predicates of the query are skipped.
+    # @param format [:string, :array] yield binary Strings of native-endian
+    #   uint32 (`unpack('L*')`), or flat Arrays of Integers.
+    #
+    # @yieldparam batch [String, Array<Integer>]
+    def each_packed(limit: 1024, source: nil, format: :string)
+      return enum_for(__method__, limit:, source:, format:) if !block_given?
+
+      string = packed_format_string?(format)
+      while (batch = next_packed(limit, source, string))
+        yield batch
+      end
+    end
+
+    # Run `query` on `node` and export all the captures at once.
+    #
+    # @see #each_packed
+    #
+    # @return [String, Array<Integer>]
+    def matches_packed(query, node, src = nil, format: :array, limit: 1024, **)
+      self.exec(query, node, **)
+      res = packed_format_string?(format) ? String.new(encoding: Encoding::BINARY) : []
+      each_packed(limit:, source: src, format:) { |batch| res.concat(batch) }
+      res
+    end
+
+    # Iterate over the matches of `query` intersecting any of `ranges`, e.g.
+    # the visible viewport, or the {Tree#changed_ranges} of an edit.
+    #
+    # Matches of local patterns are found by running the cursor on each range.
+    # A non-local pattern ({Query#pattern_non_local?}) can match a sequence of
+    # siblings starting before the range, so when the query has any, ranges
+    # are widened back to the first sibling of the outermost node starting in
+    # the range. The widening only lets such sequences be found: matches
+    # outside of the original ranges, whatever their pattern, are dropped.
+    #
+    # Matches spanning several ranges are yielded once.
+    #
+    # @param query [Query]
+    # @param node [Node]
+    # @param ranges [Array<Range<Integer>, TreeSitter::Range>] byte ranges,
+    #   in any order; overlapping ranges are merged.
+    # @param src [String, nil] when given, matches not satisfying the text
+    #   predicates of the query are skipped.
+    #
+    # @yieldparam match [QueryMatch]
+    def exec_in_ranges(query, node, ranges, src = nil)
+      return enum_for(__method__, query, node, ranges, src) if !block_given?
+
+      ranges = merge_byte_ranges(ranges.map { |r| byte_bounds(r) })
+      non_local = query.non_local_patterns
+      windows =
+        if non_local.empty?
+          ranges
+        else
+          merge_byte_ranges(ranges.map { |from, to| widen_byte_range(node, from, to) })
+        end
+
+      # Matches crossing the end of a window, which the next windows find again.
+      crossing = {}
+      windows.each do |from, to|
+        self.exec(query, node, byte_range: from...to)
+        while (match = next_match(src))
+          bounds = match_bounds(match)
+          # Without captures, there's no telling where a match is.
+          next yield match if bounds.nil?
+          next if !intersects?(ranges, bounds)
+
+          if bounds[0] < from || bounds[1] > to
+            key = [match.pattern_index, match.captures.map { |c| [c.index, c.node.start_byte, c.node.end_byte] }]
+            next if crossing.key?(key)
+
+            crossing[key] = true if bounds[1] > to
+          end
+          yield match
+        end
+      end
+    ensure
+      set_byte_range(0, 0xFFFFFFFF) if block_given?
+    end
+
+    private
+
+    def byte_bounds(range)
+      case range
+      in ::Range
+        to = range.end.nil? ? 0xFFFFFFFF : range.end + (range.exclude_end? ? 0 : 1)
+        [range.begin || 0, to]
+      in TreeSitter::Range
+        [range.start_byte, range.end_byte]
+      else
+        raise TypeError, "Expected a Range or a TreeSitter::Range, got #{range.class}"
+      end
+    end
+
+    # Sort and merge overlapping or adjacent `[from, to]` pairs.
+    def merge_byte_ranges(ranges)
+      ranges.sort.each_with_object([]) do |(from, to), res|
+        if res.empty? || from > res.last[1]
+          res << [from, to]
+        elsif to > res.last[1]
+          res.last[1] = to
+        end
+      end
+    end
+
+    # Widen `[from, to]` to where a sequence of siblings intersecting it can
+    # start: the first sibling of the outermost node starting in the range,
+    # as a sequence can be any number of siblings long.
+    def widen_byte_range(node, from, to)
+      outer = node.descendant_for_byte_range(from, [to - 1, from].max)
+      while outer != node && !(parent = outer.parent).null? && parent.start_byte >= from
+        outer = parent
+      end
+
+      parent = outer == node ? nil : outer.parent
+      start = parent.nil? || parent.null? ? outer.start_byte : parent.child(0).start_byte
+
+      [[start, node.start_byte].max.clamp(..from), to]
+    end
+
+    def match_bounds(match)
+      return nil if match.captures.empty?
+
+      [match.captures.map { |c| c.node.start_byte }.min, match.captures.map { |c| c.node.end_byte }.max]
+    end
+
+    # Empty matches and ranges intersect what contains them.
+    def intersects?(ranges, bounds)
+      ranges.any? do |from, to|
+        if bounds[0] == bounds[1]
+          from <= bounds[0] && (bounds[0] < to || bounds[0] == from)
+        elsif from == to
+          bounds[0] <= from && from < bounds[1]
+        else
+          bounds[0] < to && from < bounds[1]
+        end
+      end
+    end
+
+    def packed_format_string?(format)
+      case format
+      in :string then true
+      in :array then false
+      else
+        raise ArgumentError, "format must be :string or :array, got #{format.inspect}"
+      end
+    end
   end
 end
@@ -13,26 +13,32 @@ module TreeSitter
 
     # Iterator over matches.
     #
+    # Text predicates are evaluated natively by {QueryCursor#next_match}, so
+    # only the matches satisfying them are yielded.
+    #
     # @yieldparam match [TreeSitter::QueryMatch]
     def each(&)
       return enum_for __method__ if !block_given?
 
-      while match = @cursor.next_match
-        if match.satisfies_text_predicate?(@query, @src)
-          yield match
-        end
+      while match = @cursor.next_match(@src)
+        yield match
       end
     end
 
     # Iterate over all the results presented as hashes of `capture name => node`.
     #
-    # @yieldparam match [Hash<String, TreeSitter::Node>]
-    def each_capture_hash(&)
-      # TODO: should we return [Array<Hash<Symbol, TreeSitter::Node]>>] instead?
-      return enum_for __method__ if !block_given?
+    # The hashes are built natively from the matches, and keyed by the
+    # capture names interned in {Query#capture_names}.
+    #
+    # @param symbolize [Boolean] use Symbols instead of Strings as keys.
+    #
+    # @yieldparam match [Hash<String, TreeSitter::Node>, Hash<Symbol, TreeSitter::Node>]
+    def each_capture_hash(symbolize: false, &)
+      return enum_for(__method__, symbolize:) if !block_given?
 
-      each do |match|
-        yield match.captures.to_h { |cap| [@query.capture_name_for_id(cap.index), cap.node] }
+      names = symbolize ? @query.capture_symbols : @query.capture_names
+      while (hash = @cursor.next_capture_hash(@src, names))
+        yield hash
       end
     end
   end
@@ -0,0 +1,84 @@
+# frozen_string_literal: true
+
+module TreeSitter
+  # The cost of the patterns of a {Query}, as measured by {Query#profile}.
+  #
+  # tree-sitter doesn't expose its in-progress matches, so the time it spends
+  # looking for matches can't be attributed to patterns; it's only part of
+  # {#elapsed}. What is attributed is what happens to the matches it finds.
+  class QueryProfile
+    # The profile of a pattern.
+    #
+    # - `index`: the index of the pattern.
+    # - `start_byte`: where the pattern starts in the source of the query.
+    # - `matches`: the matches found by tree-sitter, before predicates.
+    # - `accepted`: the matches satisfying the predicates.
+    # - `text_rejected`: the matches rejected by text predicates, `#eq?`,
+    #   `#match?`, ….
+    # - `property_rejected`: the matches rejected by `#is?` and `#is-not?`.
+    # - `predicate_ns`: the nanoseconds spent checking predicates natively.
+    # - `ruby_ns`: the nanoseconds spent in the block given to
+    #   {Query#profile}.
+    Pattern = Struct.new(
+      :index, :start_byte, :matches, :accepted, :text_rejected, :property_rejected, :predicate_ns, :ruby_ns,
+    ) do
+      # @return [Integer] the nanoseconds attributed to the pattern.
+      def total_ns = predicate_ns + ruby_ns
+
+      # @return [Float] the share of matches rejected by predicates.
+      def rejection_rate = matches.zero? ? 0.0 : (text_rejected + property_rejected).fdiv(matches)
+    end
+
+    # @return [Query]
+    attr_reader :query
+
+    # @return [Array<Pattern>] the profile of every pattern, by index.
+    attr_reader :patterns
+
+    # @return [Integer] the nanoseconds the whole profile took.
+    attr_reader :elapsed
+
+    # @param query [Query]
+    # @param counters [Array<Integer>] the counters of {QueryCursor#profile}.
+    # @param ruby_ns [Array<Integer>] the nanoseconds spent in ruby, by pattern.
+    # @param elapsed [Integer]
+    def initialize(query, counters, ruby_ns, elapsed)
+      @query = query
+      @elapsed = elapsed
+      @patterns =
+        counters.each_slice(QueryCursor::PROFILE_FIELDS.size).with_index.map do |fields, i|
+          Pattern.new(i, query.start_byte_for_pattern(i), *fields, ruby_ns[i])
+        end.freeze
+    end
+
+    # @param count [Integer]
+    #
+    # @return [Array<Pattern>] the `count` most expensive patterns, first
+    #   by time, then by matches.
+    def slowest(count = 10)
+      @patterns.max_by(count) { |p| [p.total_ns, p.matches] }
+    end
+
+    # @return [Integer] the matches found for all the patterns.
+    def matches = @patterns.sum(&:matches)
+
+    # A table of the most expensive patterns.
+    #
+    # @param count [Integer] how many patterns to show.
+    #
+    # @return [String]
+    def report(count = 10)
+      lines = [format('%7s %9s %9s %9s %9s %12s %12s', 'pattern', 'byte', 'matches', 'accepted', 'rejected', 'native µs', 'ruby µs')]
+      slowest(count).each do |p|
+        lines << format(
+          '%7d %9d %9d %9d %9d %12.1f %12.1f',
+          p.index, p.start_byte, p.matches, p.accepted, p.text_rejected + p.property_rejected,
+          p.predicate_ns / 1e3, p.ruby_ns / 1e3,
+        )
+      end
+      lines << format('%d matches in %.1f ms', matches, @elapsed / 1e6)
+      lines.join("\n")
+    end
+    alias to_s report
+  end
+end
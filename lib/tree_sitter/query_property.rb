@@ -0,0 +1,11 @@
+# frozen_string_literal: true
+
+module TreeSitter
+  # A property of a {Query} pattern, set by `#set!` or checked by `#is?` and
+  # `#is-not?`.
+  #
+  # - `key`: the name of the property.
+  # - `value`: its value, `nil` when missing.
+  # - `capture_id`: the capture it's about, `nil` for the whole pattern.
+  QueryProperty = Struct.new(:key, :value, :capture_id)
+end
@@ -0,0 +1,112 @@
+# frozen_string_literal: true
+
+module TreeSitter
+  # Many independent queries, run in a single pass over a tree.
+  #
+  # The sources of the queries are concatenated and compiled into a single
+  # {Query}; each pattern is then attributed back to the query, or *rule*, it
+  # came from using {Query#start_byte_for_pattern}.
+  #
+  # Captures and predicates are per pattern, so each rule keeps its own.
+  #
+  # @example
+  #   rules = TreeSitter::QuerySet.new(ruby, {
+  #     no_puts: '((call method: (identifier) @m) (#eq? @m "puts"))',
+  #     no_eval: '((call method: (identifier) @m) (#eq? @m "eval"))',
+  #   })
+  #   rules.each_match(tree.root_node, src) do |match|
+  #     warn "#{match.rule}: #{match.captures['m'].start_point}"
+  #   end
+  class QuerySet
+    # A match of one of the rules.
+    #
+    # - `rule`: the name of the rule.
+    # - `pattern_index`: the index of the pattern in the rule's own source.
+    # - `captures`: a hash of `capture name => node`.
+    Match = Struct.new(:rule, :pattern_index, :captures)
+
+    # @return [Query] the combined query.
+    attr_reader :query
+
+    # @return [Array] the names of the rules, in order.
+    attr_reader :rules
+
+    # @param language [Language]
+    # @param queries [Hash<Object, String>, Array<String>] the sources of the
+    #   rules, by name; the names of an Array are their indices.
+    #
+    # @raise [QueryCreationError] naming the offending rule if one of the
+    #   queries is invalid.
+    def initialize(language, queries)
+      queries = queries.each_with_index.to_h { |q, i| [i, q] } if queries.is_a?(Array)
+      @rules = queries.keys.freeze
+
+      source = +''
+      starts = []
+      queries.each_value do |q|
+        starts << source.bytesize
+        source << q << "\n"
+      end
+
+      @query = compile(language, queries, source)
+
+      # The rule of each pattern, and the index of the first pattern of each rule.
+      @pattern_rules = Array.new(@query.pattern_count)
+      @pattern_offsets = Array.new(@query.pattern_count)
+      first_patterns = {}
+      @query.pattern_count.times do |i|
+        rule_index = starts.bsearch_index { |s| s > @query.start_byte_for_pattern(i) }&.pred || (starts.size - 1)
+        rule = @rules[rule_index]
+        first_patterns[rule] ||= i
+        @pattern_rules[i] = rule
+        @pattern_offsets[i] = i - first_patterns[rule]
+      end
+    end
+
+    # Iterate over the matches of all the rules, in a single pass over `node`.
+    #
+    # @param node [Node]
+    # @param src [String] the source of the tree, for text predicates.
+    #
+    # @yieldparam match [Match]
+    def each_match(node, src)
+      return enum_for(__method__, node, src) if !block_given?
+
+      names = @query.capture_names
+      QueryCursor.with do |cursor|
+        cursor.exec(@query, node)
+        while (captures = cursor.next_capture_hash(src, names))
+          i = cursor.pattern_index
+          yield Match.new(@pattern_rules[i], @pattern_offsets[i], captures)
+        end
+      end
+    end
+
+    # Run all the rules over `node`.
+    #
+    # @param node [Node]
+    # @param src [String] the source of the tree, for text predicates.
+    #
+    # @return [Hash<Object, Array<Hash<String, Node>>>] the captures of every
+    #   match, by rule; rules without matches are included.
+    def matches(node, src)
+      res = @rules.to_h { |r| [r, []] }
+      each_match(node, src) { |m| res[m.rule] << m.captures }
+      res
+    end
+
+    private
+
+    def compile(language, queries, source)
+      Query.new(language, source)
+    rescue QueryCreationError, ArgumentError
+      # Find out which rule is to blame; this is the slow path.
+      queries.each do |name, q|
+        Query.new(language, q)
+      rescue QueryCreationError, ArgumentError => e
+        raise e.class, "Rule #{name.inspect}: #{e.message}"
+      end
+      raise
+    end
+  end
+end
@@ -0,0 +1,45 @@
+# frozen_string_literal: true
+
+module TreeSitter
+  # Code navigation tags from a `tags.scm` query, evaluated natively.
+  #
+  # @example
+  #   tagger = TreeSitter::Tagger.new(ruby, File.read('queries/tags.scm'))
+  #   tagger.tags(tree.root_node, src).each do |tag|
+  #     puts "#{tag.kind} #{src.byteslice(tag.name_range)} L#{tag.row + 1}"
+  #   end
+  class Tagger
+    # The fields of every tag exported by {#tags_packed}, in order.
+    FIELDS = %i[kind definition name_start name_end start_byte end_byte row].freeze
+
+    # A tag.
+    #
+    # - `kind`: the kind of the tag, e.g. `function`.
+    # - `definition`: whether it's a definition, or a reference.
+    # - `name_range`: the byte range of its name.
+    # - `range`: the byte range of its node.
+    # - `row`: the row of its name.
+    # - `docs`: the documentation of a definition, or `nil`.
+    Tag = Struct.new(:kind, :definition, :name_range, :range, :row, :docs) do
+      alias_method :definition?, :definition
+    end
+
+    # Tag `node`.
+    #
+    # @see #tags_packed
+    #
+    # @param node [Node]
+    # @param src [String] the source of the tree.
+    #
+    # @return [Array<Tag>]
+    def tags(node, src)
+      docs = []
+      tags_packed(node, src, docs)
+        .each_slice(FIELDS.size)
+        .with_index
+        .map do |(kind, definition, name_start, name_end, start_byte, end_byte, row), i|
+          Tag.new(kinds[kind], definition == 1, name_start...name_end, start_byte...end_byte, row, docs[i])
+        end
+    end
+  end
+end
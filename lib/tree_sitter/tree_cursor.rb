@@ -0,0 +1,34 @@
+# frozen_string_literal: true
+
+module TreeSitter
+  # A stateful object for walking a syntax {Tree} efficiently.
+  class TreeCursor
+    # The pool of {with}.
+    POOL = CursorPool.new { |node| TreeCursor.new(node) }
+
+    # Run a block with a cursor on `node` taken from a per-thread pool,
+    # instead of creating a new cursor, so the native stack grown by previous
+    # walks is reused.
+    #
+    # The cursor is given back to the pool when the block returns, and must
+    # not escape it.
+    #
+    # @example
+    #   TreeSitter::TreeCursor.with(tree.root_node) do |cursor|
+    #     cursor.walk { |view| … }
+    #   end
+    #
+    # @param node [Node]
+    #
+    # @yieldparam cursor [TreeCursor]
+    #
+    # @return [Object] the value of the block.
+    def self.with(node)
+      cursor = POOL.checkout(node)
+      cursor.reset(node)
+      yield cursor
+    ensure
+      POOL.checkin(cursor) if cursor
+    end
+  end
+end
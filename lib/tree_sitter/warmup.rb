@@ -0,0 +1,102 @@
+# frozen_string_literal: true
+
+module TreeSitter
+  @after_fork = []
+
+  class << self
+    # Load languages and compile queries ahead of time, e.g. in the master
+    # process of a preforking server, so workers inherit them copy-on-write
+    # instead of each loading and compiling their own.
+    #
+    # Languages are kept by {TreeSitter.language_registry}, with their
+    # {Language#symbol_names} and {Language#field_names}, and queries by
+    # {TreeSitter.query_cache}, with their predicates processed and their
+    # capture names interned.
+    #
+    # @example config/puma.rb
+    #   before_fork do
+    #     TreeSitter.warmup(
+    #       languages: %w[ruby javascript],
+    #       queries: { 'ruby' => [File.read('queries/ruby/highlights.scm')] },
+    #     )
+    #     Process.warmup if Process.respond_to?(:warmup)
+    #   end
+    #
+    # @param languages [Array<String>] the languages to load.
+    # @param queries [Hash<String, String|Array<String>>] the sources of the
+    #   queries to compile, by language name; their languages are loaded too.
+    #
+    # @raise [ParserNotFoundError] if a language was not found.
+    # @raise [QueryCreationError] if a query is invalid.
+    #
+    # @return [Hash<String, Array<Query>>] the compiled queries by language.
+    def warmup(languages: [], queries: {})
+      loaded = preload(*(languages | queries.keys))
+      loaded.each_value do |language|
+        language.symbol_names
+        language.field_names
+      end
+
+      queries.to_h do |name, sources|
+        compiled =
+          Array(sources).map do |source|
+            query_cache.fetch(loaded[name], source).tap do |query|
+              query.text_predicates
+              query.capture_symbols
+              query.non_local_patterns
+            end
+          end
+        [name, compiled]
+      end
+    end
+
+    # Run a block in every child process, right after it's forked, e.g. to
+    # reset per-process state. Hooks run in registration order.
+    #
+    # Locks of the process-wide caches are reset by hooks registered when the
+    # gem is loaded.
+    #
+    # @yield in the child process.
+    #
+    # @return [Proc] the block, to give to {remove_after_fork}.
+    def after_fork(&block)
+      raise ArgumentError, 'after_fork needs a block' if !block
+
+      @after_fork << block
+      block
+    end
+
+    # Unregister a hook registered by {after_fork}.
+    #
+    # @param hook [Proc] the block returned by {after_fork}.
+    #
+    # @return [Proc, nil] the hook, or nil if it wasn't registered.
+    def remove_after_fork(hook)
+      index = @after_fork.index { |h| h.equal?(hook) }
+      @after_fork.delete_at(index) if index
+    end
+
+    # Run the {after_fork} hooks; called automatically in forked children.
+    #
+    # @return [void]
+    def run_after_fork_hooks
+      @after_fork.each(&:call)
+    end
+  end
+
+  # Runs the {TreeSitter.after_fork} hooks in the children of `fork`,
+  # `Process.fork`, and `Process.daemon`.
+  module ForkHooks
+    # @return [Integer]
+    def _fork
+      pid = super
+      TreeSitter.run_after_fork_hooks if pid.zero?
+      pid
+    end
+  end
+
+  Process.singleton_class.prepend(ForkHooks)
+
+  after_fork { query_cache.after_fork }
+  after_fork { language_registry.after_fork }
+end
@@ -24,6 +24,8 @@ module TreeStand
   # Raised when performing a search on a tree where a return value is expected,
   # but no match is found.
   class NodeNotFound < Error; end
+  # Raised when a batch of edits contains overlapping edits.
+  class OverlappingEdits < Error; end
 
   class << self
     extend T::Sig
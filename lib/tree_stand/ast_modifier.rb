@@ -2,16 +2,42 @@
 # typed: true
 
 module TreeStand
-  # An experimental class to modify the AST. It re-runs the query on the
-  # modified document every loop to ensure that the match is still valid.
+  # An experimental class to modify the AST.
+  #
+  # {#rewrite} collects edits from a single pass of a query, and applies them
+  # all at once with {Tree#apply_edits!}: one new document, one incremental
+  # reparse. In fixpoint mode, the query is then run again, only over the
+  # ranges that changed, until no more edits are made.
+  #
+  # {#on_match} re-runs the query on the modified document after every edit,
+  # to ensure that the match is still valid.
+  #
+  # @example Double every number
+  #   TreeStand::AstModifier.new(tree).rewrite('(number) @n') do |ast, match|
+  #     node = match['n']
+  #     ast.replace(node, (node.text.to_i * 2).to_s)
+  #   end
+  #
   # @see TreeStand::Tree
   # @api experimental
   class AstModifier
     extend T::Sig
 
+    # An edit recorded by {#replace}, {#remove}, {#insert_before}, or
+    # {#insert_after}, in terms of the current document.
+    Edit = Struct.new(:start_byte, :end_byte, :replacement)
+
+    # The maximum number of passes of {#rewrite} in fixpoint mode.
+    DEFAULT_MAX_PASSES = 100
+
+    # @return [Array<Edit>] the edits recorded since the last {#apply!}.
+    sig { returns(T::Array[Edit]) }
+    attr_reader :edits
+
     sig { params(tree: TreeStand::Tree).void }
     def initialize(tree)
       @tree = tree
+      @edits = []
     end
 
     # @param query [String]
@@ -26,5 +52,148 @@ module TreeStand
         matches = @tree.query(query)
       end
     end
+
+    # Run `query` once, collecting the edits the block records for its
+    # matches, then apply them all at once.
+    #
+    # The tree is not modified while matching, so all the matches, and their
+    # nodes, stay valid; the block must record edits with {#replace},
+    # {#remove}, {#insert_before}, and {#insert_after}, rather than modify
+    # the tree.
+    #
+    # @param query [String]
+    # @param fixpoint [Boolean] keep running the query, only over the ranges
+    #   changed by the previous pass, until a pass makes no edits.
+    # @param max_passes [Integer] the maximum number of passes in fixpoint
+    #   mode.
+    #
+    # @yieldparam self [self]
+    # @yieldparam match [Hash<String, TreeStand::Node>]
+    #
+    # @raise [TreeStand::OverlappingEdits] if the edits of a pass overlap;
+    #   the edits of the previous passes were applied.
+    # @raise [TreeStand::Error] if the rewrite didn't converge in
+    #   `max_passes` passes, or if edits recorded outside of it weren't
+    #   applied yet.
+    #
+    # If the block raises, the edits of the current pass are forgotten.
+    #
+    # @return [Integer] the number of edits applied.
+    sig do
+      params(
+        query: String,
+        fixpoint: T::Boolean,
+        max_passes: Integer,
+        block: T.proc.params(ast: TreeStand::AstModifier, match: T::Hash[String, TreeStand::Node]).void,
+      ).returns(Integer)
+    end
+    def rewrite(query, fixpoint: false, max_passes: DEFAULT_MAX_PASSES, &block)
+      raise Error, "#{@edits.size} pending edits, apply! them before rewriting" if !@edits.empty?
+
+      ts_query = TreeSitter.query_cache.fetch(@tree.parser.ts_language, query)
+      ranges = nil
+      applied = 0
+      max_passes.times do
+        each_match(ts_query, ranges, &block)
+        return applied if @edits.empty?
+
+        applied += @edits.size
+        ranges = apply!
+        return applied if !fixpoint
+      end
+      raise Error, "Rewrite did not converge in #{max_passes} passes"
+    end
+
+    # Record the replacement of a node, or range, with `text`.
+    #
+    # @param target [TreeStand::Node, TreeStand::Range]
+    # @param text [String]
+    #
+    # @return [self]
+    sig { params(target: T.any(TreeStand::Node, TreeStand::Range), text: String).returns(T.self_type) }
+    def replace(target, text)
+      range = to_range(target)
+      record(range.start_byte, range.end_byte, text)
+    end
+
+    # Record the removal of a node, or range.
+    #
+    # @param target [TreeStand::Node, TreeStand::Range]
+    #
+    # @return [self]
+    sig { params(target: T.any(TreeStand::Node, TreeStand::Range)).returns(T.self_type) }
+    def remove(target) = replace(target, '')
+
+    # Record the insertion of `text` before a node, or range.
+    #
+    # @param target [TreeStand::Node, TreeStand::Range]
+    # @param text [String]
+    #
+    # @return [self]
+    sig { params(target: T.any(TreeStand::Node, TreeStand::Range), text: String).returns(T.self_type) }
+    def insert_before(target, text)
+      start_byte = to_range(target).start_byte
+      record(start_byte, start_byte, text)
+    end
+
+    # Record the insertion of `text` after a node, or range.
+    #
+    # @param target [TreeStand::Node, TreeStand::Range]
+    # @param text [String]
+    #
+    # @return [self]
+    sig { params(target: T.any(TreeStand::Node, TreeStand::Range), text: String).returns(T.self_type) }
+    def insert_after(target, text)
+      end_byte = to_range(target).end_byte
+      record(end_byte, end_byte, text)
+    end
+
+    # Apply the recorded edits with {Tree#apply_edits!}, and forget them.
+    #
+    # @raise [TreeStand::OverlappingEdits] if two edits overlap; the edits are
+    #   forgotten and nothing is applied.
+    #
+    # @return [Array<::Range>] the byte ranges of the new document that were
+    #   replaced, or whose syntactic structure changed.
+    sig { returns(T::Array[T::Range[Integer]]) }
+    def apply!
+      edits = @edits.map(&:to_a)
+      @edits = []
+      @tree.apply_edits!(edits)
+    end
+
+    private
+
+    # Forgets the edits of the pass if it doesn't complete, so that a later
+    # {#apply!} or {#rewrite} doesn't apply half a pass.
+    def each_match(ts_query, ranges)
+      completed = false
+      names = ts_query.capture_names
+      TreeSitter::QueryCursor.with do |cursor|
+        root = @tree.ts_tree.root_node
+        matches =
+          if ranges
+            cursor.exec_in_ranges(ts_query, root, ranges, @tree.document)
+          else
+            cursor.matches(ts_query, root, @tree.document)
+          end
+        matches.each do |match|
+          captures = match.captures.to_h { |c| [names[c.index], TreeStand::Node.new(@tree, c.node)] }
+          yield self, captures
+        end
+      end
+      completed = true
+    ensure
+      @edits = [] if !completed
+    end
+
+    def to_range(target)
+      target.is_a?(TreeStand::Node) ? target.range : target
+    end
+
+    def record(start_byte, end_byte, text)
+      @edits << Edit.new(start_byte, end_byte, text)
+      self
+    end
   end
 end
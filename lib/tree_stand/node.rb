@@ -97,19 +97,53 @@ module TreeStand
     #   tree.root_node.query(<<~QUERY)
     #     (identifier) @identifier
     #   QUERY
-    sig { params(query_string: String).returns(T::Array[T::Hash[String, TreeStand::Node]]) }
-    def query(query_string)
-      ts_query = TreeSitter::Query.new(@tree.parser.ts_language, query_string)
-      TreeSitter::QueryCursor
-        .new
-        .matches(ts_query, @tree.ts_tree.root_node, @tree.document)
-        .each_capture_hash
-        .map { |h| h.transform_values! { |n| TreeStand::Node.new(@tree, n) } }
+    #
+    # Compiled queries are kept in {TreeSitter.query_cache}, so running the
+    # same query over many documents only compiles it once.
+    #
+    # @param limit [Integer, nil] stop after this many matches.
+    #
+    # @see #query_each
+    sig do
+      params(query_string: String, limit: T.nilable(Integer))
+        .returns(T::Array[T::Hash[String, TreeStand::Node]])
+    end
+    def query(query_string, limit: nil)
+      enum = query_each(query_string)
+      limit ? enum.take(limit) : enum.to_a
+    end
+
+    # Like {#query}, but pulls the matches from the cursor on demand, so
+    # stopping early, e.g. with `first` or `break`, doesn't pay for the rest
+    # of the matches.
+    #
+    # @example Does the document call `eval`?
+    #   tree.query_each('((identifier) @id (#eq? @id "eval"))').any?
+    #
+    # @yieldparam match [Hash<String, TreeStand::Node>]
+    # @return [Enumerator<Hash<String, TreeStand::Node>>] when no block is given.
+    sig do
+      params(
+        query_string: String,
+        block: T.nilable(T.proc.params(match: T::Hash[String, TreeStand::Node]).void),
+      ).returns(T.untyped)
+    end
+    def query_each(query_string, &block)
+      return enum_for(__method__, query_string) if !block
+
+      ts_query = TreeSitter.query_cache.fetch(@tree.parser.ts_language, query_string)
+      TreeSitter::QueryCursor.with do |cursor|
+        cursor
+          .matches(ts_query, @tree.ts_tree.root_node, @tree.document)
+          .each_capture_hash { |h| yield h.transform_values! { |n| TreeStand::Node.new(@tree, n) } }
+      end
     end
 
     # Returns the first captured node that matches the query string or nil if
     # there was no captured node.
     #
+    # The query stops at the first match with a capture.
+    #
     # @example Find the first identifier node.
     #   identifier_node = tree.root_node.find_node("(identifier) @identifier")
     #
@@ -117,7 +151,11 @@ module TreeStand
     # @see #query
     sig { params(query_string: String).returns(T.nilable(TreeStand::Node)) }
     def find_node(query_string)
-      query(query_string).first&.values&.first
+      query_each(query_string) do |h|
+        _, node = h.first
+        return node if node
+      end
+      nil
     end
 
     # Like {#find_node}, except that if no node is found, raises an
@@ -24,6 +24,10 @@ module TreeStand
   # be a convient property that could allow you to apply edits in a reverse order.
   # This is not always possible and depends on the edits you make, beware that
   # the tree will be different after each edit and this approach may cause bugs.
+  #
+  # {#apply_edits!} does that safely for a batch of edits collected from the
+  # same tree, e.g. by {TreeStand::AstModifier#rewrite}, with a single
+  # incremental reparse.
   class Tree
     extend T::Sig
     extend Forwardable
@@ -38,11 +42,16 @@ module TreeStand
     sig { returns(TreeStand::Parser) }
     attr_reader :parser
 
-    # @!method query(query_string)
+    # @!method query(query_string, limit: nil)
     #   (see TreeStand::Node#query)
     #   @note This is a convenience method that calls {TreeStand::Node#query} on
     #     {#root_node}.
     #
+    # @!method query_each(query_string, &block)
+    #   (see TreeStand::Node#query_each)
+    #   @note This is a convenience method that calls {TreeStand::Node#query_each} on
+    #     {#root_node}.
+    #
     # @!method find_node(query_string)
     #   (see TreeStand::Node#find_node)
     #   @note This is a convenience method that calls {TreeStand::Node#find_node} on
@@ -69,6 +78,7 @@ module TreeStand
     def_delegators(
       :root_node,
       :query,
+      :query_each,
       :find_node,
       :find_node!,
       :walk,
@@ -112,8 +122,107 @@ module TreeStand
       replace_with_new_doc(new_document)
     end
 
+    # Apply many edits at once, expressed in terms of the current document:
+    # the document is rebuilt in a single pass, the edits are reported to the
+    # tree from the last to the first, and the document is reparsed once,
+    # incrementally.
+    #
+    # Edits are applied in document order; insertions at the same offset, i.e.
+    # empty ranges, keep the order they were given in.
+    #
+    # @param edits [Array<Array(Integer, Integer, String)>] `[start_byte,
+    #   end_byte, replacement]` triples, in any order.
+    #
+    # @raise [TreeStand::OverlappingEdits] if two edits overlap, or an edit is
+    #   out of the document; nothing is applied then.
+    #
+    # @return [Array<::Range>] the byte ranges of the new document that were
+    #   replaced, or whose syntactic structure changed, sorted and merged.
+    sig { params(edits: T::Array[[Integer, Integer, String]]).returns(T::Array[T::Range[Integer]]) }
+    def apply_edits!(edits)
+      sorted = sort_edits(edits)
+      return [] if sorted.empty?
+
+      new_document = String.new(capacity: @document.bytesize, encoding: @document.encoding)
+      spans = []
+      offset = 0
+      sorted.each do |start_byte, end_byte, replacement|
+        new_document << @document.byteslice(offset...start_byte) << replacement
+        spans << ((new_document.bytesize - replacement.bytesize)...new_document.bytesize)
+        offset = end_byte
+      end
+      new_document << @document.byteslice(offset..)
+
+      old_tree = @ts_tree.copy
+      lines = line_starts(@document)
+      sorted.reverse_each { |edit| old_tree.edit(input_edit(lines, *edit)) }
+
+      new_tree = @parser.ts_parser.parse_string(old_tree, new_document)
+      changed = TreeSitter::Tree.changed_ranges(old_tree, new_tree).map { |r| r.start_byte...r.end_byte }
+      @document = new_document
+      @ts_tree = new_tree
+
+      merge_ranges(spans + changed)
+    end
+
     private
 
+    def sort_edits(edits)
+      sorted = edits.each_with_index.sort_by { |(start_byte, end_byte, _), i| [start_byte, end_byte, i] }.map(&:first)
+      sorted.each_cons(2) do |(_, prev_end, _), (start_byte, _, _)|
+        raise OverlappingEdits, "Edit at byte #{start_byte} overlaps the edit ending at #{prev_end}" if start_byte < prev_end
+      end
+      sorted.each do |start_byte, end_byte, _|
+        if start_byte.negative? || end_byte < start_byte || end_byte > @document.bytesize
+          raise OverlappingEdits, "Edit #{start_byte}...#{end_byte} is out of the document"
+        end
+      end
+      sorted
+    end
+
+    def line_starts(document)
+      res = [0]
+      while (i = document.byteindex("\n", res.last))
+        res << (i + 1)
+      end
+      res
+    end
+
+    def point(line_starts, byte)
+      row = (line_starts.bsearch_index { |start| start > byte } || line_starts.size) - 1
+      TreeSitter::Point.new.tap do |point|
+        point.row = row
+        point.column = byte - line_starts[row]
+      end
+    end
+
+    def input_edit(line_starts, start_byte, end_byte, replacement)
+      start_point = point(line_starts, start_byte)
+      last_newline = replacement.b.rindex("\n")
+      TreeSitter::InputEdit.new.tap do |edit|
+        edit.start_byte = start_byte
+        edit.old_end_byte = end_byte
+        edit.new_end_byte = start_byte + replacement.bytesize
+        edit.start_point = start_point
+        edit.old_end_point = point(line_starts, end_byte)
+        edit.new_end_point =
+          TreeSitter::Point.new.tap do |point|
+            point.row = start_point.row + replacement.count("\n")
+            point.column = last_newline ? replacement.bytesize - last_newline - 1 : start_point.column + replacement.bytesize
+          end
+      end
+    end
+
+    def merge_ranges(ranges)
+      ranges.sort_by { |r| [r.begin, r.end] }.each_with_object([]) do |range, res|
+        if res.empty? || range.begin > res.last.end
+          res << range
+        elsif range.end > res.last.end
+          res[-1] = res.last.begin...range.end
+        end
+      end
+    end
+
     def replace_with_new_doc(new_document)
       @document = new_document
       new_tree = @parser.parse_string(@document, tree: self)
@@ -14,6 +14,16 @@ module TreeStand
   # You can also define default hooks by implementing an {on} or {around}
   # method to call when visiting each node.
   #
+  # The hooks of a visitor class are compiled, once per language, into
+  # dispatch tables indexed by symbol id, and the tree is walked natively by
+  # {TreeSitter::Node#dispatch}: nodes without hooks never reach ruby. Hooks
+  # defined on a single visitor object are looked up at every {visit}.
+  #
+  # The tables are recompiled when a hook is defined on a visitor class, or
+  # when a module is included in or prepended to it or its superclasses; a
+  # hook added to a module that was already included is only seen once the
+  # tables are recompiled.
+  #
   # @example Create a visitor counting certain nodes
   #   class CountingVisitor < TreeStand::Visitor
   #     attr_reader :count
@@ -63,6 +73,66 @@ module TreeStand
   class Visitor
     extend T::Sig
 
+    class << self
+      extend T::Sig
+
+      # The `on_*` and `around_*` hooks of the class, indexed by symbol id.
+      #
+      # @see TreeSitter::Node#dispatch
+      #
+      # @return [Array(Array<Symbol, nil>, Array<Symbol, nil>)] the on and
+      #   around tables.
+      sig { params(language: TreeSitter::Language).returns(T::Array[T::Array[T.nilable(Symbol)]]) }
+      def dispatch_tables(language)
+        # Keyed on the ancestors too, for the hooks of modules included later.
+        ancestors = self.ancestors
+        cached = Visitor.dispatch_table_cache[[self, language]]
+        return cached.last if cached&.first == ancestors
+
+        tables = Visitor.compile_dispatch_tables(self, language)
+        Visitor.dispatch_table_cache[[self, language]] = [ancestors, tables]
+        tables
+      end
+
+      # @api private
+      sig do
+        params(klass: Module, language: TreeSitter::Language)
+          .returns(T::Array[T::Array[T.nilable(Symbol)]])
+      end
+      def compile_dispatch_tables(klass, language)
+        # The last entry is for the symbols past the grammar's, i.e. errors.
+        names = language.symbol_names + [:ERROR]
+        default_on = klass.instance_method(:on).owner == Visitor ? nil : :on
+        default_around = klass.instance_method(:around).owner == Visitor ? nil : :around
+        on = names.map { |name| hook(klass, :"on_#{name}") || default_on }
+        around = names.map { |name| hook(klass, :"around_#{name}") || default_around }
+        [on.freeze, around.freeze].freeze
+      end
+
+      protected
+
+      # The ancestors and dispatch tables by visitor class and language.
+      def dispatch_table_cache = @dispatch_table_cache ||= {}
+
+      private
+
+      # Hooks added after their class was compiled invalidate the tables.
+      def method_added(name)
+        super
+        return if !hook_name?(name)
+
+        Visitor.dispatch_table_cache.clear
+      end
+
+      def hook_name?(name)
+        name == :on || name == :around || name.start_with?('on_', 'around_')
+      end
+
+      def hook(klass, name)
+        klass.public_method_defined?(name) ? name : nil
+      end
+    end
+
     sig { params(node: TreeStand::Node).void }
     def initialize(node)
       @node = node
@@ -107,20 +177,16 @@ module TreeStand
     private
 
     def visit_node(node)
-      if respond_to?("on_#{node.type}")
-        public_send("on_#{node.type}", node)
-      else
-        on(node)
-      end
+      tree = node.tree
+      on, around = dispatch_tables(tree.parser.ts_language)
+      node.ts_node.dispatch(self, on, around, ->(ts_node) { TreeStand::Node.new(tree, ts_node) })
+    end
 
-      if respond_to?("around_#{node.type}")
-        public_send("around_#{node.type}", node) do
-          node.each { |child| visit_node(child) }
-        end
+    def dispatch_tables(language)
+      if singleton_methods.empty?
+        self.class.dispatch_tables(language)
       else
-        around(node) do
-          node.each { |child| visit_node(child) }
-        end
+        Visitor.compile_dispatch_tables(singleton_class, language)
       end
     end
   end
@@ -1,6 +1,59 @@
 # typed: true
 
 module TreeSitter
+  sig { returns(T::Hash[Symbol, Integer]) }
+  def self.memory_stats; end
+
+  sig { returns(TreeSitter::QueryCache) }
+  def self.query_cache; end
+
+  sig { returns(T::Hash[Symbol, Integer]) }
+  def self.stats; end
+
+  sig { returns(TreeSitter::LanguageRegistry) }
+  def self.language_registry; end
+
+  sig { params(names: String).returns(T::Hash[String, TreeSitter::Language]) }
+  def self.preload(*names); end
+
+  sig do
+    params(languages: T::Array[String], queries: T::Hash[String, T.any(String, T::Array[String])])
+      .returns(T::Hash[String, T::Array[TreeSitter::Query]])
+  end
+  def self.warmup(languages: [], queries: {}); end
+
+  sig { params(block: T.proc.void).returns(T.proc.void) }
+  def self.after_fork(&block); end
+
+  sig { params(hook: T.proc.void).returns(T.nilable(T.proc.void)) }
+  def self.remove_after_fork(hook); end
+
+  class LanguageRegistry
+    sig do
+      params(
+        name: String,
+        lib_dirs: T.nilable(T::Array[Pathname]),
+        blk: T.proc.returns([TreeSitter::Language, T.untyped]),
+      ).returns(TreeSitter::Language)
+    end
+    def fetch(name, lib_dirs = nil, &blk); end
+
+    sig { params(name: String, language: TreeSitter::Language).returns(TreeSitter::Language) }
+    def register(name, language); end
+
+    sig { params(name: String).returns(T::Boolean) }
+    def loaded?(name); end
+
+    sig { returns(T::Hash[String, T.untyped]) }
+    def paths; end
+
+    sig { void }
+    def clear; end
+
+    sig { returns(T::Hash[Symbol, Integer]) }
+    def stats; end
+  end
+
   class Node
     sig { returns(Integer) }
     def start_byte; end
@@ -16,6 +69,16 @@ module TreeSitter
 
     sig { returns(TreeSitter::Node) }
     def parent; end
+
+    sig do
+      params(
+        receiver: T.untyped,
+        on: T::Array[T.nilable(Symbol)],
+        around: T::Array[T.nilable(Symbol)],
+        wrap: T.nilable(T.proc.params(node: TreeSitter::Node).returns(T.untyped)),
+      ).void
+    end
+    def dispatch(receiver, on, around, wrap = nil); end
   end
 
   class Tree
@@ -29,19 +92,323 @@ module TreeSitter
 
     sig { params(id: Integer).returns(String) }
     def capture_name_for_id(id); end
+
+    sig { returns(T::Array[T::Array[Integer]]) }
+    def capture_quantifiers; end
+
+    sig { params(pattern_index: Integer).returns(T::Hash[String, T.nilable(String)]) }
+    def properties_for_pattern(pattern_index); end
+
+    sig { params(pattern_index: Integer).returns(T::Boolean) }
+    def pattern_rooted?(pattern_index); end
+
+    sig { params(pattern_index: Integer).returns(T::Boolean) }
+    def pattern_non_local?(pattern_index); end
+
+    sig do
+      params(trees: T::Array[TreeSitter::Tree], sources: T.nilable(T::Array[String]), threads: Integer)
+        .returns(T::Array[T::Array[Integer]])
+    end
+    def exec_many(trees, sources = nil, threads: 1); end
+
+    sig do
+      params(
+        trees: T.any(TreeSitter::Tree, TreeSitter::Node, T::Array[T.any(TreeSitter::Tree, TreeSitter::Node)]),
+        sources: T.nilable(T.any(String, T::Array[String])),
+        blk: T.nilable(T.proc.params(match: TreeSitter::QueryMatch).void),
+      ).returns(TreeSitter::QueryProfile)
+    end
+    def profile(trees, sources = nil, &blk); end
+  end
+
+  class Highlighter
+    sig do
+      params(
+        layers: T::Hash[String, TreeSitter::Injector::Layer],
+        highlighters: T.any(T::Hash[String, TreeSitter::Highlighter], T.proc.params(name: String).returns(T.nilable(TreeSitter::Highlighter))),
+      ).returns(T::Array[[TreeSitter::Highlighter, TreeSitter::Node, T::Array[TreeSitter::Range]]])
+    end
+    def self.injections(layers, highlighters); end
+
+    sig do
+      params(
+        language: TreeSitter::Language,
+        highlights: String,
+        locals: T.nilable(String),
+        names: T.nilable(T::Array[String]),
+      ).void
+    end
+    def initialize(language, highlights, locals: nil, names: nil); end
+
+    sig { returns(T::Array[String]) }
+    def names; end
+
+    sig do
+      params(
+        node: TreeSitter::Node,
+        source: String,
+        injections: T.nilable(T::Array[[TreeSitter::Highlighter, TreeSitter::Node, T::Array[TreeSitter::Range]]]),
+      ).returns(T::Array[Integer])
+    end
+    def events(node, source, injections = nil); end
+
+    sig do
+      params(
+        node: TreeSitter::Node,
+        source: String,
+        open: T::Array[String],
+        close: T.any(String, T::Array[String]),
+        escape: T::Boolean,
+        reopen: T::Boolean,
+        injections: T.nilable(T::Array[[TreeSitter::Highlighter, TreeSitter::Node, T::Array[TreeSitter::Range]]]),
+      ).returns(String)
+    end
+    def render(node, source, open, close, escape, reopen, injections = nil); end
+
+    sig do
+      params(
+        node: TreeSitter::Node,
+        src: String,
+        class_prefix: String,
+        injections: T.nilable(T::Array[[TreeSitter::Highlighter, TreeSitter::Node, T::Array[TreeSitter::Range]]]),
+      ).returns(String)
+    end
+    def html(node, src, class_prefix: '', injections: nil); end
+
+    sig do
+      params(
+        node: TreeSitter::Node,
+        src: String,
+        theme: T::Hash[String, String],
+        injections: T.nilable(T::Array[[TreeSitter::Highlighter, TreeSitter::Node, T::Array[TreeSitter::Range]]]),
+      ).returns(String)
+    end
+    def ansi(node, src, theme, injections: nil); end
+  end
+
+  class Injector
+    class Layer < Struct
+      sig { returns(String) }
+      def name; end
+
+      sig { returns(TreeSitter::Language) }
+      def language; end
+
+      sig { returns(T::Array[TreeSitter::Range]) }
+      def ranges; end
+
+      sig { returns(T.nilable(TreeSitter::Tree)) }
+      def tree; end
+
+      sig { params(edit: TreeSitter::InputEdit).void }
+      def edit(edit); end
+    end
+
+    sig do
+      params(
+        language: TreeSitter::Language,
+        injections: String,
+        languages: T.any(T::Hash[String, T.nilable(TreeSitter::Language)], T.proc.params(name: String).returns(T.nilable(TreeSitter::Language))),
+      ).void
+    end
+    def initialize(language, injections, languages:); end
+
+    sig { returns(TreeSitter::Query) }
+    def query; end
+
+    sig { params(node: TreeSitter::Node, src: String).returns(T::Hash[String, T::Array[TreeSitter::Range]]) }
+    def ranges(node, src); end
+
+    sig do
+      params(
+        tree: TreeSitter::Tree,
+        src: String,
+        previous: T.nilable(T::Hash[String, TreeSitter::Injector::Layer]),
+        threads: Integer,
+      ).returns(T::Hash[String, TreeSitter::Injector::Layer])
+    end
+    def parse(tree, src, previous = nil, threads: Etc.nprocessors); end
+  end
+
+  class Tagger
+    sig { params(language: TreeSitter::Language, source: String).void }
+    def initialize(language, source); end
+
+    sig { returns(T::Array[String]) }
+    def kinds; end
+
+    sig { params(node: TreeSitter::Node, src: String).returns(T::Array[TreeSitter::Tagger::Tag]) }
+    def tags(node, src); end
+
+    sig do
+      params(node: TreeSitter::Node, source: String, docs: T.nilable(T::Array[T.nilable(String)]))
+        .returns(T::Array[Integer])
+    end
+    def tags_packed(node, source, docs = nil); end
+  end
+
+  class QueryProfile
+    class Pattern < Struct
+      sig { returns(Integer) }
+      def index; end
+
+      sig { returns(Integer) }
+      def start_byte; end
+
+      sig { returns(Integer) }
+      def matches; end
+
+      sig { returns(Integer) }
+      def accepted; end
+
+      sig { returns(Integer) }
+      def text_rejected; end
+
+      sig { returns(Integer) }
+      def property_rejected; end
+
+      sig { returns(Integer) }
+      def predicate_ns; end
+
+      sig { returns(Integer) }
+      def ruby_ns; end
+
+      sig { returns(Integer) }
+      def total_ns; end
+
+      sig { returns(Float) }
+      def rejection_rate; end
+    end
+
+    sig { returns(TreeSitter::Query) }
+    def query; end
+
+    sig { returns(T::Array[TreeSitter::QueryProfile::Pattern]) }
+    def patterns; end
+
+    sig { returns(Integer) }
+    def elapsed; end
+
+    sig { returns(Integer) }
+    def matches; end
+
+    sig { params(count: Integer).returns(T::Array[TreeSitter::QueryProfile::Pattern]) }
+    def slowest(count = 10); end
+
+    sig { params(count: Integer).returns(String) }
+    def report(count = 10); end
+  end
+
+  class CursorPool
+    sig { params(args: T.untyped).returns(T.untyped) }
+    def checkout(*args); end
+
+    sig { params(cursor: T.untyped).void }
+    def checkin(cursor); end
+
+    sig { returns(Integer) }
+    def idle_size; end
+
+    sig { void }
+    def clear; end
   end
 
   class QueryCursor
-    sig { params(query: TreeSitter::Query, node: TreeSitter::Node).returns(TreeSitter::QueryCursor) }
-    def self.exec(query, node); end
+    sig do
+      type_parameters(:U)
+        .params(block: T.proc.params(cursor: TreeSitter::QueryCursor).returns(T.type_parameter(:U)))
+        .returns(T.type_parameter(:U))
+    end
+    def self.with(&block); end
+
+    sig { returns(TreeSitter::QueryCursor) }
+    def reset; end
+
+    sig { returns(T::Boolean) }
+    def profiling?; end
+
+    sig { params(profiling: T::Boolean).returns(T::Boolean) }
+    def profiling=(profiling); end
+
+    sig { returns(T.nilable(T::Array[Integer])) }
+    def profile; end
+
+    sig do
+      params(
+        query: TreeSitter::Query,
+        node: TreeSitter::Node,
+        timeout: T.nilable(Numeric),
+        byte_range: T.nilable(T::Range[Integer]),
+        point_range: T.nilable(T::Range[TreeSitter::Point]),
+      ).returns(TreeSitter::QueryCursor)
+    end
+    def self.exec(query, node, timeout: nil, byte_range: nil, point_range: nil); end
+
+    sig do
+      params(
+        query: TreeSitter::Query,
+        node: TreeSitter::Node,
+        timeout: T.nilable(Numeric),
+        byte_range: T.nilable(T::Range[Integer]),
+        point_range: T.nilable(T::Range[TreeSitter::Point]),
+      ).returns(TreeSitter::QueryCursor)
+    end
+    def exec(query, node, timeout: nil, byte_range: nil, point_range: nil); end
+
+    sig { returns(Symbol) }
+    def status; end
+
+    sig { returns(Integer) }
+    def byte_offset; end
+
+    sig do
+      params(
+        query: TreeSitter::Query,
+        node: TreeSitter::Node,
+        ranges: T::Array[T.any(T::Range[Integer], TreeSitter::Range)],
+        src: T.nilable(String),
+        blk: T.nilable(T.proc.params(match: TreeSitter::QueryMatch).void),
+      ).returns(T.untyped)
+    end
+    def exec_in_ranges(query, node, ranges, src = nil, &blk); end
 
-    sig { returns(T.nilable(TreeSitter::QueryMatch)) }
-    def next_match; end
+    sig { returns(T.nilable(T::Hash[T.untyped, T.untyped])) }
+    def properties; end
+
+    sig { params(properties: T.nilable(T::Hash[T.untyped, T.untyped])).returns(T.nilable(T::Hash[T.untyped, T.untyped])) }
+    def properties=(properties); end
+
+    sig { params(source: T.nilable(String)).returns(T.nilable(TreeSitter::QueryMatch)) }
+    def next_match(source = nil); end
+
+    sig do
+      params(source: T.nilable(String), names: T::Array[T.any(String, Symbol)])
+        .returns(T.nilable(T::Hash[T.any(String, Symbol), TreeSitter::Node]))
+    end
+    def next_capture_hash(source, names); end
+
+    sig { returns(T.nilable(Integer)) }
+    def pattern_index; end
+
+    sig do
+      params(query: TreeSitter::Query, node: TreeSitter::Node, source: T.nilable(String), opts: T.untyped)
+        .returns(T::Array[Integer])
+    end
+    def exec_packed(query, node, source, **opts); end
+
+    sig do
+      params(limit: Integer, source: T.nilable(String), string: T::Boolean)
+        .returns(T.nilable(T.any(String, T::Array[Integer])))
+    end
+    def next_packed(limit, source, string); end
   end
 
   class QueryMatch
     sig { returns(T::Array[TreeSitter::QueryCapture]) }
     def captures; end
+
+    sig { returns(T::Hash[String, T.nilable(String)]) }
+    def properties; end
   end
 
   class QueryCapture
@@ -63,12 +430,115 @@ module TreeSitter
   class Language
     sig { params(name: String, path: String).returns(TreeSitter::Language) }
     def self.load(name, path); end
+
+    sig { params(name: String).returns(T.nilable(TreeSitter::Language)) }
+    def self.linked(name); end
+
+    sig { returns(T::Array[Symbol]) }
+    def symbol_names; end
+
+    sig { returns(T::Array[T.nilable(Symbol)]) }
+    def field_names; end
+
+    sig { returns(T::Array[String]) }
+    def self.linked_names; end
+
+    sig { params(other: T.untyped).returns(T::Boolean) }
+    def eql?(other); end
+
+    sig { returns(Integer) }
+    def hash; end
   end
 
   class Parser
+    sig do
+      params(
+        old_tree: T.nilable(TreeSitter::Tree),
+        string: T.nilable(String),
+        max_memory: T.nilable(Integer),
+        stats: T::Boolean,
+      ).returns(T.nilable(TreeSitter::Tree))
+    end
+    def parse_string(old_tree, string, max_memory: nil, stats: false); end
+
+    sig { returns(T.nilable(Symbol)) }
+    def halt_reason; end
+
+    sig { returns(T.nilable(TreeSitter::ParseStats)) }
+    def stats; end
+  end
+
+  class ParseStats < Struct
+    sig { returns(Integer) }
+    def wall_ns; end
+
+    sig { returns(Integer) }
+    def cpu_ns; end
+
+    sig { returns(Integer) }
+    def bytes; end
+
+    sig { returns(Integer) }
+    def nodes; end
+
+    sig { returns(Integer) }
+    def errors; end
+
+    sig { returns(Integer) }
+    def missing; end
+
+    sig { returns(T.nilable(Float)) }
+    def reused; end
+
+    sig { returns(Float) }
+    def throughput; end
+
+    sig { returns(T::Boolean) }
+    def incremental?; end
   end
 
   class TreeCursor
+    sig do
+      type_parameters(:U)
+        .params(
+          node: TreeSitter::Node,
+          block: T.proc.params(cursor: TreeSitter::TreeCursor).returns(T.type_parameter(:U)),
+        )
+        .returns(T.type_parameter(:U))
+    end
+    def self.with(node, &block); end
+
+    sig { params(block: T.proc.params(view: TreeSitter::NodeView).void).returns(TreeSitter::TreeCursor) }
+    def walk(&block); end
+
+    sig { params(block: T.proc.params(view: TreeSitter::NodeView).void).returns(TreeSitter::TreeCursor) }
+    def each_step(&block); end
+  end
+
+  class NodeView
+    sig { returns(Symbol) }
+    def type; end
+
+    sig { returns(Integer) }
+    def start_byte; end
+
+    sig { returns(Integer) }
+    def end_byte; end
+
+    sig { returns(T.nilable(Symbol)) }
+    def field_name; end
+
+    sig { returns(Integer) }
+    def depth; end
+
+    sig { params(source: String).returns(String) }
+    def text(source); end
+
+    sig { void }
+    def skip_children!; end
+
+    sig { returns(TreeSitter::Node) }
+    def to_node; end
   end
 
   class Range
@@ -0,0 +1,120 @@
+# frozen_string_literal: true
+
+require_relative '../test_helper'
+
+ruby = TreeSitter.lang('ruby')
+parser = TreeSitter::Parser.new
+parser.language = ruby
+
+program = <<~RUBY
+  def mul(a)
+    a
+  end
+RUBY
+
+tree = parser.parse_string(nil, program)
+root = tree.root_node
+
+highlights = <<~QUERY
+  "def" @keyword
+  "end" @keyword
+  (method name: (identifier) @function)
+  (method_parameters (identifier) @variable.parameter)
+  (identifier) @variable
+QUERY
+
+locals = <<~QUERY
+  (method) @local.scope
+  (method_parameters (identifier) @local.definition)
+  (identifier) @local.reference
+QUERY
+
+describe 'highlighter' do
+  it 'must default to the names of the captures' do
+    highlighter = TreeSitter::Highlighter.new(ruby, highlights)
+    assert_equal %w[keyword function variable.parameter variable], highlighter.names
+    assert highlighter.names.frozen?
+  end
+
+  it 'must emit nested events covering the whole node' do
+    highlighter = TreeSitter::Highlighter.new(ruby, highlights, names: %w[keyword function variable])
+    events = highlighter.events(root, program).each_slice(3).to_a
+
+    sources = events.select { |type, _, _| type == TreeSitter::Highlighter::SOURCE }
+    assert_equal program, sources.map { |_, from, to| program.byteslice(from...to) }.join
+    starts = events.count { |type, _, _| type == TreeSitter::Highlighter::HIGHLIGHT_START }
+    assert_equal starts, events.count { |type, _, _| type == TreeSitter::Highlighter::HIGHLIGHT_END }
+    assert_equal 5, starts
+  end
+
+  it 'must render html with the first pattern winning' do
+    highlighter = TreeSitter::Highlighter.new(ruby, highlights, names: %w[keyword function variable])
+    expected = <<~HTML
+      <span class="hl-keyword">def</span> <span class="hl-function">mul</span>(<span class="hl-variable">a</span>)
+        <span class="hl-variable">a</span>
+      <span class="hl-keyword">end</span>
+    HTML
+    assert_equal expected, highlighter.html(root, program, class_prefix: 'hl-')
+  end
+
+  it 'must prefer captures with a higher priority' do
+    q = "#{highlights}((identifier) @constant (#set! priority 10))"
+    highlighter = TreeSitter::Highlighter.new(ruby, q, names: %w[keyword function variable constant])
+    assert_includes highlighter.html(root, program), '<span class="constant">mul</span>'
+  end
+
+  it 'must highlight references like their local definition' do
+    highlighter = TreeSitter::Highlighter.new(ruby, highlights, locals:, names: %w[keyword function variable variable.parameter])
+    html = highlighter.html(root, program)
+    assert_equal 2, html.scan('<span class="variable parameter">a</span>').size
+  end
+
+  it 'must render ansi, reopening the enclosing style' do
+    highlighter = TreeSitter::Highlighter.new(ruby, highlights, names: %w[keyword function variable])
+    ansi = highlighter.ansi(root, program, { 'keyword' => '1', 'function' => '34' })
+    assert ansi.start_with?("\e[1mdef\e[0m \e[34mmul\e[0m(a)")
+  end
+
+  it 'must escape html' do
+    src = "x = '<b>'\n"
+    highlighter = TreeSitter::Highlighter.new(ruby, '(string) @string')
+    assert_equal %(x = <span class="string">&#39;&lt;b&gt;&#39;</span>\n), highlighter.html(parser.parse_string(nil, src).root_node, src)
+  end
+
+  it 'must render with strings converted by #to_str' do
+    tag = Object.new
+    def tag.to_str = '<k>'
+    highlighter = TreeSitter::Highlighter.new(ruby, highlights, names: %w[keyword])
+    open = [tag]
+    rendered = highlighter.render(root, program, open, '</k>', false, false)
+    assert rendered.start_with?('<k>def</k>')
+    assert_same tag, open.first
+  end
+
+  it 'must nest the highlights of injected languages' do
+    math = TreeSitter.lang('math')
+    src = %(a = "1 + x"\nb = 'y'\n)
+    tree = parser.parse_string(nil, src)
+    injector = TreeSitter::Injector.new(ruby, <<~QUERY, languages: { 'math' => math })
+      ((string (string_content) @injection.content)
+       (#match? @injection.content "[+*]")
+       (#set! injection.language "math"))
+    QUERY
+    layers = injector.parse(tree, src)
+    highlighter = TreeSitter::Highlighter.new(ruby, '(string) @string', names: %w[string number variable])
+    injected = TreeSitter::Highlighter.new(math, "(number) @number\n(identifier) @variable.math\n(sum) @sum")
+    injections = TreeSitter::Highlighter.injections(layers, { 'math' => injected })
+
+    expected = <<~HTML
+      a = <span class="string">&quot;<span class="number">1</span> + <span class="variable">x</span>&quot;</span>
+      b = <span class="string">&#39;y&#39;</span>
+    HTML
+    assert_equal expected, highlighter.html(tree.root_node, src, injections:)
+    assert_empty TreeSitter::Highlighter.injections(layers, ->(_name) {})
+  end
+
+  it 'must not be initialized twice' do
+    highlighter = TreeSitter::Highlighter.new(ruby, highlights)
+    _ { highlighter.send(:initialize, ruby, highlights) }.must_raise RuntimeError
+  end
+end
@@ -0,0 +1,77 @@
+# frozen_string_literal: true
+
+require_relative '../test_helper'
+
+ruby = TreeSitter.lang('ruby')
+math = TreeSitter.lang('math')
+parser = TreeSitter::Parser.new
+parser.language = ruby
+
+program = <<~RUBY
+  a = "1 + x"
+  b = "2 * y"
+  c = 'plain'
+RUBY
+
+injections = <<~QUERY
+  ((string (string_content) @injection.content)
+   (#match? @injection.content "[+*]")
+   (#set! injection.language "math"))
+QUERY
+
+describe 'injector' do
+  before do
+    @tree = parser.parse_string(nil, program)
+    @injector = TreeSitter::Injector.new(ruby, injections, languages: { 'math' => math })
+  end
+
+  it 'must group the ranges of each language' do
+    ranges = @injector.ranges(@tree.root_node, program)
+    assert_equal %w[math], ranges.keys
+    assert_equal(%w[1\ +\ x 2\ *\ y], ranges['math'].map { |r| program.byteslice(r.start_byte...r.end_byte) })
+  end
+
+  it 'must parse all the ranges of a language as one tree' do
+    layers = @injector.parse(@tree, program)
+    layer = layers['math']
+    assert_equal math, layer.language
+    assert_equal 2, layer.tree.included_ranges.size
+    refute layer.tree.root_node.has_error?
+  end
+
+  it 'must ignore unknown languages' do
+    injector = TreeSitter::Injector.new(ruby, injections, languages: ->(_name) {})
+    assert_empty injector.parse(@tree, program)
+  end
+
+  it 'must reparse edited layers' do
+    layers = @injector.parse(@tree, program)
+    edited = program.sub('1 + x', '1 + xy')
+    edit = TreeSitter::InputEdit.new
+    edit.start_byte = program.index('x')
+    edit.old_end_byte = edit.start_byte + 1
+    edit.new_end_byte = edit.start_byte + 2
+    edit.start_point = point(0, edit.start_byte)
+    edit.old_end_point = point(0, edit.old_end_byte)
+    edit.new_end_point = point(0, edit.new_end_byte)
+    @tree.edit(edit)
+    layers.each_value { |layer| layer.edit(edit) }
+
+    tree = parser.parse_string(@tree, edited)
+    layers = @injector.parse(tree, edited, layers)
+    ranges = layers['math'].ranges
+    assert_equal('1 + xy', edited.byteslice(ranges.first.start_byte...ranges.first.end_byte))
+    refute layers['math'].tree.root_node.has_error?
+  end
+
+  def point(row, column)
+    TreeSitter::Point.new.tap do |p|
+      p.row = row
+      p.column = column
+    end
+  end
+
+  it 'must reject invalid thread counts' do
+    assert_raises(ArgumentError) { @injector.parse(@tree, program, threads: 0) }
+  end
+end
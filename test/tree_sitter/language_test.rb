@@ -78,3 +78,50 @@ describe 'language' do
     assert ruby.version.between?(TreeSitter::MIN_COMPATIBLE_LANGUAGE_VERSION, TreeSitter::LANGUAGE_VERSION)
   end
 end
+
+describe 'language registry' do
+  it 'must load a library once' do
+    assert_same TreeSitter::Language.load('ruby', ruby_path), TreeSitter::Language.load('ruby', ruby_path.to_s)
+  end
+
+  it 'must return the same language on repeat lookups' do
+    before = TreeSitter.language_registry.stats
+    assert_same TreeSitter.lang('ruby'), TreeSitter.lang('ruby')
+    assert_operator TreeSitter.language_registry.stats[:hits], :>, before[:hits]
+    assert TreeSitter.language_registry.loaded?('ruby')
+    assert_match(/ruby/, TreeSitter.language_registry.paths['ruby'].to_s)
+  end
+
+  it 'must not cache failures' do
+    registry = TreeSitter::LanguageRegistry.new
+    assert_raises(TreeSitter::ParserNotFoundError) { registry.fetch('nope') { raise TreeSitter::ParserNotFoundError } }
+    refute registry.loaded?('nope')
+    assert_same ruby, registry.fetch('nope') { [ruby, ruby_path] }
+  end
+
+  it 'must prefer registered languages' do
+    registry = TreeSitter::LanguageRegistry.new
+    registry.register('custom', ruby)
+    assert_same(ruby, registry.fetch('custom') { flunk 'must not search' })
+    _ { registry.register('custom', 'ruby') }.must_raise TypeError
+  end
+
+  it 'must preload languages' do
+    assert_equal({ 'ruby' => ruby }, TreeSitter.preload('ruby'))
+  end
+end
+
+describe 'linked grammars' do
+  it 'must not find grammars that were not linked' do
+    assert_nil TreeSitter::Language.linked('rubyyyyyyyyyy')
+  end
+
+  it 'must prefer linked grammars' do
+    names = TreeSitter::Language.linked_names
+    assert_kind_of Array, names
+    names.each do |name|
+      assert_same TreeSitter::Language.linked(name), TreeSitter::Language.linked(name)
+      assert_same TreeSitter::Language.linked(name), TreeSitter.lang(name)
+    end
+  end
+end
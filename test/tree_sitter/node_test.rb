@@ -531,3 +531,50 @@ describe 'fetch' do
     end
   end
 end
+
+describe 'dispatch' do
+  before do
+    @names = ruby.symbol_names + [:ERROR]
+    @receiver = Object.new
+    @receiver.instance_variable_set(:@acc, [])
+    @receiver.define_singleton_method(:acc) { @acc }
+    @receiver.define_singleton_method(:record) { |node| @acc << node.type }
+    @receiver.define_singleton_method(:wrap) do |node, &block|
+      @acc << :"<#{node.type}"
+      block.call
+      @acc << :"#{node.type}>"
+    end
+  end
+
+  it 'must call on hooks of the types in the table' do
+    on = @names.map { |name| :record if name == :identifier }
+    root.dispatch(@receiver, on, [])
+    assert_equal %i[identifier] * 10, @receiver.acc
+  end
+
+  it 'must visit children only when around hooks yield' do
+    around = @names.map { |name| :wrap if %i[method_parameters assignment].include?(name) }
+    root.dispatch(@receiver, [], around)
+    assert_equal %i[<method_parameters method_parameters> <assignment assignment>], @receiver.acc
+
+    @receiver.acc.clear
+    @receiver.define_singleton_method(:skip) { |node| @acc << node.type }
+    on = @names.map { |name| :record if name == :identifier }
+    around = @names.map { |name| :skip if name == :method_parameters }
+    root.dispatch(@receiver, on, around)
+    assert_equal %i[identifier method_parameters] + %i[identifier] * 7, @receiver.acc
+  end
+
+  it 'must wrap nodes' do
+    on = @names.map { |name| :record if name == :method }
+    wrapped = []
+    root.dispatch(@receiver, on, [], ->(node) { wrapped << node; node })
+    assert_equal [root.child(0)], wrapped
+  end
+
+  it 'must propagate exceptions' do
+    @receiver.define_singleton_method(:boom) { |_node| raise 'boom' }
+    on = @names.map { |name| :boom if name == :identifier }
+    assert_raises(RuntimeError) { root.dispatch(@receiver, on, []) }
+  end
+end
@@ -101,6 +101,73 @@ describe 'parse_string_encoding' do
   end
 end
 
+describe 'max_memory' do
+  before do
+    parser.reset
+  end
+
+  it 'must halt parses allocating more than max_memory' do
+    res = parser.parse_string(nil, program * 1_000, max_memory: 1_024)
+    assert_nil res
+    assert_equal :max_memory, parser.halt_reason
+  end
+
+  it 'must parse within max_memory' do
+    res = parser.parse_string(nil, program, max_memory: 64 * 1_024 * 1_024)
+    assert_instance_of TreeSitter::Tree, res
+    assert_nil parser.halt_reason
+  end
+
+  it 'must reject non-positive budgets' do
+    _ { parser.parse_string(nil, program, max_memory: 0) }.must_raise ArgumentError
+  end
+end
+
+describe 'stats' do
+  before do
+    parser.reset
+  end
+
+  it 'must not collect stats by default' do
+    parser.parse_string(nil, program)
+    assert_nil parser.stats
+  end
+
+  it 'must collect the stats of a parse' do
+    tree = parser.parse_string(nil, program, stats: true)
+    stats = parser.stats
+    assert_equal program.bytesize, stats.bytes
+    assert_equal tree.root_node.descendant_count, stats.nodes
+    assert_operator stats.nodes, :>, 1
+    assert_equal 0, stats.errors
+    assert_equal 0, stats.missing
+    refute stats.incremental?
+    assert_operator stats.throughput, :>, 0
+  end
+
+  it 'must count errors' do
+    parser.parse_string(nil, "def mul(a, b)\n  a * \n", stats: true)
+    stats = parser.stats
+    assert_operator stats.errors + stats.missing, :>, 0
+  end
+
+  it 'must measure reuse of incremental parses' do
+    tree = parser.parse_string(nil, program)
+    parser.parse_string(tree, program, stats: true)
+    assert_in_delta 1.0, parser.stats.reused
+  end
+
+  it 'must count all the parses' do
+    before = TreeSitter.stats
+    parser.parse_string(nil, program)
+    after = TreeSitter.stats
+    assert_equal before[:parses] + 1, after[:parses]
+    assert_equal before[:bytes] + program.bytesize, after[:bytes]
+    assert_operator after[:nodes], :>, before[:nodes]
+    assert_operator after[:wall_ns], :>=, before[:wall_ns]
+  end
+end
+
 describe 'print_dot_graphs' do
   before do
     parser.reset
@@ -0,0 +1,47 @@
+# frozen_string_literal: true
+
+require_relative '../test_helper'
+
+ruby = TreeSitter.lang('ruby')
+math = TreeSitter.lang('math')
+
+describe 'query_cache' do
+  before do
+    @cache = TreeSitter::QueryCache.new(2)
+  end
+
+  it 'must compile a query once per language and source' do
+    q = @cache.fetch(ruby, '(identifier) @id')
+    assert_same q, @cache.fetch(TreeSitter.lang('ruby'), +'(identifier) @id')
+    refute_same q, @cache.fetch(math, '(identifier) @id')
+    assert_equal 1, @cache.stats[:hits]
+    assert_equal 2, @cache.stats[:misses]
+  end
+
+  it 'must evict the least recently used query' do
+    a = @cache.fetch(ruby, '(identifier) @a')
+    @cache.fetch(ruby, '(identifier) @b')
+    @cache.fetch(ruby, '(identifier) @a')
+    @cache.fetch(ruby, '(identifier) @c')
+
+    assert_equal 1, @cache.stats[:evictions]
+    assert_same a, @cache.fetch(ruby, '(identifier) @a')
+    assert_equal 2, @cache.size
+
+    @cache.capacity = 0
+    assert_equal 0, @cache.size
+  end
+
+  it 'must not cache invalid queries' do
+    _ { @cache.fetch(ruby, '(stupid query') }.must_raise TreeSitter::QueryCreationError
+    assert_equal 0, @cache.size
+  end
+
+  it 'must be shared by TreeStand' do
+    tree = TreeStand::Parser.new('math').parse_string('1 + x * 3')
+    query = '(number) @n'
+    before = TreeSitter.query_cache.stats[:hits]
+    2.times { tree.query(query) }
+    assert_operator TreeSitter.query_cache.stats[:hits], :>, before
+  end
+end
@@ -0,0 +1,58 @@
+# frozen_string_literal: true
+
+require_relative '../test_helper'
+
+ruby = TreeSitter.lang('ruby')
+parser = TreeSitter::Parser.new
+parser.language = ruby
+
+program = <<~RUBY
+  def mul(a, b)
+    res = a * b
+    puts res.inspect
+    return res
+  end
+RUBY
+
+tree = parser.parse_string(nil, program)
+root = tree.root_node
+
+rules = {
+  params: '(method_parameters (identifier) @param)',
+  puts: <<~QUERY,
+    ((call method: (identifier) @method) (#eq? @method "inspect"))
+    ((identifier) @puts (#eq? @puts "puts"))
+  QUERY
+  returns: '(return) @return',
+}
+
+describe 'query_set' do
+  it 'must dispatch matches to the rule they come from' do
+    set = TreeSitter::QuerySet.new(ruby, rules)
+    assert_equal rules.keys, set.rules
+    assert_equal 4, set.query.pattern_count
+
+    matches = set.matches(root, program)
+    assert_equal(%w[a b], matches[:params].map { |m| program.byteslice(m['param'].start_byte...m['param'].end_byte) })
+    assert_equal [%w[method], %w[puts]], matches[:puts].map(&:keys).sort
+    assert_equal 1, matches[:returns].size
+
+    pattern_indices = set.each_match(root, program).select { |m| m.rule == :puts }.map(&:pattern_index)
+    assert_equal [0, 1], pattern_indices.sort
+  end
+
+  it 'must give the same results as running each rule on its own' do
+    set = TreeSitter::QuerySet.new(ruby, rules.values)
+    rules.values.each_with_index do |source, i|
+      query = TreeSitter::Query.new(ruby, source)
+      expected = TreeSitter::QueryCursor.new.matches(query, root, program).each_capture_hash.to_a
+      assert_equal expected.size, set.matches(root, program)[i].size
+    end
+  end
+
+  it 'must name the invalid rule' do
+    err = _ { TreeSitter::QuerySet.new(ruby, { ok: '(identifier) @id', broken: '(stupid query' }) }
+      .must_raise TreeSitter::QueryCreationError
+    assert_match(/broken/, err.message)
+  end
+end
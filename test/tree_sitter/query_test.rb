@@ -96,6 +96,25 @@ describe 'pattern/capture/string' do
     query.disable_pattern(0)
     assert_equal 1, query.pattern_count
   end
+
+  it 'must return all the capture quantifiers at once' do
+    query = TreeSitter::Query.new(ruby, combined)
+    assert_equal [[TreeSitter::Quantifier::ZERO], [TreeSitter::Quantifier::ONE_OR_MORE]], query.capture_quantifiers
+    assert_same query.capture_quantifiers, query.capture_quantifiers
+  end
+
+  it 'must validate predicates on creation' do
+    err = _ { TreeSitter::Query.new(ruby, "(identifier)\n((identifier) @id (#eq? @id))") }.must_raise ArgumentError
+    assert_equal 'L1: Wrong number of arguments to #eq? predicate. Expected 2, got 1.', err.message
+    _ { TreeSitter::Query.new(ruby, '((identifier) @id (#match? @id @id))') }.must_raise ArgumentError
+    _ { TreeSitter::Query.new(ruby, '((identifier) @id (#any-of? @id @id))') }.must_raise ArgumentError
+  end
+
+  it 'must build predicate tables on first access' do
+    query = TreeSitter::Query.new(ruby, "#{pattern} #{predicate}")
+    assert_equal [0, 1], query.text_predicates.map(&:size)
+    assert_equal [[], []], query.general_predicates
+  end
   # TODO: pattern guaranteed at step
 end
 
@@ -130,6 +149,134 @@ describe 'query_cursor' do
     @cursor.remove_match(1)
     assert_nil @cursor.next_match
   end
+
+  it 'must report its status' do
+    assert_equal :running, @cursor.status
+    nil while @cursor.next_match
+    assert_equal :completed, @cursor.status
+
+    @cursor.exec(@query, root, timeout: 10)
+    refute_nil @cursor.next_capture
+    assert_equal :running, @cursor.status
+    _ { @cursor.exec(@query, root, timeout: 0) }.must_raise ArgumentError
+  end
+
+  it 'must work with byte and point ranges given to exec' do
+    child = root.child(0).child(0)
+    @cursor.exec(@query, root, byte_range: child.start_byte...child.end_byte)
+    assert_nil @cursor.next_capture
+    assert_equal :completed, @cursor.status
+
+    @cursor.exec(@query, root, byte_range: 0.., point_range: child.start_point..child.end_point)
+    assert_nil @cursor.next_capture
+    _ { @cursor.exec(@query, root, byte_range: 10...2) }.must_raise ArgumentError
+  end
+end
+
+describe 'windowed queries' do
+  src = <<~RUBY
+    # doc
+    def a(x) = x
+
+    def b(y, z) = y
+  RUBY
+  doc_tree = parser.parse_string(nil, src)
+  doc_root = doc_tree.root_node
+  method_b = src.index('def b')
+
+  it 'must tell rooted and non-local patterns apart' do
+    q = TreeSitter::Query.new(ruby, '(identifier) @id ((comment) @doc . (method) @m)')
+    assert q.pattern_rooted?(0)
+    refute q.pattern_non_local?(0)
+    refute q.pattern_rooted?(1)
+    assert q.pattern_non_local?(1)
+    assert_equal [1], q.non_local_patterns
+    _ { q.pattern_rooted?(2) }.must_raise IndexError
+  end
+
+  it 'must only find matches in the ranges' do
+    q = TreeSitter::Query.new(ruby, '(identifier) @id')
+    cursor = TreeSitter::QueryCursor.new
+    names = cursor.exec_in_ranges(q, doc_root, [method_b...src.size, method_b..method_b + 4])
+      .map { |m| m.captures.first.node }
+      .map { |n| src.byteslice(n.start_byte...n.end_byte) }
+    assert_equal %w[b y z y], names
+
+    # The cursor is left unrestricted.
+    assert_equal 7, cursor.matches(q, doc_root, src).count
+  end
+
+  it 'must widen ranges for non-local patterns only' do
+    q = TreeSitter::Query.new(ruby, '(identifier) @id ((comment) @doc . (method) @m)')
+    def_a = src.index('def a')
+    matches = TreeSitter::QueryCursor.new.exec_in_ranges(q, doc_root, [def_a...(def_a + 3)]).to_a
+
+    assert_equal [1], matches.map(&:pattern_index).uniq - [0]
+    assert(matches.select { |m| m.pattern_index.zero? }.all? { |m| m.captures.first.node.start_byte < def_a + 3 })
+  end
+
+  it 'must find sequences of any number of siblings' do
+    seq = "a = 1\nb = 2\nc = 3\n"
+    seq_root = parser.parse_string(nil, seq).root_node
+    q = TreeSitter::Query.new(ruby, '((assignment) @a . (assignment) @b . (assignment) @c)')
+    c = seq.index('c =')
+    matches = TreeSitter::QueryCursor.new.exec_in_ranges(q, seq_root, [c...(c + 1)]).to_a
+
+    assert_equal 1, matches.size
+    assert_equal %w[a b c], matches.first.captures.map { |cap| seq.byteslice(cap.node.start_byte, 1) }
+  end
+
+  it 'must drop non-local matches outside of the ranges' do
+    seq = "a = 1\nb = 2\nc = 3\nd = 4\n"
+    seq_root = parser.parse_string(nil, seq).root_node
+    q = TreeSitter::Query.new(ruby, '((assignment) @x . (assignment) @y)')
+    d = seq.index('d =')
+    matches = TreeSitter::QueryCursor.new.exec_in_ranges(q, seq_root, [d...(d + 1)]).to_a
+
+    assert_equal [%w[c d]], matches.map { |m| m.captures.map { |cap| seq.byteslice(cap.node.start_byte, 1) } }
+  end
+end
+
+describe 'packed matches' do
+  it 'must export the same captures as next_match' do
+    query = TreeSitter::Query.new(ruby, '(identifier) @id')
+    cursor = TreeSitter::QueryCursor.new
+    expected =
+      cursor.matches(query, root, program).flat_map do |m|
+        m.captures.flat_map { |c| [m.pattern_index, c.index, c.node.start_byte, c.node.end_byte, c.node.symbol] }
+      end
+
+    refute_empty expected
+    assert_equal expected, cursor.matches_packed(query, root, program)
+    assert_equal expected, cursor.matches_packed(query, root, program, format: :string).unpack('L*')
+  end
+
+  it 'must yield batches of at most limit matches' do
+    query = TreeSitter::Query.new(ruby, '((identifier) @id (#eq? @id "res"))')
+    cursor = TreeSitter::QueryCursor.exec(query, root)
+    batches = cursor.each_packed(limit: 2, source: program, format: :array).to_a
+    assert_equal [2, 1], batches.map { |b| b.size / TreeSitter::QueryCursor::PACKED_FIELDS.size }
+  end
+
+  it 'must run queries over many trees in parallel' do
+    sources = ['def a = b', program, 'x = y', program]
+    trees = sources.map { |src| parser.parse_string(nil, src) }
+    query = TreeSitter::Query.new(ruby, '((identifier) @id (#match? @id "^[a-r]"))')
+    cursor = TreeSitter::QueryCursor.new
+    expected = trees.zip(sources).map { |t, src| cursor.matches_packed(query, t.root_node, src) }
+
+    assert_equal expected, query.exec_many(trees, sources, threads: 3)
+    assert_equal [], query.exec_many([], threads: 2)
+    _ { query.exec_many(trees, threads: 0) }.must_raise ArgumentError
+  end
+
+  it 'must leave the source modifiable' do
+    query = TreeSitter::Query.new(ruby, '((identifier) @id (#eq? @id "res"))')
+    src = program.dup
+    refute_empty TreeSitter::QueryCursor.new.exec_packed(query, root, src)
+    src << "\n"
+    assert_equal "#{program}\n", src
+  end
 end
 
 describe 'querying anonymous nodes' do
@@ -220,6 +367,35 @@ describe 'matches' do
       _(m.keys.sort).must_equal %w[product product.left product.right sum sum.left]
       _(m.values.all? { |n| n.instance_of?(TreeSitter::Node) }).must_be_equal true
     end
+
+    hashes = TreeSitter::QueryCursor.new.matches(query, tree.root_node, src).each_capture_hash.to_a
+    hashes.first.each_key do |name|
+      _(query.capture_names.any? { |n| n.equal?(name) }).must_equal true
+    end
+
+    symbolized = TreeSitter::QueryCursor.new.matches(query, tree.root_node, src).each_capture_hash(symbolize: true).first
+    _(symbolized.keys.sort).must_equal %i[product product.left product.right sum sum.left]
+  end
+
+  it 'must tell the pattern of the last capture hash' do
+    src = <<~MATH
+      1 + x * 3
+    MATH
+    math = TreeSitter.lang('math')
+    parser = TreeSitter::Parser.new
+    parser.language = math
+    tree = parser.parse_string(nil, src)
+    query = TreeSitter::Query.new(math, '(number) @n (variable) @v')
+    cursor = TreeSitter::QueryCursor.new
+    cursor.exec(query, tree.root_node)
+    _(cursor.pattern_index).must_be_nil
+
+    patterns = []
+    while (hash = cursor.next_capture_hash(src, query.capture_names))
+      patterns << [hash.keys, cursor.pattern_index]
+    end
+    _(patterns).must_equal [[%w[n], 0], [%w[v], 1], [%w[n], 0]]
+    _(cursor.pattern_index).must_be_nil
   end
 end
 
@@ -273,6 +449,115 @@ describe 'query predicates' do
     end
   end
 
+  it 'should skip unsatisfied matches in next_match when given the source' do
+    src = <<~MATH
+      1 + x * 3
+    MATH
+    math = TreeSitter.lang('math')
+    parser = TreeSitter::Parser.new
+    parser.language = math
+    tree = parser.parse_string(nil, src)
+    q = TreeSitter::Query.new(math, '((number) @n (#eq? @n "3"))')
+
+    c = TreeSitter::QueryCursor.exec(q, tree.root_node)
+    assert_equal 2, [c.next_match, c.next_match].compact.size
+
+    c = TreeSitter::QueryCursor.exec(q, tree.root_node)
+    node = c.next_match(src).captures.first.node
+    assert_equal '3', src.byteslice(node.start_byte...node.end_byte)
+    assert_nil c.next_match(src)
+  end
+
+  it 'should attribute predicates to their own pattern' do
+    src = <<~MATH
+      1 + x * 3
+    MATH
+    math = TreeSitter.lang('math')
+    parser = TreeSitter::Parser.new
+    parser.language = math
+    tree = parser.parse_string(nil, src)
+    q = TreeSitter::Query.new(math, '(product) @p ((number) @n (#eq? @n "1"))')
+    c = TreeSitter::QueryCursor.new
+    assert_equal 2, c.matches(q, tree.root_node, src).count
+  end
+
+  it 'should expose #set! properties on matches' do
+    src = <<~MATH
+      1 + x * 3
+    MATH
+    math = TreeSitter.lang('math')
+    parser = TreeSitter::Parser.new
+    parser.language = math
+    tree = parser.parse_string(nil, src)
+    q = TreeSitter::Query.new(math, '((number) @n (#set! kind "literal") (#set! @n pure)) (variable) @v')
+
+    assert_equal({ 'kind' => 'literal', 'pure' => nil }, q.properties_for_pattern(0))
+    assert_empty q.properties_for_pattern(1)
+    assert_equal [%w[kind literal], ['pure', nil]], q.property_settings[0].map { |p| [p.key, p.value] }
+
+    c = TreeSitter::QueryCursor.exec(q, tree.root_node)
+    props = c.next_match.properties
+    assert_equal 'literal', props['kind']
+    assert props.frozen?
+  end
+
+  it 'should check #is? and #is-not? against the properties of the cursor' do
+    src = <<~MATH
+      1 + x * 3
+    MATH
+    math = TreeSitter.lang('math')
+    parser = TreeSitter::Parser.new
+    parser.language = math
+    tree = parser.parse_string(nil, src)
+    q = TreeSitter::Query.new(math, '((number) @n (#is? local)) ((variable) @v (#is-not? kind "param"))')
+    assert_equal [true, false], q.property_predicates.map { |preds| preds.first.last }
+
+    c = TreeSitter::QueryCursor.new
+    assert_equal 3, c.matches(q, tree.root_node).count
+
+    c.properties = { 'local' => true }
+    assert_equal 3, c.matches(q, tree.root_node).count
+
+    c.properties = { 'kind' => 'param' }
+    assert_equal 0, c.matches(q, tree.root_node).count
+
+    c.properties = nil
+    assert_equal 3, c.matches(q, tree.root_node).count
+  end
+
+  it 'should apply #is? to the whole cursor, regardless of its capture' do
+    src = <<~MATH
+      1 + x * 3
+    MATH
+    math = TreeSitter.lang('math')
+    parser = TreeSitter::Parser.new
+    parser.language = math
+    tree = parser.parse_string(nil, src)
+    q = TreeSitter::Query.new(math, '((number) @n (#is? @n local))')
+
+    c = TreeSitter::QueryCursor.new
+    c.properties = { 'local' => true }
+    assert_equal 2, c.matches(q, tree.root_node).count
+    c.properties = { 'kind' => true }
+    assert_equal 0, c.matches(q, tree.root_node).count
+  end
+
+  it 'should keep the previous properties when converting new ones raises' do
+    bad = Object.new
+    def bad.to_s = raise(ArgumentError, 'no string')
+
+    c = TreeSitter::QueryCursor.new
+    c.properties = { 'local' => true }
+    _ { c.properties = { 'kind' => 'param', bad => true } }.must_raise ArgumentError
+    assert_equal({ 'local' => true }, c.properties)
+  end
+
+  it 'should validate property predicates' do
+    _ { TreeSitter::Query.new(ruby, '((identifier) @id (#set!))') }.must_raise ArgumentError
+    _ { TreeSitter::Query.new(ruby, '((identifier) @id (#is? @id @id))') }.must_raise ArgumentError
+    _ { TreeSitter::Query.new(ruby, '((identifier) @id (#set! a b c))') }.must_raise ArgumentError
+  end
+
   it 'should handle `any-` predicates without quantification' do
     src = <<~MATH
       1 + x * 3 * 4 * 5
@@ -287,8 +572,8 @@ describe 'query predicates' do
       { matches: 3, captures: 3, query: '((product) @p (#any-not-eq? @p "x * 3"))' },
       { matches: 3, captures: 3, query: '((product) @p (#any-match? @p "aaaa"))' },
       { matches: 3, captures: 3, query: '((product) @p (#any-not-match? @p "aaaa"))' },
-      { matches: 3, captures: 3, query: '((product) @p (#any-of? @p "aaaa" "xxxx"))' },
-      { matches: 2, captures: 2, query: '((product) @p (#any-of? @p "x * 3" "xxxx"))' },
+      { matches: 0, captures: 0, query: '((product) @p (#any-of? @p "aaaa" "xxxx"))' },
+      { matches: 1, captures: 1, query: '((product) @p (#any-of? @p "x * 3" "xxxx"))' },
       { matches: 2, captures: 2, query: '((product) @p (#not-any-of? @p "x * 3" "xxxx"))' },
       { matches: 3, captures: 3, query: '((product) @p (#not-any-of? @p "aaaa" "xxxx"))' },
     ].each do |t|
@@ -332,12 +617,12 @@ describe 'query predicates' do
       { matches: 17, captures: 3, query: '((product)? @p (#any-not-match? @p "\\\d?"))' },
       { matches: 17, captures: 3, query: '((product)* @p (#any-not-match? @p "\\\d?"))' },
 
-      { matches: 2, captures: 2, query: '((product)+ @p (#any-of? @p "x * 3" "xxxx"))' },
-      { matches: 3, captures: 3, query: '((product)+ @p (#any-of? @p "aaaa" "xxxx"))' },
-      { matches: 16, captures: 2, query: '((product)? @p (#any-of? @p "x * 3" "xxxx"))' },
-      { matches: 17, captures: 3, query: '((product)? @p (#any-of? @p "aaaa" "xxxx"))' },
-      { matches: 16, captures: 2, query: '((product)* @p (#any-of? @p "x * 3" "xxxx"))' },
-      { matches: 17, captures: 3, query: '((product)* @p (#any-of? @p "aaaa" "xxxx"))' },
+      { matches: 1, captures: 1, query: '((product)+ @p (#any-of? @p "x * 3" "xxxx"))' },
+      { matches: 0, captures: 0, query: '((product)+ @p (#any-of? @p "aaaa" "xxxx"))' },
+      { matches: 15, captures: 1, query: '((product)? @p (#any-of? @p "x * 3" "xxxx"))' },
+      { matches: 14, captures: 0, query: '((product)? @p (#any-of? @p "aaaa" "xxxx"))' },
+      { matches: 15, captures: 1, query: '((product)* @p (#any-of? @p "x * 3" "xxxx"))' },
+      { matches: 14, captures: 0, query: '((product)* @p (#any-of? @p "aaaa" "xxxx"))' },
 
       { matches: 3, captures: 3, query: '((product)+ @p (#any-not-of? @p "x * 3" "xxxx"))' },
       { matches: 3, captures: 3, query: '((product)+ @p (#any-not-of? @p "aaaa" "xxxx"))' },
@@ -401,3 +686,119 @@ describe 'query predicates' do
     end
   end
 end
+
+describe 'profiling' do
+  before do
+    @query = TreeSitter::Query.new(ruby, <<~QUERY)
+      ((identifier) @id (#eq? @id "res"))
+      (integer) @int
+    QUERY
+  end
+
+  it 'must not profile by default' do
+    cursor = TreeSitter::QueryCursor.new
+    refute cursor.profiling?
+    assert_nil cursor.profile
+  end
+
+  it 'must count matches per pattern' do
+    cursor = TreeSitter::QueryCursor.new
+    cursor.profiling = true
+    cursor.matches(@query, root, program).to_a
+    profile = cursor.profile
+    assert_equal 2 * TreeSitter::QueryCursor::PROFILE_FIELDS.size, profile.size
+
+    matches, accepted, text_rejected, property_rejected = profile
+    assert_equal 3, accepted
+    assert_equal matches, accepted + text_rejected
+    assert_equal 0, property_rejected
+    assert_equal [0, 0, 0, 0, 0], profile[5...10]
+  end
+
+  it 'must accumulate over executions of the same query' do
+    cursor = TreeSitter::QueryCursor.new
+    cursor.profiling = true
+    2.times { cursor.matches(@query, root, program).to_a }
+    assert_equal 6, cursor.profile[1]
+
+    cursor.profiling = true
+    assert_equal 0, cursor.profile[1]
+  end
+
+  it 'must report the cost of every pattern' do
+    seen = []
+    profile = @query.profile([tree, tree], [program, program]) { |match| seen << match.pattern_index }
+    assert_equal [0] * 6, seen
+    assert_equal 2, profile.patterns.size
+
+    pattern = profile.patterns.first
+    assert_equal 0, pattern.index
+    assert_equal 6, pattern.accepted
+    assert_operator pattern.rejection_rate, :>, 0
+    assert_operator pattern.ruby_ns, :>, 0
+    assert_equal pattern, profile.slowest(1).first
+    assert_match(/\d+ matches in/, profile.report)
+  end
+
+  it 'must reject mismatched sources' do
+    assert_raises(ArgumentError) { @query.profile([tree, tree], [program]) }
+  end
+end
+
+describe 'pooled cursors' do
+  before do
+    @query = TreeSitter::Query.new(ruby, capture)
+    TreeSitter::QueryCursor::POOL.clear
+  end
+
+  it 'must reuse cursors within a thread' do
+    first = TreeSitter::QueryCursor.with { |cursor| cursor }
+    second = TreeSitter::QueryCursor.with { |cursor| cursor }
+    assert_same first, second
+    assert_equal 1, TreeSitter::QueryCursor::POOL.idle_size
+  end
+
+  it 'must give distinct cursors to nested blocks' do
+    TreeSitter::QueryCursor.with do |outer|
+      TreeSitter::QueryCursor.with { |inner| refute_same outer, inner }
+    end
+    assert_equal 2, TreeSitter::QueryCursor::POOL.idle_size
+  end
+
+  it 'must not share cursors between threads' do
+    mine = TreeSitter::QueryCursor.with { |cursor| cursor }
+    theirs = Thread.new { TreeSitter::QueryCursor.with { |cursor| cursor } }.value
+    refute_same mine, theirs
+  end
+
+  it 'must return the value of the block and give the cursor back on raise' do
+    assert_equal 42, TreeSitter::QueryCursor.with { |_| 42 }
+    assert_raises(RuntimeError) { TreeSitter::QueryCursor.with { |_| raise 'boom' } }
+    assert_equal 1, TreeSitter::QueryCursor::POOL.idle_size
+  end
+
+  it 'must reset cursors given back' do
+    TreeSitter::QueryCursor.with do |cursor|
+      cursor.match_limit = 1
+      cursor.properties = { 'local' => true }
+      cursor.profiling = true
+      cursor.exec(@query, root, byte_range: 0...4)
+    end
+    TreeSitter::QueryCursor.with do |cursor|
+      assert_equal 0xFFFFFFFF, cursor.match_limit
+      assert_nil cursor.properties
+      refute_predicate cursor, :profiling?
+      assert_nil cursor.next_match
+      assert_equal TreeSitter::QueryCursor.new.matches(@query, root, program).count,
+                   cursor.matches(@query, root, program).count
+    end
+  end
+
+  it 'must find the same matches as a new cursor' do
+    expected = TreeSitter::QueryCursor.new.matches(@query, root, program).map { |m| m.captures.map(&:node) }
+    3.times do
+      actual = TreeSitter::QueryCursor.with { |cursor| cursor.matches(@query, root, program).map { |m| m.captures.map(&:node) } }
+      assert_equal expected, actual
+    end
+  end
+end
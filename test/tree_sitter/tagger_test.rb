@@ -0,0 +1,82 @@
+# frozen_string_literal: true
+
+require_relative '../test_helper'
+
+ruby = TreeSitter.lang('ruby')
+parser = TreeSitter::Parser.new
+parser.language = ruby
+
+program = <<~RUBY
+  # unrelated
+
+  # Multiplies.
+  # Really.
+  def mul(a, b)
+    a * b
+  end
+
+  mul(1, 2)
+RUBY
+
+tree = parser.parse_string(nil, program)
+root = tree.root_node
+
+tags = <<~'QUERY'
+  (
+    (comment)* @doc
+    .
+    (method name: (identifier) @name) @definition.method
+    (#strip! @doc "^#\\s*")
+    (#select-adjacent! @doc @definition.method)
+  )
+  (call method: (identifier) @name) @reference.call
+QUERY
+
+describe 'tagger' do
+  before do
+    @tagger = TreeSitter::Tagger.new(ruby, tags)
+  end
+
+  it 'must collect the kinds of tags' do
+    assert_equal %w[method call], @tagger.kinds
+  end
+
+  it 'must tag definitions and references' do
+    definition, reference = @tagger.tags(root, program)
+
+    assert_equal 'method', definition.kind
+    assert definition.definition?
+    assert_equal 'mul', program.byteslice(definition.name_range)
+    assert program.byteslice(definition.range).start_with?('def mul')
+    assert_equal 4, definition.row
+
+    assert_equal 'call', reference.kind
+    refute reference.definition?
+    assert_equal 8, reference.row
+    assert_nil reference.docs
+  end
+
+  it 'must strip and select adjacent docs' do
+    assert_equal "Multiplies.\nReally.", @tagger.tags(root, program).first.docs
+  end
+
+  it 'must export packed tags' do
+    packed = @tagger.tags_packed(root, program)
+    assert_equal 2 * TreeSitter::Tagger::FIELDS.size, packed.size
+    assert_equal [0, 1], packed.first(2)
+  end
+
+  it 'must keep every adjacent doc' do
+    src = "#{(1..100).map { |i| "# #{i}" }.join("\n")}\ndef f; end\n"
+    docs = @tagger.tags(parser.parse_string(nil, src).root_node, src).first.docs
+    assert_equal (1..100).map(&:to_s).join("\n"), docs
+  end
+
+  it 'must not be initialized twice' do
+    _ { @tagger.send(:initialize, ruby, tags) }.must_raise RuntimeError
+  end
+
+  it 'must validate its predicates' do
+    _ { TreeSitter::Tagger.new(ruby, '((comment) @doc (#strip! @doc))') }.must_raise ArgumentError
+  end
+end
@@ -81,3 +81,93 @@ describe 'TreeCursor should work properly' do
     refute_equal @cursor, @cursor.copy
   end
 end
+
+describe 'TreeCursor#walk' do
+  before do
+    @cursor = TreeSitter::TreeCursor.new(root)
+  end
+
+  it 'must yield the same view at every step' do
+    views = []
+    @cursor.walk { |view| views << view }
+    assert_equal root.descendant_count, views.size
+    assert_equal 1, views.uniq(&:object_id).size
+  end
+
+  it 'must walk in pre-order with relative depths' do
+    steps = []
+    @cursor.each_step { |view| steps << [view.type, view.depth] }
+    assert_equal [:program, 0], steps[0]
+    assert_equal [:method, 1], steps[1]
+    assert_equal [:def, 2], steps[2]
+  end
+
+  it 'must agree with the nodes it stands for' do
+    @cursor.walk do |view|
+      node = view.to_node
+      assert_equal node.type, view.type
+      assert_equal node.start_byte, view.start_byte
+      assert_equal node.end_byte, view.end_byte
+      assert_equal node.named?, view.named?
+      assert_equal program.byteslice(node.start_byte...node.end_byte), view.text(program)
+    end
+  end
+
+  it 'must report field names' do
+    fields = []
+    @cursor.walk { |view| fields << view.field_name if view.field_name }
+    assert_includes fields, :name
+    assert_includes fields, :parameters
+  end
+
+  it 'must skip children' do
+    types = []
+    @cursor.walk do |view|
+      types << view.type
+      view.skip_children! if view.type == :method
+    end
+    assert_equal %i[program method], types
+  end
+
+  it 'must keep nodes past the walk' do
+    nodes = []
+    @cursor.walk { |view| nodes << view.to_node if view.type == :identifier }
+    assert_equal %w[mul a b res a b puts res inspect res], nodes.map { |n| program.byteslice(n.start_byte...n.end_byte) }
+  end
+
+  it 'must invalidate the view after the walk' do
+    kept = nil
+    @cursor.walk { |view| kept = view }
+    assert_raises(RuntimeError) { kept.type }
+  end
+
+  it 'must not move the cursor' do
+    @cursor.walk { |_| nil }
+    assert_equal root, @cursor.current_node
+  end
+
+  it 'must return an enumerator without a block' do
+    assert_equal root.descendant_count, @cursor.walk.count
+  end
+
+  it 'must keep the tree alive during the walk' do
+    expected = @cursor.walk.map(&:type)
+    types = []
+    TreeSitter::TreeCursor.new(parser.parse_string(nil, program).root_node).walk do |view|
+      GC.start
+      types << view.type
+      view.to_node if view.type == :identifier
+    end
+    assert_equal expected, types
+  end
+end
+
+describe 'TreeCursor.with' do
+  it 'must reuse cursors, reset to the given node' do
+    first = TreeSitter::TreeCursor.with(root) { |cursor| cursor.goto_first_child && cursor }
+    TreeSitter::TreeCursor.with(root.child(0)) do |cursor|
+      assert_same first, cursor
+      assert_equal root.child(0), cursor.current_node
+    end
+  end
+end
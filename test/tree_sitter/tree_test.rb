@@ -1,5 +1,7 @@
 # frozen_string_literal: true
 
+require 'objspace'
+
 require_relative '../test_helper'
 
 ruby = TreeSitter.lang('ruby')
@@ -47,5 +49,21 @@ describe 'print_dot_graph' do
   end
 end
 
+describe 'memsize' do
+  it 'must account for the memory allocated by tree-sitter' do
+    fresh = parser.parse_string(nil, program * 10)
+    assert_operator ObjectSpace.memsize_of(fresh), :>, ObjectSpace.memsize_of(fresh.copy)
+  end
+
+  it 'must expose process-wide memory stats' do
+    stats = TreeSitter.memory_stats
+    %i[live_bytes peak_bytes total_bytes allocations frees].each do |k|
+      assert_kind_of Integer, stats[k]
+    end
+    assert_operator stats[:live_bytes], :>, 0
+    assert_operator stats[:peak_bytes], :>=, stats[:live_bytes]
+  end
+end
+
 # TODO: edit
 # TODO: changed_ranges
@@ -0,0 +1,63 @@
+# frozen_string_literal: true
+
+require_relative '../test_helper'
+
+ruby = TreeSitter.lang('ruby')
+
+describe 'warmup' do
+  it 'must load languages and their tables' do
+    TreeSitter.warmup(languages: %w[ruby])
+    assert TreeSitter.language_registry.loaded?('ruby')
+    assert_same ruby.symbol_names, ruby.symbol_names
+    assert_equal ruby.symbol_count, ruby.symbol_names.size
+    assert_nil ruby.field_names.first
+    assert_equal ruby.field_id_for_name('name'), ruby.field_names.index(:name)
+  end
+
+  it 'must compile queries into the cache' do
+    source = '(identifier) @warm'
+    queries = TreeSitter.warmup(queries: { 'ruby' => source })
+    query = queries['ruby'].first
+    assert_same query, TreeSitter.query_cache.fetch(ruby, source)
+    assert_equal %i[warm], query.capture_symbols
+  end
+
+  it 'must raise on invalid queries' do
+    _ { TreeSitter.warmup(queries: { 'ruby' => '(nope' }) }.must_raise TreeSitter::QueryCreationError
+  end
+end
+
+describe 'after_fork' do
+  before do
+    @hooks = []
+  end
+
+  after do
+    @hooks.each { |hook| TreeSitter.remove_after_fork(hook) }
+  end
+
+  it 'must require a block' do
+    _ { TreeSitter.after_fork }.must_raise ArgumentError
+  end
+
+  it 'must run hooks in forked children' do
+    skip 'fork is not supported' if !Process.respond_to?(:fork)
+
+    reader, writer = IO.pipe
+    @hooks << TreeSitter.after_fork { writer.write('forked') if !writer.closed? }
+    pid = fork do
+      writer.close
+      exit!(0)
+    end
+    writer.close
+    Process.wait(pid)
+    assert_equal 'forked', reader.read
+  end
+
+  it 'must unregister hooks' do
+    hook = TreeSitter.after_fork { nil }
+    @hooks << hook
+    assert_same hook, TreeSitter.remove_after_fork(hook)
+    assert_nil TreeSitter.remove_after_fork(hook)
+  end
+end
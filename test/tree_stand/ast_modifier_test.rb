@@ -29,4 +29,149 @@ class AstModifierTest < Minitest::Test
       1 - x + 5
     MATH
   end
+
+  def test_rewrite_applies_all_the_edits_of_a_pass_at_once
+    tree = @parser.parse_string(<<~MATH)
+      1 + x * 3 - x - 2 * 4 + 5
+    MATH
+
+    applied = TreeStand::AstModifier.new(tree).rewrite('(number) @n') do |ast, match|
+      node = match['n']
+      ast.replace(node, (node.text.to_i * 10).to_s)
+    end
+
+    assert_equal 5, applied
+    assert_equal(<<~MATH, tree.document)
+      10 + x * 30 - x - 20 * 40 + 50
+    MATH
+    assert_equal @parser.parse_string(tree.document).root_node.sexpr, tree.root_node.sexpr
+  end
+
+  def test_rewrite_inserts_and_removes
+    tree = @parser.parse_string(<<~MATH)
+      1 * x + 3
+    MATH
+
+    TreeStand::AstModifier.new(tree).rewrite('(variable) @v') do |ast, match|
+      ast.insert_before(match['v'], '(')
+      ast.insert_after(match['v'], ' + 1)')
+    end
+
+    assert_equal(<<~MATH, tree.document)
+      1 * (x + 1) + 3
+    MATH
+    assert_equal @parser.parse_string(tree.document).root_node.sexpr, tree.root_node.sexpr
+  end
+
+  def test_rewrite_rejects_overlapping_edits
+    tree = @parser.parse_string(<<~MATH)
+      1 * x + 3
+    MATH
+
+    assert_raises(TreeStand::OverlappingEdits) do
+      TreeStand::AstModifier.new(tree).rewrite('(product (number) @n) @p') do |ast, match|
+        ast.replace(match['p'], 'y')
+        ast.replace(match['n'], '2')
+      end
+    end
+    assert_equal(<<~MATH, tree.document)
+      1 * x + 3
+    MATH
+  end
+
+  def test_rewrite_to_a_fixpoint
+    tree = @parser.parse_string(<<~MATH)
+      x + 2 * 3 * 4
+    MATH
+
+    fold = lambda do |fixpoint|
+      TreeStand::AstModifier.new(tree).rewrite('(product (number) @a (number) @b) @p', fixpoint:) do |ast, match|
+        ast.replace(match['p'], (match['a'].text.to_i * match['b'].text.to_i).to_s)
+      end
+    end
+
+    assert_equal 1, fold.call(false)
+    assert_equal(<<~MATH, tree.document)
+      x + 6 * 4
+    MATH
+
+    assert_equal 1, fold.call(true)
+    assert_equal(<<~MATH, tree.document)
+      x + 24
+    MATH
+    assert_equal @parser.parse_string(tree.document).root_node.sexpr, tree.root_node.sexpr
+  end
+
+  def test_rewrite_to_a_fixpoint_with_sequences_of_siblings
+    tree = TreeStand::Parser.new('ruby').parse_string(<<~RUBY)
+      1
+      2
+      x
+    RUBY
+
+    query = '((integer) @a . (integer) @b . (integer) @c) ((identifier) @x)'
+    applied = TreeStand::AstModifier.new(tree).rewrite(query, fixpoint: true) do |ast, match|
+      if match['x']
+        ast.replace(match['x'], '3')
+      else
+        a, c = match.values_at('a', 'c')
+        range = TreeStand::Range.new(
+          start_byte: a.range.start_byte,
+          end_byte: c.range.end_byte,
+          start_point: a.range.start_point,
+          end_point: c.range.end_point,
+        )
+        ast.replace(range, match.values.sum { |n| n.text.to_i }.to_s)
+      end
+    end
+
+    assert_equal 2, applied
+    assert_equal("6\n", tree.document)
+  end
+
+  def test_rewrite_forgets_the_edits_of_a_failed_pass
+    tree = @parser.parse_string(<<~MATH)
+      1 + 2
+    MATH
+    ast = TreeStand::AstModifier.new(tree)
+
+    assert_raises(RuntimeError) do
+      ast.rewrite('(number) @n') do |mod, match|
+        mod.replace(match['n'], '0')
+        raise 'boom' if match['n'].text == '2'
+      end
+    end
+    assert_empty ast.edits
+
+    assert_equal 2, ast.rewrite('(number) @n') { |mod, match| mod.replace(match['n'], '7') }
+    assert_equal(<<~MATH, tree.document)
+      7 + 7
+    MATH
+  end
+
+  def test_rewrite_refuses_pending_edits
+    tree = @parser.parse_string(<<~MATH)
+      1 + 2
+    MATH
+    ast = TreeStand::AstModifier.new(tree)
+    ast.replace(tree.root_node.find_node!('(number) @n'), '3')
+
+    assert_raises(TreeStand::Error) { ast.rewrite('(number) @n') { nil } }
+    assert_equal 1, ast.edits.size
+  end
+
+  def test_rewrite_gives_up_after_max_passes
+    tree = @parser.parse_string(<<~MATH)
+      1
+    MATH
+
+    assert_raises(TreeStand::Error) do
+      TreeStand::AstModifier.new(tree).rewrite('(number) @n', fixpoint: true, max_passes: 3) do |ast, match|
+        ast.replace(match['n'], (match['n'].text.to_i + 1).to_s)
+      end
+    end
+    assert_equal(<<~MATH, tree.document)
+      4
+    MATH
+  end
 end
@@ -204,6 +204,33 @@ class NodeTest < Minitest::Test
     assert_equal('1 + x * 3', matches.dig(1, 'sum').text)
   end
 
+  def test_query_with_limit
+    tree = @parser.parse_string(<<~MATH)
+      1 + x * 3 + 2 * 4
+    MATH
+
+    assert_equal(4, tree.query('(number) @number').size)
+    matches = tree.query('(number) @number', limit: 2)
+    assert_equal(%w[1 3], matches.map { |m| m['number'].text })
+  end
+
+  def test_query_each_is_lazy
+    tree = @parser.parse_string(<<~MATH)
+      1 + x * 3 + 2 * 4
+    MATH
+
+    enum = tree.query_each('(product) @product')
+    assert_kind_of(Enumerator, enum)
+    assert_equal('x * 3', enum.first['product'].text)
+
+    texts = []
+    tree.query_each('(number) @number') do |m|
+      texts << m['number'].text
+      break if texts.size == 2
+    end
+    assert_equal(%w[1 3], texts)
+  end
+
   def test_error_nodes
     tree = @parser.parse_string(<<~MATH)
       1 ++ x
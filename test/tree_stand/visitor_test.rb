@@ -189,4 +189,115 @@ class VisitorTest < Minitest::Test
       acc,
     )
   end
+
+  class NumberCounter < TreeStand::Visitor
+    attr_reader :count
+
+    def initialize(node)
+      super
+      @count = 0
+    end
+
+    def on_number(_node)
+      @count += 1
+    end
+  end
+
+  def test_class_hooks
+    tree = @parser.parse_string(<<~MATH)
+      1 * x + 3
+    MATH
+
+    assert_equal 2, NumberCounter.new(tree.root_node).visit.count
+  end
+
+  def test_dispatch_tables_are_compiled_once_per_class_and_language
+    language = @parser.ts_language
+    tables = NumberCounter.dispatch_tables(language)
+
+    assert_same tables, NumberCounter.dispatch_tables(language)
+    on, around = tables
+    assert_equal language.symbol_count + 1, on.size
+    assert_equal(:on_number, on[language.symbol_names.index(:number)])
+    assert(around.none?)
+  end
+
+  def test_dispatch_tables_see_hooks_added_later
+    tree = @parser.parse_string(<<~MATH)
+      1 * x + 3
+    MATH
+
+    klass = Class.new(TreeStand::Visitor) do
+      attr_reader :acc
+
+      def initialize(node)
+        super
+        @acc = []
+      end
+    end
+    assert_empty klass.new(tree.root_node).visit.acc
+
+    klass.define_method(:on_variable) { |node| @acc << node.text }
+    assert_equal %w[x], klass.new(tree.root_node).visit.acc
+  end
+
+  def test_dispatch_tables_see_hooks_of_modules_included_later
+    tree = @parser.parse_string(<<~MATH)
+      1 * x + 3
+    MATH
+
+    klass = Class.new(TreeStand::Visitor) do
+      attr_reader :acc
+
+      def initialize(node)
+        super
+        @acc = []
+      end
+    end
+    assert_empty klass.new(tree.root_node).visit.acc
+
+    klass.include(Module.new { def on_variable(node) = @acc << node.text })
+    assert_equal %w[x], klass.new(tree.root_node).visit.acc
+
+    klass.prepend(Module.new { def on_number(node) = @acc << node.text })
+    assert_equal %w[1 x 3], klass.new(tree.root_node).visit.acc
+  end
+
+  def test_hooks_of_extended_visitors
+    tree = @parser.parse_string(<<~MATH)
+      1 * x + 3
+    MATH
+
+    visitor = NumberCounter.new(tree.root_node)
+    visitor.extend(Module.new { def on_variable(_node) = @count += 10 })
+    assert_equal 12, visitor.visit.count
+  end
+
+  def test_hooks_receive_tree_stand_nodes
+    tree = @parser.parse_string(<<~MATH)
+      1 * x + 3
+    MATH
+
+    acc = []
+    visitor = TreeStand::Visitor.new(tree.root_node)
+    visitor.define_singleton_method(:on_number) { |node| acc << node }
+    visitor.visit
+
+    assert(acc.all?(TreeStand::Node))
+    assert_equal %w[1 3], acc.map(&:text)
+  end
+
+  def test_visiting_a_subtree
+    tree = @parser.parse_string(<<~MATH)
+      1 * x + 3
+    MATH
+
+    product = tree.root_node.find_node('(product) @p')
+    acc = []
+    visitor = TreeStand::Visitor.new(product)
+    visitor.define_singleton_method(:on) { |node| acc << node.type }
+    visitor.visit
+
+    assert_equal %i[product number * variable], acc
+  end
 end